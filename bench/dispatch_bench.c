@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "chunk.h"
+#include "common.h"
+#include "vm.h"
+
+#define BLOCKS 250000
+#define RUNS 20
+
+/**
+ * Build an arithmetic heavy chunk
+ *
+ * The chunk cycles through every arithmetic instruction so
+ * that the dispatcher sees a realistic mix of opcodes rather
+ * than the same handler over and over. The constants are
+ * picked to keep the running value bounded.
+ */
+static void chunk_build(Chunk* chunk)
+{
+    int one = chunk_constant_add(chunk, NUMBER_VAL(1.0));
+    int two = chunk_constant_add(chunk, NUMBER_VAL(2.0));
+    int three = chunk_constant_add(chunk, NUMBER_VAL(3.0));
+
+    chunk_write(chunk, OP_CONSTANT, 1);
+    chunk_write(chunk, one, 1);
+
+    for (int i = 0; i < BLOCKS; i++)
+    {
+        chunk_write(chunk, OP_CONSTANT, 1);
+        chunk_write(chunk, three, 1);
+        chunk_write(chunk, OP_ADD, 1);
+        chunk_write(chunk, OP_CONSTANT, 1);
+        chunk_write(chunk, two, 1);
+        chunk_write(chunk, OP_MULTIPLY, 1);
+        chunk_write(chunk, OP_CONSTANT, 1);
+        chunk_write(chunk, one, 1);
+        chunk_write(chunk, OP_SUBTRACT, 1);
+        chunk_write(chunk, OP_NEGATE, 1);
+        chunk_write(chunk, OP_CONSTANT, 1);
+        chunk_write(chunk, two, 1);
+        chunk_write(chunk, OP_DIVIDE, 1);
+    }
+
+    chunk_write(chunk, OP_RETURN, 1);
+}
+
+int main()
+{
+    Chunk chunk;
+    chunk_init(&chunk);
+    chunk_build(&chunk);
+
+    VM vm;
+    vm_init(&vm);
+
+    clock_t start = clock();
+    for (int i = 0; i < RUNS; i++)
+    {
+        vm_interpret_chunk(&vm, &chunk);
+    }
+    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    // Each block is nine instructions.
+    double instructions = (double)RUNS * (BLOCKS * 9.0 + 2.0);
+
+#ifdef COMPUTED_GOTO
+    const char* mode = "computed goto";
+#else
+    const char* mode = "switch";
+#endif
+
+    printf("%s: %.3f s, %.2f ns/instruction\n",
+        mode, elapsed, elapsed * 1e9 / instructions);
+
+    vm_free(&vm);
+    chunk_free(&chunk);
+    return 0;
+}
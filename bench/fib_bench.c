@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "chunk.h"
+#include "common.h"
+#include "compiler.h"
+#include "vm.h"
+
+#define DEPTH 30
+#define RUNS 5
+
+/**
+ * Generate a script computing a Fibonacci number through calls
+ *
+ * The language has no conditionals yet, so instead of one
+ * recursive function there is a function per level, each
+ * calling the two below it. The calls form the same tree as
+ * recursive fib and nearly all of the work is setting up and
+ * tearing down frames. Every function takes `parameters`
+ * arguments and passes them on.
+ */
+static char* source_generate(int parameters)
+{
+    char* source = malloc((size_t)DEPTH * 256);
+    char* cursor = source;
+
+    char list[64] = "";
+    char* end = list;
+    for (int i = 0; i < parameters; i++)
+    {
+        end += sprintf(end, i == 0 ? "a%d" : ", a%d", i);
+    }
+
+    cursor += sprintf(cursor, "fn fib0(%s) { return 1; }\n", list);
+    cursor += sprintf(cursor, "fn fib1(%s) { return 1; }\n", list);
+    for (int i = 2; i <= DEPTH; i++)
+    {
+        cursor += sprintf(cursor, "fn fib%d(%s) { return fib%d(%s) + fib%d(%s); }\n",
+            i, list, i - 1, list, i - 2, list);
+    }
+
+    char arguments[64] = "";
+    end = arguments;
+    for (int i = 0; i < parameters; i++)
+    {
+        end += sprintf(end, i == 0 ? "%d" : ", %d", i);
+    }
+    sprintf(cursor, "let result = fib%d(%s);\n", DEPTH, arguments);
+
+    return source;
+}
+
+/**
+ * Time the calls with a given number of arguments
+ *
+ * @return the best time over RUNS runs, in nanoseconds per call
+ */
+static double calls_time(int parameters, long calls)
+{
+    char* source = source_generate(parameters);
+
+    VM vm;
+    vm_init(&vm);
+
+    Chunk chunk;
+    chunk_init(&chunk);
+    if (!compile(&vm, source, &chunk))
+    {
+        fprintf(stderr, "Benchmark source failed to compile.\n");
+        exit(1);
+    }
+
+    double best = 0.0;
+    for (int run = 0; run < RUNS; run++)
+    {
+        clock_t start = clock();
+        if (vm_interpret_chunk(&vm, &chunk) != INTERPRET_OK) exit(1);
+        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+
+    chunk_free(&chunk);
+    vm_free(&vm);
+    free(source);
+    return best * 1e9 / (double)calls;
+}
+
+int main()
+{
+    // fib(n) as computed here makes 2 * fib(n) - 1 calls.
+    long previous = 1;
+    long current = 1;
+    for (int i = 2; i <= DEPTH; i++)
+    {
+        long next = previous + current;
+        previous = current;
+        current = next;
+    }
+    long calls = 2 * current - 1;
+
+    printf("%-24s %10ld\n", "calls:", calls);
+    printf("%-24s %10.2f ns/call\n", "1 argument, OP_CALL_1:", calls_time(1, calls));
+    printf("%-24s %10.2f ns/call\n", "3 arguments, OP_CALL_3:", calls_time(3, calls));
+    printf("%-24s %10.2f ns/call\n", "4 arguments, OP_CALL:", calls_time(4, calls));
+    return 0;
+}
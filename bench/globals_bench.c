@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chunk.h"
+#include "common.h"
+#include "compiler.h"
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+#define GLOBALS 64
+#define STATEMENTS 200000
+#define RUNS 20
+
+// Which globals each statement reads and writes.
+static int accesses[STATEMENTS][3];
+
+/**
+ * Generate a script that shuffles numbers between variables
+ *
+ * Every statement reads two variables and assigns a third, so
+ * nearly all of the work is variable access. Wrapped in a block
+ * the same variables are locals instead of globals.
+ */
+static char* source_generate(bool local)
+{
+    char* source = malloc((size_t)(GLOBALS + STATEMENTS) * 32);
+    char* cursor = source;
+
+    if (local) *cursor++ = '{';
+    for (int i = 0; i < GLOBALS; i++)
+    {
+        cursor += sprintf(cursor, "let g%d = %d;\n", i, i);
+    }
+
+    srand(1);
+    for (int i = 0; i < STATEMENTS; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            accesses[i][j] = rand() % GLOBALS;
+        }
+        cursor += sprintf(cursor, "g%d = g%d - g%d;\n", accesses[i][0], accesses[i][1], accesses[i][2]);
+    }
+    if (local) *cursor++ = '}';
+    *cursor = '\0';
+
+    return source;
+}
+
+/**
+ * Time the compiled script
+ *
+ * The chunk is compiled once and run repeatedly. Each run
+ * redefines the variables, so every run does the same work.
+ */
+static double script_time(VM* vm, Chunk* chunk)
+{
+    double best = 0.0;
+    for (int run = 0; run < RUNS; run++)
+    {
+        clock_t start = clock();
+        vm_interpret_chunk(vm, chunk);
+        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+/**
+ * Time looking the same globals up by name
+ *
+ * This is the hash table work an interpreter that resolves
+ * globals at runtime would do for the same script, on top of
+ * everything else it does. The names are interned already, as
+ * they would be in the constant table.
+ */
+static double lookup_time(VM* vm)
+{
+    ObjString* names[GLOBALS];
+    Table table;
+    table_init(&table);
+
+    char name[16];
+    for (int i = 0; i < GLOBALS; i++)
+    {
+        int length = snprintf(name, sizeof(name), "g%d", i);
+        names[i] = string_copy(vm, name, length);
+        table_set(&table, names[i], NUMBER_VAL(i));
+    }
+
+    double best = 0.0;
+    for (int run = 0; run < RUNS; run++)
+    {
+        clock_t start = clock();
+        for (int i = 0; i < STATEMENTS; i++)
+        {
+            Value a;
+            Value b;
+            table_get(&table, names[accesses[i][1]], &a);
+            table_get(&table, names[accesses[i][2]], &b);
+            table_set(&table, names[accesses[i][0]], NUMBER_VAL(AS_NUMBER(a) - AS_NUMBER(b)));
+        }
+        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+
+    table_free(&table);
+    return best;
+}
+
+/**
+ * Compile a generated script and time it
+ */
+static double source_time(VM* vm, bool local)
+{
+    char* source = source_generate(local);
+
+    Chunk chunk;
+    chunk_init(&chunk);
+    if (!compile(vm, source, &chunk))
+    {
+        fprintf(stderr, "Benchmark source failed to compile.\n");
+        exit(1);
+    }
+
+    double best = script_time(vm, &chunk);
+
+    chunk_free(&chunk);
+    free(source);
+    return best;
+}
+
+int main()
+{
+    VM vm;
+    vm_init(&vm);
+
+    double globals = source_time(&vm, false);
+    double locals = source_time(&vm, true);
+    double lookups = lookup_time(&vm);
+
+    printf("statements:            %10d\n", STATEMENTS);
+    printf("slot globals:          %10.2f ns/statement\n", globals * 1e9 / STATEMENTS);
+    printf("stack locals:          %10.2f ns/statement\n", locals * 1e9 / STATEMENTS);
+    printf("name lookups alone:    %10.2f ns/statement\n", lookups * 1e9 / STATEMENTS);
+    printf("by name, at least:     %10.2fx slower\n", (globals + lookups) / globals);
+
+    vm_free(&vm);
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "scanner.h"
+
+#define WORDS 4000000
+#define RUNS 5
+
+/**
+ * Keywords, near misses and plain identifiers
+ *
+ * The near misses share a keyword's length and first and
+ * last characters, so they land in a keyword's slot and
+ * have to be rejected by the word compare.
+ */
+static const char* words[] = {
+    "let", "count", "if", "fn", "return", "total", "while", "index",
+    "for", "false", "fault", "this", "thus", "print", "point", "and",
+    "nil", "null", "else", "elite", "true", "tree", "super", "value",
+    "or", "on", "class", "clips", "result", "x", "node_next", "i",
+};
+
+static char* source_generate(size_t* length)
+{
+    int word_count = (int)(sizeof(words) / sizeof(words[0]));
+    char* source = malloc((size_t)WORDS * 16);
+    size_t used = 0;
+
+    srand(1);
+    for (int i = 0; i < WORDS; i++)
+    {
+        const char* word = words[rand() % word_count];
+        size_t word_length = strlen(word);
+        memcpy(source + used, word, word_length);
+        used += word_length;
+        source[used++] = i % 12 == 11 ? '\n' : ' ';
+    }
+    source[used] = '\0';
+
+    *length = used;
+    return source;
+}
+
+int main()
+{
+    size_t length;
+    char* source = source_generate(&length);
+
+    double best = 0.0;
+    long keywords = 0;
+
+    for (int run = 0; run < RUNS; run++)
+    {
+        Scanner scanner;
+        scanner_init(&scanner, source);
+
+        clock_t start = clock();
+        Token token;
+        keywords = 0;
+        do
+        {
+            token = token_scan(&scanner);
+            if (TOKEN_TYPE(token) != TOKEN_IDENTIFIER) keywords++;
+        } while (TOKEN_TYPE(token) != TOKEN_EOF);
+        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+
+    // The EOF token was counted along with the keywords.
+    keywords--;
+
+    printf("words:      %10d (%ld keywords)\n", WORDS, keywords);
+    printf("best run:   %10.3f s\n", best);
+    printf("per word:   %10.2f ns\n", best * 1e9 / WORDS);
+    printf("throughput: %10.1f MB/s\n", length / best / (1024.0 * 1024.0));
+
+    free(source);
+    return 0;
+}
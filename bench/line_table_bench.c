@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "common.h"
+#include "compiler.h"
+#include "vm.h"
+
+#define LINES 100000
+
+static const char* line_source = "nil + nil * nil - nil / nil + nil\n";
+
+/**
+ * Generate a print of a long multi-line expression
+ *
+ * Adding nil fails at runtime, so nothing here is folded
+ * away and every line compiles to a run of instructions.
+ */
+static char* source_generate()
+{
+    size_t length = strlen(line_source);
+    char* source = malloc(LINES * (length + 2) + 16);
+    char* cursor = source;
+
+    memcpy(cursor, "print ", 6);
+    cursor += 6;
+
+    for (int i = 0; i < LINES; i++)
+    {
+        if (i > 0)
+        {
+            memcpy(cursor, "+ ", 2);
+            cursor += 2;
+        }
+        memcpy(cursor, line_source, length);
+        cursor += length;
+    }
+    *cursor++ = ';';
+    *cursor = '\0';
+
+    return source;
+}
+
+int main()
+{
+    char* source = source_generate();
+
+    VM vm;
+    vm_init(&vm);
+
+    Chunk chunk;
+    chunk_init(&chunk);
+    if (!compile(&vm, source, &chunk))
+    {
+        fprintf(stderr, "Benchmark source failed to compile.\n");
+        return 1;
+    }
+
+    size_t per_byte = (size_t)chunk.count * sizeof(int);
+    size_t encoded = (size_t)chunk.line_count * sizeof(LineStart);
+
+    printf("code:             %9d bytes\n", chunk.count);
+    printf("line per byte:    %9zu bytes\n", per_byte);
+    printf("run-length table: %9zu bytes (%d runs)\n", encoded, chunk.line_count);
+    printf("reduction:        %8.1f%%\n", 100.0 * (1.0 - (double)encoded / per_byte));
+
+    chunk_free(&chunk);
+    vm_free(&vm);
+    free(source);
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "precompile.h"
+#include "token.h"
+
+#define SOURCE_BYTES (128 * 1024 * 1024)
+#define RUNS 3
+
+static const char* lines[] = {
+    "let total = (count + 1) * 2 - offset / 4; // running total\n",
+    "print \"a string literal that is a little on the long side\";\n",
+    "let banner = \"a string\n    that spans\n    a few lines\";\n",
+    "\n",
+};
+
+static char* source_generate(size_t* length)
+{
+    int line_count = (int)(sizeof(lines) / sizeof(lines[0]));
+    char* source = malloc(SOURCE_BYTES + 256);
+    size_t used = 0;
+
+    for (int i = 0; used < SOURCE_BYTES; i = (i + 1) % line_count)
+    {
+        size_t line_length = strlen(lines[i]);
+        memcpy(source + used, lines[i], line_length);
+        used += line_length;
+    }
+    source[used] = '\0';
+
+    *length = used;
+    return source;
+}
+
+/**
+ * Wall clock time, since the work is spread over threads
+ */
+static double now()
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+int main()
+{
+    size_t length;
+    char* source = source_generate(&length);
+    int cores = precompile_thread_count();
+
+    printf("source: %zu bytes, %d cores\n", length, cores);
+
+    double sequential = 0.0;
+    for (int pieces = 1; pieces <= 16; pieces *= 2)
+    {
+        double best = 0.0;
+        uint32_t tokens = 0;
+
+        for (int run = 0; run < RUNS; run++)
+        {
+            TokenStream stream;
+            double start = now();
+            if (pieces == 1)
+            {
+                token_stream_init(&stream, source, true);
+            }
+            else
+            {
+                token_stream_init_parallel(&stream, source, length, pieces);
+            }
+            double elapsed = now() - start;
+
+            tokens = stream.scanned;
+            token_stream_free(&stream);
+            if (run == 0 || elapsed < best) best = elapsed;
+        }
+
+        if (pieces == 1) sequential = best;
+        printf("%2d pieces: %7.3f s, %8.1f MB/s, %5.2fx (%u tokens)\n", pieces, best,
+            length / best / (1024.0 * 1024.0), sequential / best, tokens);
+    }
+
+    free(source);
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "scanner.h"
+
+#define SOURCE_BYTES (64 * 1024 * 1024)
+#define RUNS 5
+
+/**
+ * Lines in the style of our generated scripts
+ *
+ * Deep indentation, banner comments and long string
+ * literals, which is where a generator spends its bytes.
+ */
+static const char* lines[] = {
+    "// ------------------------------------------------------------------\n",
+    "//   generated from schema.json, do not edit by hand\n",
+    "let message = \"the quick brown fox jumps over the lazy dog, twice\";\n",
+    "\n",
+    "                if (count >= 1024) print count * 2 + offset;\n",
+    "        let label = \"multi line\n            string literal\";\n",
+    "\t\treturn (left + right) / 2;   // midpoint\n",
+};
+
+static char* source_generate(size_t* length)
+{
+    int line_count = (int)(sizeof(lines) / sizeof(lines[0]));
+    char* source = malloc(SOURCE_BYTES + 256);
+    size_t used = 0;
+
+    for (int i = 0; used < SOURCE_BYTES; i = (i + 1) % line_count)
+    {
+        size_t line_length = strlen(lines[i]);
+        memcpy(source + used, lines[i], line_length);
+        used += line_length;
+    }
+    source[used] = '\0';
+
+    *length = used;
+    return source;
+}
+
+int main()
+{
+    size_t length;
+    char* source = source_generate(&length);
+
+    double best = 0.0;
+    long tokens = 0;
+    int line = 0;
+
+    for (int run = 0; run < RUNS; run++)
+    {
+        Scanner scanner;
+        scanner_init(&scanner, source);
+
+        clock_t start = clock();
+        Token token;
+        tokens = 0;
+        do
+        {
+            token = token_scan(&scanner);
+            tokens++;
+        } while (TOKEN_TYPE(token) != TOKEN_EOF);
+        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        line = token.line;
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+
+    printf("source:     %10zu bytes, %d lines\n", length, line);
+    printf("tokens:     %10ld\n", tokens);
+    printf("best run:   %10.3f s\n", best);
+    printf("throughput: %10.1f MB/s\n", length / best / (1024.0 * 1024.0));
+
+    free(source);
+    return 0;
+}
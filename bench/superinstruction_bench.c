@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "chunk.h"
+#include "common.h"
+#include "optimizer.h"
+#include "vm.h"
+
+#define BLOCKS 250000
+#define RUNS 20
+
+/**
+ * Build a chunk of constant operands
+ *
+ * This is the shape the compiler produces for numeric code
+ * such as `x * 2 + 3 - 1`: every operator's right operand is
+ * a literal loaded just before it.
+ */
+static void chunk_build(Chunk* chunk)
+{
+    int one = chunk_constant_add(chunk, NUMBER_VAL(1.0));
+    int two = chunk_constant_add(chunk, NUMBER_VAL(2.0));
+    int three = chunk_constant_add(chunk, NUMBER_VAL(3.0));
+
+    chunk_write(chunk, OP_CONSTANT, 1);
+    chunk_write(chunk, one, 1);
+
+    for (int i = 0; i < BLOCKS; i++)
+    {
+        chunk_write(chunk, OP_CONSTANT, 1);
+        chunk_write(chunk, three, 1);
+        chunk_write(chunk, OP_ADD, 1);
+        chunk_write(chunk, OP_CONSTANT, 1);
+        chunk_write(chunk, two, 1);
+        chunk_write(chunk, OP_MULTIPLY, 1);
+        chunk_write(chunk, OP_CONSTANT, 1);
+        chunk_write(chunk, one, 1);
+        chunk_write(chunk, OP_SUBTRACT, 1);
+        chunk_write(chunk, OP_CONSTANT, 1);
+        chunk_write(chunk, two, 1);
+        chunk_write(chunk, OP_DIVIDE, 1);
+    }
+
+    chunk_write(chunk, OP_RETURN, 1);
+}
+
+/**
+ * Count the instructions a straight line chunk dispatches
+ */
+static int instruction_count(Chunk* chunk)
+{
+    int count = 0;
+    for (int offset = 0; offset < chunk->count; count++)
+    {
+        switch (chunk->code[offset])
+        {
+            case OP_CONSTANT:
+            case OP_ADD_CONSTANT:
+            case OP_SUBTRACT_CONSTANT:
+            case OP_MULTIPLY_CONSTANT:
+            case OP_DIVIDE_CONSTANT:
+                offset += 2;
+                break;
+            default:
+                offset += 1;
+                break;
+        }
+    }
+
+    return count;
+}
+
+static double chunk_time(VM* vm, Chunk* chunk)
+{
+    clock_t start = clock();
+    for (int i = 0; i < RUNS; i++)
+    {
+        vm_interpret_chunk(vm, chunk);
+    }
+
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main()
+{
+    Chunk chunk;
+    chunk_init(&chunk);
+    chunk_build(&chunk);
+
+    VM vm;
+    vm_init(&vm);
+
+    int before = instruction_count(&chunk);
+    double plain = chunk_time(&vm, &chunk);
+
+    chunk_optimize(&chunk);
+
+    int after = instruction_count(&chunk);
+    double fused = chunk_time(&vm, &chunk);
+
+    printf("plain:  %9d dispatches, %.3f s\n", before, plain);
+    printf("fused:  %9d dispatches, %.3f s\n", after, fused);
+    printf("dispatch reduction: %.1f%%, speedup: %.2fx\n",
+        100.0 * (before - after) / before, plain / fused);
+
+    vm_free(&vm);
+    chunk_free(&chunk);
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+#define ENTRIES_MAX 10000000
+// Roughly how many operations of each kind are timed per size,
+// so small tables are measured over many rounds.
+#define OPERATIONS 20000000
+
+static double seconds_since(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/**
+ * Make distinct interned keys
+ *
+ * The keys are shuffled so the order they are used in has
+ * nothing to do with the order their objects were allocated in.
+ */
+static ObjString** keys_make(VM* vm, int count, const char* prefix)
+{
+    ObjString** keys = malloc(sizeof(ObjString*) * (size_t)count);
+    char name[32];
+
+    for (int i = 0; i < count; i++)
+    {
+        int length = snprintf(name, sizeof(name), "%s%d", prefix, i);
+        keys[i] = string_copy(vm, name, length);
+    }
+
+    for (int i = count - 1; i > 0; i--)
+    {
+        int j = rand() % (i + 1);
+        ObjString* key = keys[i];
+        keys[i] = keys[j];
+        keys[j] = key;
+    }
+
+    return keys;
+}
+
+/**
+ * Time insert, hit, miss and delete on a table of one size
+ *
+ * Each round fills an empty table, looks every key up, looks
+ * up as many absent keys and then deletes every key again.
+ */
+static void table_measure(ObjString** keys, ObjString** absent, int count)
+{
+    int rounds = OPERATIONS / count;
+    if (rounds < 1) rounds = 1;
+
+    double insert = 0.0;
+    double hit = 0.0;
+    double miss = 0.0;
+    double delete = 0.0;
+    long found = 0;
+
+    for (int round = 0; round < rounds; round++)
+    {
+        Table table;
+        table_init(&table);
+
+        clock_t start = clock();
+        for (int i = 0; i < count; i++)
+        {
+            table_set(&table, keys[i], NUMBER_VAL(i));
+        }
+        insert += seconds_since(start);
+
+        start = clock();
+        for (int i = 0; i < count; i++)
+        {
+            Value value;
+            found += table_get(&table, keys[i], &value);
+        }
+        hit += seconds_since(start);
+
+        start = clock();
+        for (int i = 0; i < count; i++)
+        {
+            Value value;
+            found += table_get(&table, absent[i], &value);
+        }
+        miss += seconds_since(start);
+
+        start = clock();
+        for (int i = 0; i < count; i++)
+        {
+            table_delete(&table, keys[i]);
+        }
+        delete += seconds_since(start);
+
+        table_free(&table);
+    }
+
+    if (found != (long)count * rounds) printf("lookups went wrong\n");
+
+    double operations = (double)count * rounds / 1e9;
+    printf("%10d %10.1f %10.1f %10.1f %10.1f\n", count,
+        insert / operations, hit / operations, miss / operations, delete / operations);
+}
+
+int main(int argc, const char* argv[])
+{
+    int entries_max = argc > 1 ? atoi(argv[1]) : ENTRIES_MAX;
+
+    VM vm;
+    vm_init(&vm);
+    srand(1);
+
+    ObjString** keys = keys_make(&vm, entries_max, "key");
+    ObjString** absent = keys_make(&vm, entries_max, "absent");
+
+    printf("%10s %10s %10s %10s %10s   (ns/op)\n", "entries", "insert", "hit", "miss", "delete");
+    for (int count = 1000; count <= entries_max; count *= 10)
+    {
+        table_measure(keys, absent, count);
+    }
+
+    free(keys);
+    free(absent);
+    vm_free(&vm);
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "scanner.h"
+#include "token.h"
+
+#define SOURCE_BYTES (32 * 1024 * 1024)
+#define RUNS 5
+
+static const char* line_source =
+    "let offset = (count + 1) * 2 - total / 4; print offset >= limit;\n";
+
+static char* source_generate()
+{
+    size_t line_length = strlen(line_source);
+    char* source = malloc(SOURCE_BYTES + line_length + 1);
+    size_t used = 0;
+
+    while (used < SOURCE_BYTES)
+    {
+        memcpy(source + used, line_source, line_length);
+        used += line_length;
+    }
+    source[used] = '\0';
+
+    return source;
+}
+
+/**
+ * Consume every token of the source, the way the parser does
+ *
+ * @param mode 0 calls the scanner directly, 1 streams through
+ * the ring, 2 scans everything into a batch first
+ * @return the best time of a few runs, in seconds
+ */
+static double tokens_consume(const char* source, int mode, long* count)
+{
+    double best = 0.0;
+
+    for (int run = 0; run < RUNS; run++)
+    {
+        Scanner scanner;
+        TokenStream stream;
+        uint32_t checksum = 0;
+        long tokens = 0;
+        Token token;
+
+        clock_t start = clock();
+        if (mode == 0)
+        {
+            scanner_init(&scanner, source);
+            do
+            {
+                token = token_scan(&scanner);
+                checksum += token.type_length;
+                tokens++;
+            } while (TOKEN_TYPE(token) != TOKEN_EOF);
+        }
+        else
+        {
+            token_stream_init(&stream, source, mode == 2);
+            do
+            {
+                token = token_next(&stream);
+                checksum += token.type_length + token_peek(&stream, 1).type_length;
+                tokens++;
+            } while (TOKEN_TYPE(token) != TOKEN_EOF);
+            token_stream_free(&stream);
+        }
+        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        if (checksum == 0) printf(" ");
+        *count = tokens;
+        if (run == 0 || elapsed < best) best = elapsed;
+    }
+
+    return best;
+}
+
+int main()
+{
+    char* source = source_generate();
+    const char* modes[] = { "scanner", "ring stream", "batch stream" };
+
+    long count = 0;
+    for (int mode = 0; mode < 3; mode++)
+    {
+        double best = tokens_consume(source, mode, &count);
+        printf("%-13s %8.2f ns/token\n", modes[mode], best * 1e9 / count);
+    }
+
+    printf("tokens:       %10ld\n", count);
+    printf("token size:   %10zu bytes (was 24)\n", sizeof(Token));
+    printf("batch array:  %10.1f MB\n", count * sizeof(Token) / (1024.0 * 1024.0));
+    printf("ring buffer:  %10zu bytes\n", TOKEN_RING_SIZE * sizeof(Token));
+
+    free(source);
+    return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef clox_cache_h
+#define clox_cache_h
+
+#include "chunk.h"
+#include "common.h"
+#include "vm.h"
+
+// Bump whenever the instruction set or the file layout changes,
+// so caches written by older builds are recompiled.
+#define CACHE_VERSION 7
+
+uint64_t cache_hash(const char* source, size_t length);
+char* cache_path_make(const char* path);
+bool cache_load(VM* vm, const char* path, uint64_t hash, uint64_t length, Chunk* chunk);
+bool cache_store(VM* vm, const char* path, uint64_t hash, uint64_t length, Chunk* chunk);
+
+#endif
@@ -4,29 +4,102 @@
 #include "common.h"
 #include "value.h"
 
+// OP_CONSTANT_LONG addresses constants with a 24-bit operand.
+#define CONSTANT_LONG_MAX 0xffffff
+
 typedef enum {
     OP_CONSTANT,
+    OP_CONSTANT_LONG,
+    OP_NIL,
+    OP_TRUE,
+    OP_FALSE,
+    OP_EQUAL,
+    OP_GREATER,
+    OP_LESS,
     OP_ADD,
     OP_SUBTRACT,
     OP_MULTIPLY,
     OP_DIVIDE,
+    OP_ADD_CONSTANT,
+    OP_SUBTRACT_CONSTANT,
+    OP_MULTIPLY_CONSTANT,
+    OP_DIVIDE_CONSTANT,
+    OP_NOT,
     OP_NEGATE,
+    OP_PRINT,
+    OP_POP,
+    OP_POPN,
+    OP_GET_LOCAL,
+    OP_GET_LOCAL_LONG,
+    OP_SET_LOCAL,
+    OP_SET_LOCAL_LONG,
+    OP_DEFINE_GLOBAL,
+    OP_GET_GLOBAL,
+    OP_SET_GLOBAL,
+    OP_GET_UPVALUE,
+    OP_SET_UPVALUE,
+    OP_CLOSURE,
+    OP_CLOSE_UPVALUE,
+    OP_CALL,
+    OP_CALL_0,
+    OP_CALL_1,
+    OP_CALL_2,
+    OP_CALL_3,
+    OP_TAIL_CALL,
     OP_RETURN,
 } OpCode;
 
+/**
+ * How OP_CLOSURE captures one variable
+ *
+ * Each capture follows the instruction as a kind byte and a
+ * two byte index, low byte first. The index is a stack slot of
+ * the enclosing function for the local kinds and an index into
+ * the enclosing closure's captures for CAPTURE_UPVALUE.
+ */
+typedef enum
+{
+    // Share the local through an upvalue cell.
+    CAPTURE_LOCAL,
+    // Copy the local's value, it is never assigned.
+    CAPTURE_LOCAL_VALUE,
+    // Copy a capture of the enclosing closure, cell or value.
+    CAPTURE_UPVALUE,
+} CaptureKind;
+
+/**
+ * The start of a run of bytecode from one source line
+ *
+ * Consecutive instructions nearly always come from the same
+ * line, so rather than a line per byte of code we store a
+ * line only where it changes.
+ */
+typedef struct {
+    int offset;
+    int line;
+} LineStart;
+
 typedef struct {
     int count;
     int capacity;
     uint8_t* code;
-    int* lines;
+    int line_count;
+    int line_capacity;
+    LineStart* lines;
     ValueArray constants;
+    // Open addressing index from a constant to its position in
+    // `constants`, used to deduplicate constants as they are added.
+    int* constant_index;
+    int constant_index_capacity;
+    int constant_index_count;
 } Chunk;
 
 void chunk_init(Chunk* chunk);
 void chunk_free(Chunk* chunk);
 void chunk_write(Chunk* chunk, uint8_t byte, int line);
+void chunk_truncate(Chunk* chunk, int count);
+int chunk_line_get(Chunk* chunk, int offset);
 int chunk_constant_add(Chunk* chunk, Value value);
-
-void append_constant(Chunk* chunk, double num, int line);
+int chunk_constant_write(Chunk* chunk, Value value, int line);
 
 #endif
@@ -5,6 +5,21 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define DEBUG_TRACE_EXECUTION
+// Define DEBUG_PRINT_CODE to disassemble each chunk once it is
+// compiled, and DEBUG_TRACE_EXECUTION to print every instruction
+// the VM runs. Neither is on unless asked for, see CLOX_DEBUG_TRACE
+// in CMakeLists.txt.
+
+// Pack every value into a single 64-bit word using the
+// unused payload bits of quiet NaNs. See value.h.
+#ifndef DISABLE_NAN_BOXING
+#define NAN_BOXING
+#endif
+
+// Dispatch instructions through a table of label addresses
+// when the compiler supports GCC's labels as values extension.
+#if defined(__GNUC__) && !defined(DISABLE_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
 
 #endif
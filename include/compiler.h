@@ -1,6 +1,18 @@
 #ifndef clox_compiler_h
 #define clox_compiler_h
 
-void compile(const char* source);
+#include <stdio.h>
+
+#include "chunk.h"
+#include "vm.h"
+
+// The smallest piece of a source worth lexing on its own thread.
+#ifndef LEX_PIECE_MIN
+#define LEX_PIECE_MIN (1024 * 1024)
+#endif
+
+bool compile(VM* vm, const char* source, Chunk* chunk);
+bool compile_parallel(VM* vm, const char* source, size_t length, Chunk* chunk, int threads);
+bool compile_file(VM* vm, FILE* file, Chunk* chunk);
 
 #endif
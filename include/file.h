@@ -0,0 +1,23 @@
+#ifndef clox_file_h
+#define clox_file_h
+
+#include "common.h"
+
+/**
+ * The contents of a file, mapped or read into memory
+ *
+ * `data` is always followed by a NUL byte, so source code
+ * can be handed to the scanner as is.
+ */
+typedef struct
+{
+    const char* data;
+    size_t length;
+    // Size of the mapping, or zero if `data` was read into the heap.
+    size_t mapped_length;
+} MappedFile;
+
+bool file_map(const char* path, MappedFile* file);
+void file_unmap(MappedFile* file);
+
+#endif
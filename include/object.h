@@ -0,0 +1,132 @@
+#ifndef clox_object_h
+#define clox_object_h
+
+#include "chunk.h"
+#include "common.h"
+#include "value.h"
+
+typedef struct VM VM;
+
+#define OBJ_TYPE(value)   (AS_OBJ(value)->type)
+
+#define IS_CLOSURE(value)  object_is_type(value, OBJ_CLOSURE)
+#define IS_FUNCTION(value) object_is_type(value, OBJ_FUNCTION)
+#define IS_STRING(value)   object_is_type(value, OBJ_STRING)
+#define IS_UPVALUE(value)  object_is_type(value, OBJ_UPVALUE)
+
+#define AS_CLOSURE(value)  ((ObjClosure*)AS_OBJ(value))
+#define AS_FUNCTION(value) ((ObjFunction*)AS_OBJ(value))
+#define AS_STRING(value)   ((ObjString*)AS_OBJ(value))
+#define AS_CSTRING(value)  (((ObjString*)AS_OBJ(value))->chars)
+#define AS_UPVALUE(value)  ((ObjUpvalue*)AS_OBJ(value))
+
+typedef enum
+{
+    OBJ_CLOSURE,
+    OBJ_FUNCTION,
+    OBJ_STRING,
+    OBJ_UPVALUE,
+} ObjType;
+
+/**
+ * The header shared by every heap object
+ *
+ * Each object type embeds this as its first field, so a
+ * pointer to any object can be treated as an `Obj*`. All
+ * objects a VM allocates are chained through `next` so they
+ * can be freed together.
+ */
+struct Obj
+{
+    ObjType type;
+    struct Obj* next;
+};
+
+/**
+ * An immutable string
+ *
+ * The characters are stored inline after the header, so a
+ * string is a single allocation, and are NUL terminated for
+ * the benefit of C code. The hash is computed once when the
+ * string is created. Strings are interned: there is never more
+ * than one string with the same characters, so two strings are
+ * equal exactly when they are the same object.
+ */
+typedef struct
+{
+    Obj obj;
+    int length;
+    uint32_t hash;
+    char chars[];
+} ObjString;
+
+/**
+ * A compiled function
+ *
+ * The function itself is just code: it holds no variables of
+ * the scope it was declared in. A function that uses none of
+ * them is a value on its own, and only one that does is wrapped
+ * in a closure when its declaration runs.
+ */
+typedef struct
+{
+    Obj obj;
+    int arity;
+    int upvalue_count;
+    Chunk chunk;
+    // NULL for anonymous functions.
+    ObjString* name;
+} ObjFunction;
+
+/**
+ * A variable captured by reference
+ *
+ * While the variable is still on the stack the upvalue is open:
+ * `location` points at the stack slot and the upvalue is in the
+ * VM's list of open upvalues. When the variable goes out of
+ * scope its value moves into `closed` and `location` points
+ * there instead, so every closure sharing the upvalue keeps
+ * seeing the same variable.
+ */
+typedef struct ObjUpvalue
+{
+    Obj obj;
+    Value* location;
+    Value closed;
+    // The next open upvalue, further down the stack.
+    struct ObjUpvalue* next;
+} ObjUpvalue;
+
+/**
+ * A function together with the variables it captured
+ *
+ * The captures are stored inline, so a closure is a single
+ * allocation. A variable that is never assigned after its
+ * declaration can't change under the closure, so its value is
+ * copied straight into `upvalues`. Only variables that are
+ * assigned get an `ObjUpvalue` cell there, which the closure
+ * shares with the scope that declared the variable.
+ */
+typedef struct
+{
+    Obj obj;
+    ObjFunction* function;
+    int upvalue_count;
+    Value upvalues[];
+} ObjClosure;
+
+ObjClosure* closure_new(VM* vm, ObjFunction* function);
+ObjFunction* function_new(VM* vm);
+ObjUpvalue* upvalue_new(VM* vm, Value* slot);
+uint32_t string_hash(const char* chars, int length);
+ObjString* string_copy(VM* vm, const char* chars, int length);
+ObjString* string_concatenate(VM* vm, ObjString* a, ObjString* b);
+void object_print(Value value);
+void objects_free(VM* vm);
+
+static inline bool object_is_type(Value value, ObjType type)
+{
+    return IS_OBJ(value) && AS_OBJ(value)->type == type;
+}
+
+#endif
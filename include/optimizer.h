@@ -0,0 +1,8 @@
+#ifndef clox_optimizer_h
+#define clox_optimizer_h
+
+#include "chunk.h"
+
+void chunk_optimize(Chunk* chunk);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef clox_precompile_h
+#define clox_precompile_h
+
+#include "common.h"
+
+int precompile_thread_count();
+int precompile_files(const char* const* paths, int count, int threads);
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef clox_scanner_h
 #define clox_scanner_h
 
+#include <stdint.h>
+#include <stdio.h>
+
 typedef enum
 {
     // Single character tokens
@@ -53,16 +56,62 @@ typedef enum
     TOKEN_EOF,
 } TokenType;
 
+/**
+ * A token, packed into twelve bytes
+ *
+ * The lexeme is found at `offset` in the source. Error tokens
+ * have no lexeme; their offset indexes the scanner's table of
+ * error messages instead. Type and length share one word, the
+ * type in the low byte, which limits lexemes to 16 MiB and
+ * sources held in memory to 4 GiB. Streamed sources may be
+ * longer: their offsets wrap, which is harmless as long as
+ * the window of source text the scanner holds is smaller.
+ */
 typedef struct
 {
-    TokenType type;
-    const char* start;
-    int length;
+    uint32_t offset;
     int line;
+    uint32_t type_length;
 } Token;
 
-void scanner_init(const char* source);
+#define TOKEN_LENGTH_MAX 0xffffff
+
+#define TOKEN_TYPE(token)   ((TokenType)((token).type_length & 0xff))
+#define TOKEN_LENGTH(token) ((int)((token).type_length >> 8))
+
+// Bytes a streaming scanner reads at a time.
+#ifndef SCAN_BLOCK_SIZE
+#define SCAN_BLOCK_SIZE (64 * 1024)
+#endif
+
+typedef struct ScanReader ScanReader;
+
+typedef struct
+{
+    // The source text held in memory: all of it, or for a
+    // streaming scanner, a window that slides over the input.
+    // `end` is its terminating NUL.
+    const char* source;
+    const char* start;
+    const char* current;
+    const char* end;
+    int line;
+    // Streaming only. Where `source` begins in the input, the
+    // reader refilling the window, and the earliest byte the
+    // next refill has to keep, if any.
+    uint64_t source_offset;
+    ScanReader* reader;
+    const char* keep;
+} Scanner;
+
+void scanner_init(Scanner* scanner, const char* source);
+void scanner_init_length(Scanner* scanner, const char* source, size_t length);
+void scanner_init_file(Scanner* scanner, FILE* file);
+void scanner_init_fd(Scanner* scanner, int fd);
+void scanner_free(Scanner* scanner);
 
-Token token_scan();
+Token token_scan(Scanner* scanner);
+const char* token_lexeme(Scanner* scanner, Token token);
+const char* token_error_message(Token token);
 
 #endif
@@ -0,0 +1,55 @@
+#ifndef clox_table_h
+#define clox_table_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+// The table grows once it would be more than this full.
+#define TABLE_MAX_LOAD_NUMERATOR 3
+#define TABLE_MAX_LOAD_DENOMINATOR 4
+
+typedef struct
+{
+    ObjString* key;
+    Value value;
+} Entry;
+
+/**
+ * A hash table keyed by strings
+ *
+ * Robin Hood hashing: open addressing with linear probing over a
+ * power of two number of entries, where an insert that meets an
+ * entry closer to its home slot than itself takes that slot and
+ * carries on inserting the displaced entry. Probe lengths stay
+ * short and even at high load, and a lookup can stop as soon as
+ * it passes where its key would have been placed. Deletes shift
+ * the following entries back instead of leaving tombstones.
+ *
+ * Each entry's distance from its home slot is kept in a separate
+ * byte array, 0 for an empty slot and distance + 1 otherwise. A
+ * probe mostly runs over those bytes and only touches the entry
+ * whose key it is looking for. Keys are interned strings, so
+ * comparing keys is comparing pointers.
+ *
+ * This is the one table the runtime uses for anything keyed by
+ * name: the string intern set, and later globals and fields.
+ */
+typedef struct
+{
+    int count;
+    int capacity;
+    Entry* entries;
+    uint8_t* distances;
+} Table;
+
+void table_init(Table* table);
+void table_free(Table* table);
+void table_reserve(Table* table, int count);
+bool table_get(Table* table, ObjString* key, Value* value);
+bool table_set(Table* table, ObjString* key, Value value);
+bool table_delete(Table* table, ObjString* key);
+void table_add_all(Table* from, Table* to);
+ObjString* table_find_string(Table* table, const char* chars, int length, uint32_t hash);
+
+#endif
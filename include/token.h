@@ -0,0 +1,75 @@
+#ifndef clox_token_h
+#define clox_token_h
+
+#include "common.h"
+#include "scanner.h"
+
+// Tokens held by a streaming token buffer, which bounds how
+// far ahead the parser can look. Must be a power of two.
+#ifndef TOKEN_RING_SIZE
+#define TOKEN_RING_SIZE 64
+#endif
+
+// Two slots of the ring hold the tokens the parser consumed last.
+#define TOKEN_LOOKAHEAD_MAX (TOKEN_RING_SIZE - 3)
+
+/**
+ * A buffered stream of tokens
+ *
+ * In batch mode the whole source is scanned up front into one
+ * contiguous array. Otherwise the tokens live in a ring that is
+ * refilled a batch at a time as the parser consumes them, so
+ * memory stays bounded however long the source is. Either way,
+ * looking k tokens ahead is a single index operation.
+ *
+ * Positions count tokens from the start of the source. The
+ * stream keeps returning the EOF token once it is reached.
+ */
+typedef struct
+{
+    Scanner scanner;
+    Token* tokens;
+    int capacity;
+    // Ring: capacity - 1. Batch: all ones, since the array never wraps.
+    uint32_t mask;
+    // Position of the next token `token_next` returns.
+    uint32_t position;
+    // Tokens scanned so far, the EOF token included.
+    uint32_t scanned;
+    bool batch;
+} TokenStream;
+
+void token_stream_init(TokenStream* stream, const char* source, bool batch);
+void token_stream_init_file(TokenStream* stream, FILE* file);
+void token_stream_init_parallel(TokenStream* stream, const char* source, size_t length, int pieces);
+void token_stream_free(TokenStream* stream);
+Token token_stream_fill(TokenStream* stream, uint32_t position);
+
+/**
+ * Look at a token without consuming it
+ *
+ * @param distance how far ahead to look, 0 being the token
+ * `token_next` returns next. At most TOKEN_LOOKAHEAD_MAX.
+ *
+ * Inline, since the parser calls this for every token and it
+ * is almost always just an index into tokens already scanned.
+ */
+static inline Token token_peek(TokenStream* stream, int distance)
+{
+    uint32_t position = stream->position + (uint32_t)distance;
+    if (position < stream->scanned) return stream->tokens[position & stream->mask];
+
+    return token_stream_fill(stream, position);
+}
+
+/**
+ * Consume the next token
+ */
+static inline Token token_next(TokenStream* stream)
+{
+    Token token = token_peek(stream, 0);
+    if (TOKEN_TYPE(token) != TOKEN_EOF) stream->position++;
+    return token;
+}
+
+#endif
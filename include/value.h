@@ -1,9 +1,123 @@
 #ifndef clox_value_h
 #define clox_value_h
 
+#include <string.h>
+
 #include "common.h"
 
-typedef double Value;
+typedef struct Obj Obj;
+
+#ifdef NAN_BOXING
+
+/**
+ * NaN-boxed values
+ *
+ * A double whose exponent bits are all set and whose quiet bit
+ * is set is a quiet NaN, and the hardware never cares about the
+ * remaining mantissa bits. Every value that isn't a number is
+ * stored as such a NaN with its payload in those spare bits:
+ * small tags for nil and the booleans, or, with the sign bit
+ * set as well, a pointer to a heap object. Pointers fit since
+ * current 64-bit hardware only uses the low 48 bits of an address.
+ *
+ * Every value is then a single 64-bit word, the same size as a
+ * bare double.
+ */
+typedef uint64_t Value;
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN     ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL       1 // 001
+#define TAG_FALSE     2 // 010
+#define TAG_TRUE      3 // 011
+#define TAG_UNDEFINED 4 // 100
+
+#define IS_BOOL(value)   (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value)    ((value) == NIL_VAL)
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+#define IS_OBJ(value)    (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
+
+#define AS_BOOL(value)   ((value) == TRUE_VAL)
+#define AS_NUMBER(value) value_to_number(value)
+#define AS_OBJ(value)    ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+#define BOOL_VAL(b)      ((b) ? TRUE_VAL : FALSE_VAL)
+#define FALSE_VAL        ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL         ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define NIL_VAL          ((Value)(uint64_t)(QNAN | TAG_NIL))
+// Fills global slots no definition has reached yet. It never
+// ends up on the stack, so scripts can't observe it.
+#define UNDEFINED_VAL    ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+#define NUMBER_VAL(num)  number_to_value(num)
+#define OBJ_VAL(obj)     (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+
+/**
+ * Reinterpret the bits of a value as a double
+ *
+ * Going through memcpy is the well defined way to type-pun
+ * in C, and compilers reduce it to a plain register move.
+ */
+static inline double value_to_number(Value value)
+{
+    double number;
+    memcpy(&number, &value, sizeof(Value));
+    return number;
+}
+
+static inline Value number_to_value(double number)
+{
+    Value value;
+    memcpy(&value, &number, sizeof(double));
+    return value;
+}
+
+#else
+
+typedef enum
+{
+    VAL_BOOL,
+    VAL_NIL,
+    VAL_NUMBER,
+    VAL_OBJ,
+    VAL_UNDEFINED,
+} ValueType;
+
+/**
+ * Tagged union values
+ *
+ * The portable representation: a type tag next to a union
+ * of the possible payloads, 16 bytes per value.
+ */
+typedef struct
+{
+    ValueType type;
+    union
+    {
+        bool boolean;
+        double number;
+        Obj* obj;
+    } as;
+} Value;
+
+#define IS_BOOL(value)   ((value).type == VAL_BOOL)
+#define IS_NIL(value)    ((value).type == VAL_NIL)
+#define IS_NUMBER(value) ((value).type == VAL_NUMBER)
+#define IS_OBJ(value)    ((value).type == VAL_OBJ)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
+
+#define AS_BOOL(value)   ((value).as.boolean)
+#define AS_NUMBER(value) ((value).as.number)
+#define AS_OBJ(value)    ((value).as.obj)
+
+#define BOOL_VAL(value)   ((Value){ VAL_BOOL, { .boolean = value } })
+#define NIL_VAL           ((Value){ VAL_NIL, { .number = 0 } })
+#define NUMBER_VAL(value) ((Value){ VAL_NUMBER, { .number = value } })
+#define OBJ_VAL(object)   ((Value){ VAL_OBJ, { .obj = (Obj*)object } })
+#define UNDEFINED_VAL     ((Value){ VAL_UNDEFINED, { .number = 0 } })
+
+#endif
 
 typedef struct {
     int capacity;
@@ -11,6 +125,8 @@ typedef struct {
     Value* values;
 } ValueArray;
 
+bool values_equal(Value a, Value b);
+bool values_identical(Value a, Value b);
 void value_array_init(ValueArray* array);
 void value_array_free(ValueArray* array);
 void value_array_write(ValueArray* array, Value value);
@@ -2,17 +2,73 @@
 #define clox_vm_h
 
 #include "chunk.h"
+#include "object.h"
+#include "table.h"
 #include "value.h"
 
-#define STACK_MAX 256
+// Number of slots the value stack starts out with.
+#ifndef STACK_INITIAL
+#define STACK_INITIAL 64
+#endif
+
+// Hard limit on the number of slots the value stack may grow to.
+// Going past it is reported as a stack overflow.
+#ifndef STACK_MAX
+#define STACK_MAX (1024 * 1024)
+#endif
+
+// The deepest calls may nest. Going past it is reported
+// as a stack overflow.
+#ifndef FRAMES_MAX
+#define FRAMES_MAX 1024
+#endif
 
+/**
+ * A call in progress
+ *
+ * Frames live in one contiguous array, innermost last, and all
+ * share the value stack: `slots` is the window of it the call
+ * works in. Slot 0 holds the function being called and the
+ * arguments follow, right where the caller pushed them.
+ */
 typedef struct
 {
-    Chunk* chunk;
+    // NULL for the script, whose chunk is the VM's `chunk`.
+    ObjFunction* function;
+    // NULL unless the function captures variables.
+    ObjClosure* closure;
+    // Where to carry on in the function once a call it
+    // makes returns.
     uint8_t* ip;
-    Value stack[STACK_MAX];
+    Value* slots;
+} CallFrame;
+
+struct VM
+{
+    // The script being run.
+    Chunk* chunk;
+    CallFrame* frames;
+    int frame_count;
+    Value* stack;
     Value* stack_top;
-} VM;
+    int stack_capacity;
+    // Every interned string, used as a set: the values are unused.
+    Table strings;
+    // All heap objects, linked through their headers.
+    Obj* objects;
+    // Global variables live in a dense array. The compiler gives
+    // every global name a slot in it the first time it sees the
+    // name, and `global_slots` maps names to those slots.
+    Table global_slots;
+    ValueArray globals;
+    // The name of each slot, for error messages.
+    ValueArray global_names;
+    // Upvalues still pointing into the stack, topmost first.
+    ObjUpvalue* open_upvalues;
+};
+
+// Global slots are addressed with a 16-bit operand.
+#define GLOBALS_MAX (UINT16_MAX + 1)
 
 typedef enum
 {
@@ -21,13 +77,14 @@ typedef enum
     INTERPRET_RUNTIME_ERROR,
 } InterpretResult;
 
-void vm_init();
-void vm_free();
-void vm_stack_push(Value value);
+void vm_init(VM* vm);
+void vm_free(VM* vm);
+bool vm_stack_push(VM* vm, Value value);
+int vm_global_slot(VM* vm, ObjString* name);
 
-Value vm_stack_pop();
+Value vm_stack_pop(VM* vm);
 
-InterpretResult vm_interpret(const char* source);
-static InterpretResult vm_run();
+InterpretResult vm_interpret(VM* vm, const char* source);
+InterpretResult vm_interpret_chunk(VM* vm, Chunk* chunk);
 
 #endif
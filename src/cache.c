@@ -0,0 +1,817 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MKSTEMP
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "cache.h"
+#include "file.h"
+#include "memory.h"
+#include "object.h"
+
+/**
+ * Bytecode cache files
+ *
+ * A `.cloxc` file holds a compiled chunk so a script that
+ * hasn't changed since it was last run doesn't need to be
+ * scanned and compiled again. All integers are stored little
+ * endian, whatever the host, and values are stored by type
+ * rather than as raw `Value`s, so the file doesn't depend on
+ * the value representation the interpreter was built with.
+ *
+ * | field      | size               | contents                      |
+ * |------------|--------------------|-------------------------------|
+ * | magic      | 4                  | "CLXC"                        |
+ * | version    | 4                  | CACHE_VERSION                 |
+ * | hash       | 8                  | `cache_hash` of the source    |
+ * | length     | 8                  | length of the source in bytes |
+ * | code       | 4 + count          | bytecode                      |
+ * | lines      | 4 + 8 * count      | line runs, offset and line    |
+ * | constants  | 4 + ...            | a type tag, then the payload  |
+ * | globals    | 4 + ...            | global names in slot order    |
+ *
+ * A number's payload is its 8 bytes of IEEE 754 double. A
+ * string's is a 4 byte length followed by its characters, and
+ * global names are stored the same way. The bytecode refers to
+ * globals by slot, so loading the chunk gives the names those
+ * same slots again.
+ *
+ * A function's payload is a byte saying whether it has a name,
+ * the name if so, a byte of arity and 2 bytes of upvalue count,
+ * followed by its own code, lines and constants laid out like
+ * the script's.
+ *
+ * Nothing in a cache file is trusted. Besides the bounds checks
+ * while reading, the loaded code is verified before it is handed
+ * to the VM, which doesn't check operands as it runs.
+ */
+
+#define CACHE_MAGIC "CLXC"
+
+typedef enum
+{
+    CONSTANT_NUMBER,
+    CONSTANT_STRING,
+    CONSTANT_FUNCTION,
+} ConstantTag;
+
+/**
+ * Read from a cache file held in memory
+ *
+ * Every read is bounds checked. Running off the end of the
+ * buffer clears `ok` and from then on reads return zeros, so
+ * the parsing code only has to check once at the end.
+ */
+typedef struct
+{
+    const uint8_t* current;
+    const uint8_t* end;
+    bool ok;
+} Reader;
+
+/**
+ * Hash source code to key its cache file
+ *
+ * This is 64-bit FNV-1a. It is no defense against someone
+ * crafting a collision, but that would need write access to
+ * the cache file anyway.
+ */
+uint64_t cache_hash(const char* source, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)source[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/**
+ * Get the cache file path for a script
+ *
+ * `script.clox` is cached in `script.cloxc` next to it. Any
+ * other file name just gets `.cloxc` appended. The caller
+ * owns the returned string.
+ */
+char* cache_path_make(const char* path)
+{
+    size_t length = strlen(path);
+    const char* suffix = ".cloxc";
+
+    if (length >= 5 && strcmp(path + length - 5, ".clox") == 0)
+    {
+        suffix = "c";
+    }
+
+    char* cache_path = malloc(length + strlen(suffix) + 1);
+    if (cache_path == NULL) return NULL;
+
+    memcpy(cache_path, path, length);
+    strcpy(cache_path + length, suffix);
+    return cache_path;
+}
+
+static bool bytes_read(Reader* reader, void* bytes, size_t count)
+{
+    // An empty chunk's code array is NULL.
+    if (count == 0) return reader->ok;
+
+    if (!reader->ok || (size_t)(reader->end - reader->current) < count)
+    {
+        reader->ok = false;
+        memset(bytes, 0, count);
+        return false;
+    }
+
+    memcpy(bytes, reader->current, count);
+    reader->current += count;
+    return true;
+}
+
+static uint64_t uint_read(Reader* reader, int size)
+{
+    uint8_t bytes[8];
+    bytes_read(reader, bytes, size);
+
+    uint64_t value = 0;
+    for (int i = size - 1; i >= 0; i--)
+    {
+        value = (value << 8) | bytes[i];
+    }
+
+    return value;
+}
+
+static void uint_write(FILE* file, uint64_t value, int size)
+{
+    for (int i = 0; i < size; i++)
+    {
+        fputc((int)((value >> (8 * i)) & 0xff), file);
+    }
+}
+
+/**
+ * Read a length prefixed string and intern it
+ */
+static ObjString* string_read(VM* vm, Reader* reader)
+{
+    uint32_t length = (uint32_t)uint_read(reader, 4);
+    if (!reader->ok || length > (size_t)(reader->end - reader->current)) return NULL;
+
+    ObjString* string = string_copy(vm, (const char*)reader->current, (int)length);
+    reader->current += length;
+    return string;
+}
+
+static void string_write(FILE* file, ObjString* string)
+{
+    uint_write(file, (uint64_t)string->length, 4);
+    fwrite(string->chars, 1, (size_t)string->length, file);
+}
+
+static bool body_read(VM* vm, Reader* reader, Chunk* chunk);
+static bool body_write(FILE* file, Chunk* chunk);
+
+/**
+ * Read a function constant
+ *
+ * The function is allocated up front so its chunk can be read
+ * in place. A function that fails to load is left empty, and
+ * the VM frees it along with its other objects.
+ */
+static bool function_read(VM* vm, Reader* reader, Value* value)
+{
+    ObjFunction* function = function_new(vm);
+
+    if (uint_read(reader, 1) != 0)
+    {
+        function->name = string_read(vm, reader);
+        if (function->name == NULL) return false;
+    }
+    function->arity = (int)uint_read(reader, 1);
+    function->upvalue_count = (int)uint_read(reader, 2);
+    if (!reader->ok || !body_read(vm, reader, &function->chunk)) return false;
+
+    *value = OBJ_VAL(function);
+    return true;
+}
+
+static void function_write(FILE* file, ObjFunction* function)
+{
+    uint_write(file, function->name != NULL, 1);
+    if (function->name != NULL) string_write(file, function->name);
+    uint_write(file, (uint64_t)function->arity, 1);
+    uint_write(file, (uint64_t)function->upvalue_count, 2);
+}
+
+/**
+ * Read a constant
+ *
+ * Strings are interned in `vm` as they are read, so they are
+ * shared with strings the VM already has.
+ */
+static bool constant_read(VM* vm, Reader* reader, Value* value)
+{
+    switch (uint_read(reader, 1))
+    {
+        case CONSTANT_NUMBER:
+        {
+            uint64_t bits = uint_read(reader, 8);
+            double number;
+            memcpy(&number, &bits, sizeof(double));
+            *value = NUMBER_VAL(number);
+            return reader->ok;
+        }
+        case CONSTANT_STRING:
+        {
+            ObjString* string = string_read(vm, reader);
+            if (string == NULL) return false;
+
+            *value = OBJ_VAL(string);
+            return true;
+        }
+        case CONSTANT_FUNCTION:
+            return function_read(vm, reader, value);
+        default:
+            return false;
+    }
+}
+
+static bool constant_write(FILE* file, Value value)
+{
+    if (IS_NUMBER(value))
+    {
+        double number = AS_NUMBER(value);
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(double));
+
+        uint_write(file, CONSTANT_NUMBER, 1);
+        uint_write(file, bits, 8);
+        return true;
+    }
+
+    if (IS_STRING(value))
+    {
+        uint_write(file, CONSTANT_STRING, 1);
+        string_write(file, AS_STRING(value));
+        return true;
+    }
+
+    if (IS_FUNCTION(value))
+    {
+        uint_write(file, CONSTANT_FUNCTION, 1);
+        function_write(file, AS_FUNCTION(value));
+        return body_write(file, &AS_FUNCTION(value)->chunk);
+    }
+
+    return false;
+}
+
+/**
+ * Read the code, lines and constants of a chunk
+ *
+ * The chunk is only filled in once all of it has been read,
+ * so a bad file leaves it empty.
+ */
+static bool body_read(VM* vm, Reader* reader, Chunk* chunk)
+{
+    Chunk loaded;
+    chunk_init(&loaded);
+
+    uint32_t code_count = (uint32_t)uint_read(reader, 4);
+    if (!reader->ok || code_count > (size_t)(reader->end - reader->current)) return false;
+
+    loaded.code = GROW_ARRAY(NULL, uint8_t, 0, code_count);
+    loaded.capacity = (int)code_count;
+    loaded.count = (int)code_count;
+    bytes_read(reader, loaded.code, code_count);
+
+    uint32_t line_count = (uint32_t)uint_read(reader, 4);
+    if (!reader->ok || line_count > (size_t)(reader->end - reader->current) / 8)
+    {
+        chunk_free(&loaded);
+        return false;
+    }
+
+    loaded.lines = GROW_ARRAY(NULL, LineStart, 0, line_count);
+    loaded.line_capacity = (int)line_count;
+    loaded.line_count = (int)line_count;
+    for (uint32_t i = 0; i < line_count; i++)
+    {
+        loaded.lines[i].offset = (int)uint_read(reader, 4);
+        loaded.lines[i].line = (int)uint_read(reader, 4);
+    }
+
+    uint32_t constant_count = (uint32_t)uint_read(reader, 4);
+    for (uint32_t i = 0; i < constant_count && reader->ok; i++)
+    {
+        Value value;
+        if (!constant_read(vm, reader, &value))
+        {
+            chunk_free(&loaded);
+            return false;
+        }
+
+        value_array_write(&loaded.constants, value);
+    }
+
+    if (!reader->ok)
+    {
+        chunk_free(&loaded);
+        return false;
+    }
+
+    *chunk = loaded;
+    return true;
+}
+
+/**
+ * Write the code, lines and constants of a chunk
+ *
+ * @return false if the chunk has a constant that can't be
+ * stored
+ */
+static bool body_write(FILE* file, Chunk* chunk)
+{
+    uint_write(file, (uint64_t)chunk->count, 4);
+    fwrite(chunk->code, 1, (size_t)chunk->count, file);
+
+    uint_write(file, (uint64_t)chunk->line_count, 4);
+    for (int i = 0; i < chunk->line_count; i++)
+    {
+        uint_write(file, (uint64_t)chunk->lines[i].offset, 4);
+        uint_write(file, (uint64_t)chunk->lines[i].line, 4);
+    }
+
+    uint_write(file, (uint64_t)chunk->constants.count, 4);
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        if (!constant_write(file, chunk->constants.values[i])) return false;
+    }
+
+    return true;
+}
+
+/**
+ * Get the size of an instruction with fixed size operands
+ *
+ * @return the size of the opcode and its operands, or -1 if
+ * the byte is not an opcode. OP_CLOSURE is followed by its
+ * captures on top of this.
+ */
+static int operand_length(uint8_t op)
+{
+    switch (op)
+    {
+        case OP_CONSTANT:
+        case OP_ADD_CONSTANT:
+        case OP_SUBTRACT_CONSTANT:
+        case OP_MULTIPLY_CONSTANT:
+        case OP_DIVIDE_CONSTANT:
+        case OP_POPN:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            return 2;
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_LOCAL_LONG:
+        case OP_SET_LOCAL_LONG:
+            return 3;
+        case OP_CONSTANT_LONG:
+        case OP_CLOSURE:
+            return 4;
+        default:
+            return op <= OP_RETURN ? 1 : -1;
+    }
+}
+
+static bool chunk_verify(Chunk* chunk, ObjFunction* function, int global_count, bool* cells);
+
+/**
+ * Verify the functions among a chunk's constants
+ *
+ * @param cells set to an array per constant, NULL for constants
+ * that aren't functions, of which of the function's captures it
+ * assigns and so must be cells
+ *
+ * Every function is the constant of exactly one chunk, so each
+ * is verified once however often its chunk refers to it.
+ */
+static bool functions_verify(Chunk* chunk, int global_count, bool** cells)
+{
+    bool verified = true;
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        cells[i] = NULL;
+        if (!verified || !IS_FUNCTION(chunk->constants.values[i])) continue;
+
+        ObjFunction* function = AS_FUNCTION(chunk->constants.values[i]);
+        cells[i] = calloc((size_t)function->upvalue_count + 1, sizeof(bool));
+        verified = cells[i] != NULL &&
+            chunk_verify(&function->chunk, function, global_count, cells[i]);
+    }
+
+    return verified;
+}
+
+/**
+ * Check the captures that follow an OP_CLOSURE
+ *
+ * @param height the stack height of the enclosing code
+ * @param inner the cells the closure's function needs
+ *
+ * A copied local can't be one the function assigns. A capture
+ * passed on from the enclosing closure can be, as long as the
+ * enclosing function treats it as a cell in turn.
+ */
+static bool captures_verify(const uint8_t* code, ObjFunction* function, int height,
+    const bool* inner, int count, bool* cells)
+{
+    int upvalue_count = function == NULL ? 0 : function->upvalue_count;
+
+    for (int i = 0; i < count; i++)
+    {
+        int index = code[3 * i + 1] | (code[3 * i + 2] << 8);
+        switch (code[3 * i])
+        {
+            case CAPTURE_LOCAL:
+                if (index >= height) return false;
+                break;
+            case CAPTURE_LOCAL_VALUE:
+                if (index >= height || inner[i]) return false;
+                break;
+            case CAPTURE_UPVALUE:
+                if (index >= upvalue_count) return false;
+                if (inner[i]) cells[index] = true;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Verify the code of a chunk loaded from a cache
+ *
+ * @param function the function the chunk belongs to, NULL for
+ * the script
+ * @param global_count the number of global slots the file names
+ * @param cells set for each of the function's captures that its
+ * code, or a closure it creates, assigns
+ * @return whether the code is safe to run
+ *
+ * Every instruction must be whole, and every operand must name
+ * a constant of the right kind, a global the file named, a
+ * capture the function has, or a local slot below the top of
+ * the stack. There are no jumps, so the stack height at each
+ * instruction follows from the one before, and the code must
+ * end in a return.
+ */
+static bool chunk_verify(Chunk* chunk, ObjFunction* function, int global_count, bool* cells)
+{
+    if (chunk->count == 0 || chunk->line_count == 0) return false;
+
+    bool** functions = calloc((size_t)chunk->constants.count + 1, sizeof(bool*));
+    if (functions == NULL) return false;
+
+    bool verified = functions_verify(chunk, global_count, functions);
+    int upvalue_count = function == NULL ? 0 : function->upvalue_count;
+    int height = function == NULL ? 0 : function->arity + 1;
+    const uint8_t* code = chunk->code;
+    int offset = 0;
+    uint8_t op = OP_RETURN;
+
+    while (verified && offset < chunk->count)
+    {
+        op = code[offset];
+        int length = operand_length(op);
+        if (length == -1 || length > chunk->count - offset)
+        {
+            verified = false;
+            break;
+        }
+
+        int operand = 0;
+        for (int i = length - 1; i > 0; i--)
+        {
+            operand = (operand << 8) | code[offset + i];
+        }
+
+        bool valid = true;
+        int pops = 0;
+        int pushes = 0;
+        switch (op)
+        {
+            case OP_CONSTANT:
+            case OP_CONSTANT_LONG:
+                // Only closures can reach captures.
+                valid = operand < chunk->constants.count &&
+                    (functions[operand] == NULL ||
+                     AS_FUNCTION(chunk->constants.values[operand])->upvalue_count == 0);
+                pushes = 1;
+                break;
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+                pushes = 1;
+                break;
+            case OP_EQUAL:
+            case OP_GREATER:
+            case OP_LESS:
+            case OP_ADD:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+                pops = 2;
+                pushes = 1;
+                break;
+            case OP_ADD_CONSTANT:
+            case OP_SUBTRACT_CONSTANT:
+            case OP_MULTIPLY_CONSTANT:
+            case OP_DIVIDE_CONSTANT:
+                valid = operand < chunk->constants.count &&
+                    IS_NUMBER(chunk->constants.values[operand]);
+                pops = 1;
+                pushes = 1;
+                break;
+            case OP_NOT:
+            case OP_NEGATE:
+                pops = 1;
+                pushes = 1;
+                break;
+            case OP_PRINT:
+            case OP_POP:
+            case OP_CLOSE_UPVALUE:
+                pops = 1;
+                break;
+            case OP_POPN:
+                pops = operand;
+                break;
+            case OP_GET_LOCAL:
+            case OP_GET_LOCAL_LONG:
+                valid = operand < height;
+                pushes = 1;
+                break;
+            case OP_SET_LOCAL:
+            case OP_SET_LOCAL_LONG:
+                valid = operand < height;
+                pops = 1;
+                pushes = 1;
+                break;
+            case OP_DEFINE_GLOBAL:
+                valid = operand < global_count;
+                pops = 1;
+                break;
+            case OP_GET_GLOBAL:
+                valid = operand < global_count;
+                pushes = 1;
+                break;
+            case OP_SET_GLOBAL:
+                valid = operand < global_count;
+                pops = 1;
+                pushes = 1;
+                break;
+            case OP_GET_UPVALUE:
+                valid = operand < upvalue_count;
+                pushes = 1;
+                break;
+            case OP_SET_UPVALUE:
+                valid = operand < upvalue_count;
+                if (valid) cells[operand] = true;
+                pops = 1;
+                pushes = 1;
+                break;
+            case OP_CLOSURE:
+            {
+                if (operand >= chunk->constants.count || functions[operand] == NULL)
+                {
+                    valid = false;
+                    break;
+                }
+
+                int count = AS_FUNCTION(chunk->constants.values[operand])->upvalue_count;
+                valid = 3 * count <= chunk->count - offset - length &&
+                    captures_verify(code + offset + length, function, height,
+                        functions[operand], count, cells);
+                length += 3 * count;
+                pushes = 1;
+                break;
+            }
+            case OP_CALL:
+            case OP_CALL_0:
+            case OP_CALL_1:
+            case OP_CALL_2:
+            case OP_CALL_3:
+            {
+                int argc = op == OP_CALL ? operand : op - OP_CALL_0;
+                pops = argc + 1;
+                pushes = 1;
+                break;
+            }
+            case OP_TAIL_CALL:
+                // The result is returned, as it would be by the
+                // OP_RETURN the call stands in for.
+                pops = operand + 1;
+                break;
+            case OP_RETURN:
+                pops = function == NULL ? 0 : 1;
+                break;
+        }
+
+        if (!valid || height < pops)
+        {
+            verified = false;
+            break;
+        }
+
+        height += pushes - pops;
+        offset += length;
+    }
+
+    if (op != OP_RETURN) verified = false;
+
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        free(functions[i]);
+    }
+    free(functions);
+    return verified;
+}
+
+/**
+ * Parse a cache file into a chunk
+ *
+ * The chunk is only filled in once the whole file has been
+ * checked, so a bad file leaves it empty.
+ */
+static bool cache_parse(VM* vm, Reader* reader, uint64_t hash, uint64_t length, Chunk* chunk)
+{
+    char magic[4];
+    bytes_read(reader, magic, sizeof(magic));
+    if (memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0) return false;
+    if (uint_read(reader, 4) != CACHE_VERSION) return false;
+    if (uint_read(reader, 8) != hash) return false;
+    if (uint_read(reader, 8) != length) return false;
+
+    Chunk loaded;
+    if (!body_read(vm, reader, &loaded)) return false;
+
+    // The slots only line up if the VM hands out the same
+    // slots as when the chunk was compiled, which it does for
+    // a VM that had no globals yet.
+    uint32_t global_count = (uint32_t)uint_read(reader, 4);
+    for (uint32_t i = 0; i < global_count && reader->ok; i++)
+    {
+        ObjString* name = string_read(vm, reader);
+        if (name == NULL || vm_global_slot(vm, name) != (int)i)
+        {
+            chunk_free(&loaded);
+            return false;
+        }
+    }
+
+    if (!reader->ok || reader->current != reader->end ||
+        !chunk_verify(&loaded, NULL, (int)global_count, NULL))
+    {
+        chunk_free(&loaded);
+        return false;
+    }
+
+    *chunk = loaded;
+    return true;
+}
+
+/**
+ * Load a chunk from a cache file
+ *
+ * @param vm the virtual machine that will run the chunk
+ * @param path the path of the cache file
+ * @param hash the hash of the current source
+ * @param length the length of the current source
+ * @param chunk an empty chunk to load the bytecode into
+ * @return whether the cache was usable
+ *
+ * A missing file, a file written by a different version
+ * or a file for a different source are all just a cache
+ * miss, and the caller compiles the source instead. The
+ * file is mapped and parsed in place, so the only copy made
+ * is the chunk itself.
+ */
+bool cache_load(VM* vm, const char* path, uint64_t hash, uint64_t length, Chunk* chunk)
+{
+    MappedFile file;
+    if (!file_map(path, &file)) return false;
+
+    Reader reader;
+    reader.current = (const uint8_t*)file.data;
+    reader.end = reader.current + file.length;
+    reader.ok = true;
+
+    bool loaded = cache_parse(vm, &reader, hash, length, chunk);
+    file_unmap(&file);
+    return loaded;
+}
+
+/**
+ * Open a new temporary file next to a cache file
+ *
+ * @param temporary set to the name of the file, which the caller
+ * frees
+ *
+ * Each writer gets a file of its own, so writers racing to cache
+ * the same script never write into each other's files. Where
+ * there is no mkstemp the name is fixed and racing writers are
+ * left to chance.
+ */
+static FILE* temporary_open(const char* path, char** temporary)
+{
+    size_t path_length = strlen(path);
+    *temporary = malloc(path_length + 8);
+    if (*temporary == NULL) return NULL;
+
+    memcpy(*temporary, path, path_length);
+#ifdef HAVE_MKSTEMP
+    strcpy(*temporary + path_length, ".XXXXXX");
+
+    int fd = mkstemp(*temporary);
+    if (fd == -1)
+    {
+        free(*temporary);
+        return NULL;
+    }
+
+    // mkstemp creates the file readable by its owner only.
+    fchmod(fd, 0644);
+    FILE* file = fdopen(fd, "wb");
+    if (file == NULL)
+    {
+        close(fd);
+        remove(*temporary);
+        free(*temporary);
+    }
+#else
+    strcpy(*temporary + path_length, ".tmp");
+
+    FILE* file = fopen(*temporary, "wb");
+    if (file == NULL) free(*temporary);
+#endif
+
+    return file;
+}
+
+/**
+ * Write a chunk to a cache file
+ *
+ * @param vm the virtual machine the chunk was compiled for
+ * @param path the path of the cache file
+ * @param hash the hash of the source the chunk was compiled from
+ * @param length the length of that source
+ * @param chunk the compiled chunk
+ * @return whether the cache file was written
+ *
+ * The file is written under a temporary name of its own and
+ * renamed into place, so a concurrent run never sees a partial
+ * cache. Not being able to write the cache is not an error,
+ * the script simply gets compiled again next time.
+ */
+bool cache_store(VM* vm, const char* path, uint64_t hash, uint64_t length, Chunk* chunk)
+{
+    char* temporary;
+    FILE* file = temporary_open(path, &temporary);
+    if (file == NULL) return false;
+
+    fwrite(CACHE_MAGIC, 1, 4, file);
+    uint_write(file, CACHE_VERSION, 4);
+    uint_write(file, hash, 8);
+    uint_write(file, length, 8);
+
+    bool written = body_write(file, chunk);
+
+    uint_write(file, (uint64_t)vm->global_names.count, 4);
+    for (int i = 0; i < vm->global_names.count; i++)
+    {
+        string_write(file, AS_STRING(vm->global_names.values[i]));
+    }
+
+    if (ferror(file)) written = false;
+    if (fclose(file) != 0) written = false;
+
+    if (written && rename(temporary, path) != 0) written = false;
+    if (!written) remove(temporary);
+
+    free(temporary);
+    return written;
+}
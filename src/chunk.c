@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include "chunk.h"
 #include "memory.h"
 #include "value.h"
@@ -15,8 +16,13 @@ void chunk_init(Chunk* chunk)
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->code = NULL;
+    chunk->line_count = 0;
+    chunk->line_capacity = 0;
     chunk->lines = NULL;
     value_array_init(&chunk->constants);
+    chunk->constant_index = NULL;
+    chunk->constant_index_capacity = 0;
+    chunk->constant_index_count = 0;
 }
 
 /**
@@ -29,8 +35,9 @@ void chunk_init(Chunk* chunk)
 void chunk_free(Chunk* chunk)
 {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    FREE_ARRAY(LineStart, chunk->lines, chunk->line_capacity);
     value_array_free(&chunk->constants);
+    FREE_ARRAY(int, chunk->constant_index, chunk->constant_index_capacity);
     chunk_init(chunk);
 }
 
@@ -45,6 +52,9 @@ void chunk_free(Chunk* chunk)
  * the elements of the array over to the newly allocated 
  * array. Doubling the size in this way means that on 
  * average, the cost of appending to the chunk is O(1).
+ *
+ * The line is only recorded when it differs from the
+ * line of the previous byte, starting a new run.
  */
 void chunk_write(Chunk* chunk, uint8_t byte, int line)
 {
@@ -55,14 +65,177 @@ void chunk_write(Chunk* chunk, uint8_t byte, int line)
         chunk->code = GROW_ARRAY(
             chunk->code, uint8_t, capacity_old, chunk->capacity
         );
-        chunk->lines = GROW_ARRAY(
-            chunk->lines, int, capacity_old, chunk->capacity
-        );
     }
 
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
     chunk->count++;
+
+    if (chunk->line_count > 0 && chunk->lines[chunk->line_count - 1].line == line)
+    {
+        return;
+    }
+
+    if (chunk->line_capacity < chunk->line_count + 1)
+    {
+        int capacity_old = chunk->line_capacity;
+        chunk->line_capacity = GROW_CAPACITY(capacity_old);
+        chunk->lines = GROW_ARRAY(
+            chunk->lines, LineStart, capacity_old, chunk->line_capacity
+        );
+    }
+
+    LineStart* start = &chunk->lines[chunk->line_count++];
+    start->offset = chunk->count - 1;
+    start->line = line;
+}
+
+/**
+ * Drop the code past a given offset
+ *
+ * @param chunk the chunk to shrink
+ * @param count the number of bytes of code to keep
+ *
+ * Line runs that start in the dropped code go with it.
+ */
+void chunk_truncate(Chunk* chunk, int count)
+{
+    chunk->count = count;
+
+    while (chunk->line_count > 0 &&
+           chunk->lines[chunk->line_count - 1].offset >= count)
+    {
+        chunk->line_count--;
+    }
+}
+
+/**
+ * Get the source line of a byte of code
+ *
+ * @param chunk the chunk holding the code
+ * @param offset the offset of the byte
+ * @return the line the byte was compiled from
+ *
+ * A binary search for the last run starting at or before
+ * the offset. Only error reporting and the disassembler need
+ * lines, so they can afford the search.
+ */
+int chunk_line_get(Chunk* chunk, int offset)
+{
+    int low = 0;
+    int high = chunk->line_count - 1;
+
+    while (low < high)
+    {
+        int mid = low + (high - low + 1) / 2;
+        if (chunk->lines[mid].offset > offset)
+        {
+            high = mid - 1;
+        }
+        else
+        {
+            low = mid;
+        }
+    }
+
+    return chunk->lines[low].line;
+}
+
+/**
+ * Hash a value for the constant index
+ *
+ * Hashes the representation of the value, in line with
+ * `values_identical`, and mixes the bits so that numbers
+ * that differ only in their high bits spread out too.
+ */
+static uint32_t value_hash(Value value)
+{
+#ifdef NAN_BOXING
+    uint64_t bits = value;
+#else
+    uint64_t bits = 0;
+    switch (value.type)
+    {
+        case VAL_BOOL:   bits = value.as.boolean; break;
+        case VAL_NIL:    break;
+        case VAL_NUMBER: memcpy(&bits, &value.as.number, sizeof(double)); break;
+        case VAL_OBJ:    bits = (uint64_t)(uintptr_t)value.as.obj; break;
+        case VAL_UNDEFINED: break;
+    }
+    bits ^= (uint64_t)value.type << 60;
+#endif
+
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    bits *= 0xc4ceb9fe1a85ec53ULL;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+/**
+ * Find the slot of a constant in the constant index
+ *
+ * @return the slot holding the constant, or the empty slot
+ * where it would go
+ *
+ * Slots hold positions in the constant array, or -1 when
+ * empty. A slot is only trusted after checking that the
+ * constant at that position really is the value we look for.
+ * The compiler drops constants off the end of the array when
+ * it folds expressions, which leaves stale slots behind. These
+ * fail the check and are probed past like any other collision.
+ */
+static int constant_index_find(Chunk* chunk, Value value)
+{
+    uint32_t mask = (uint32_t)chunk->constant_index_capacity - 1;
+    uint32_t slot = value_hash(value) & mask;
+
+    for (;;)
+    {
+        int constant = chunk->constant_index[slot];
+        if (constant == -1) return (int)slot;
+
+        if (constant < chunk->constants.count &&
+            values_identical(chunk->constants.values[constant], value))
+        {
+            return (int)slot;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+}
+
+/**
+ * Rebuild the constant index with room to grow
+ *
+ * The new index is sized for the live constants only,
+ * so this also sweeps out any stale slots.
+ */
+static void constant_index_rebuild(Chunk* chunk)
+{
+    int capacity_old = chunk->constant_index_capacity;
+    int capacity = 8;
+    while (capacity < (chunk->constants.count + 1) * 2) capacity *= 2;
+
+    FREE_ARRAY(int, chunk->constant_index, capacity_old);
+    chunk->constant_index = GROW_ARRAY(NULL, int, 0, capacity);
+    chunk->constant_index_capacity = capacity;
+    chunk->constant_index_count = 0;
+
+    for (int i = 0; i < capacity; i++)
+    {
+        chunk->constant_index[i] = -1;
+    }
+
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        int slot = constant_index_find(chunk, chunk->constants.values[i]);
+        if (chunk->constant_index[slot] == -1)
+        {
+            chunk->constant_index[slot] = i;
+            chunk->constant_index_count++;
+        }
+    }
 }
 
 /**
@@ -71,10 +244,56 @@ void chunk_write(Chunk* chunk, uint8_t byte, int line)
  * @param chunk the chunk the constant will be added to
  * @param value the constant value to be added
  * @return the index at which that constant can be found
+ *
+ * If an identical constant is already in the chunk we return
+ * its index instead of adding a copy. Lookups go through a
+ * small hash index kept at most three quarters full, so this
+ * stays cheap for chunks with very many constants.
  */
 int chunk_constant_add(Chunk* chunk, Value value)
 {
+    if ((chunk->constant_index_count + 1) * 4 > chunk->constant_index_capacity * 3)
+    {
+        constant_index_rebuild(chunk);
+    }
+
+    int slot = constant_index_find(chunk, value);
+    if (chunk->constant_index[slot] != -1) return chunk->constant_index[slot];
+
     value_array_write(&chunk->constants, value);
+    chunk->constant_index[slot] = chunk->constants.count - 1;
+    chunk->constant_index_count++;
     return chunk->constants.count - 1;
 }
 
+/**
+ * Write an instruction that loads a constant
+ *
+ * @param chunk the chunk to write to
+ * @param value the constant to load
+ * @param line the source line of the instruction
+ * @return the index of the constant
+ *
+ * The first 256 constants are loaded with OP_CONSTANT and a
+ * single byte operand. Past that we switch to OP_CONSTANT_LONG,
+ * whose three byte operand is stored low byte first.
+ */
+int chunk_constant_write(Chunk* chunk, Value value, int line)
+{
+    int constant = chunk_constant_add(chunk, value);
+
+    if (constant <= UINT8_MAX)
+    {
+        chunk_write(chunk, OP_CONSTANT, line);
+        chunk_write(chunk, (uint8_t)constant, line);
+    }
+    else
+    {
+        chunk_write(chunk, OP_CONSTANT_LONG, line);
+        chunk_write(chunk, (uint8_t)(constant & 0xff), line);
+        chunk_write(chunk, (uint8_t)((constant >> 8) & 0xff), line);
+        chunk_write(chunk, (uint8_t)((constant >> 16) & 0xff), line);
+    }
+
+    return constant;
+}
@@ -1,28 +1,1658 @@
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "common.h"
 #include "compiler.h"
+#include "memory.h"
+#include "object.h"
+#include "optimizer.h"
 #include "scanner.h"
+#include "token.h"
 
-void compile(const char* source)
+#ifdef DEBUG_PRINT_CODE
+#include "debug.h"
+#endif
+
+// Local slots are addressed with at most a 16-bit operand.
+#define LOCALS_MAX (UINT16_MAX + 1)
+// Upvalues are addressed with a one byte operand.
+#define UPVALUES_MAX (UINT8_MAX + 1)
+#define PARAMETERS_MAX UINT8_MAX
+// Calls with up to this many arguments have an instruction
+// of their own.
+#define CALL_SHORT_MAX 3
+
+/**
+ * A local variable in scope
+ *
+ * Locals live on the VM stack in the order they are declared,
+ * so a local's index in its function's `locals` is also its
+ * stack slot. The name is interned: the token it came from may
+ * have left a streaming scanner's buffer by the time it is
+ * looked up.
+ */
+typedef struct
+{
+    ObjString* name;
+    // The depth of the scope that declared the local, or -1
+    // while its initializer is being compiled.
+    int depth;
+    // Whether a closure captures the local.
+    bool captured;
+    // Whether the local is assigned after its declaration.
+    bool assigned;
+} Local;
+
+/**
+ * A variable a function captures from the functions around it
+ */
+typedef struct
+{
+    // A stack slot of the enclosing function when `is_local`,
+    // otherwise an index into the enclosing function's upvalues.
+    uint16_t index;
+    bool is_local;
+} Upvalue;
+
+/**
+ * A capture of a local by OP_CLOSURE that may become a copy
+ *
+ * Captures of locals are emitted as CAPTURE_LOCAL. Whether the
+ * local is ever assigned is only known once it goes out of
+ * scope, and a local that isn't has its captures rewritten to
+ * copy the value instead.
+ */
+typedef struct
+{
+    int slot;
+    // Offset of the capture's kind byte in the chunk.
+    int offset;
+} Capture;
+
+typedef enum
+{
+    TYPE_FUNCTION,
+    TYPE_SCRIPT,
+} FunctionType;
+
+/**
+ * The state of the function being compiled
+ *
+ * Function declarations nest, so each has its own compiler
+ * linked to the one of the function around it, which is how
+ * variables of enclosing functions are found.
+ */
+typedef struct Compiler
+{
+    struct Compiler* enclosing;
+    // NULL for the top level script, which is compiled
+    // straight into the chunk it was given.
+    ObjFunction* function;
+    FunctionType type;
+    Chunk* chunk;
+    Local* locals;
+    int local_count;
+    int local_capacity;
+    Upvalue upvalues[UPVALUES_MAX];
+    Capture* captures;
+    int capture_count;
+    int capture_capacity;
+    // The number of blocks around the code being compiled,
+    // 0 at the top level of the function.
+    int scope_depth;
+} Compiler;
+
+typedef struct
+{
+    TokenStream tokens;
+    // The VM the compiled chunk will run on, which owns the
+    // strings and functions the compiler creates.
+    VM* vm;
+    Compiler* compiler;
+    Token current;
+    Token previous;
+    bool had_error;
+    bool panic_mode;
+    // Offset of the opcode of the last instruction emitted.
+    int last_op;
+    // Where the code and constants of the left operand of
+    // the infix expression being parsed begin.
+    int left_start;
+    int left_constants;
+} Parser;
+
+/**
+ * Operator precedence, from lowest to highest
+ *
+ * The Pratt parser compares these numerically, so the
+ * order of the enum is significant.
+ */
+typedef enum
+{
+    PREC_NONE,
+    PREC_ASSIGNMENT,  // =
+    PREC_OR,          // or
+    PREC_AND,         // and
+    PREC_EQUALITY,    // == !=
+    PREC_COMPARISON,  // < > <= >=
+    PREC_TERM,        // + -
+    PREC_FACTOR,      // * /
+    PREC_UNARY,       // ! -
+    PREC_CALL,        // . ()
+    PREC_PRIMARY,
+} Precedence;
+
+typedef void (*ParseFn)(Parser* parser, bool can_assign);
+
+/**
+ * A row in the parse table
+ *
+ * For a given token type we store the function to compile
+ * a prefix expression starting with that token, the function
+ * to compile an infix expression whose left operand is followed
+ * by that token, and the precedence of the infix expression.
+ */
+typedef struct
+{
+    ParseFn prefix;
+    ParseFn infix;
+    Precedence precedence;
+} ParseRule;
+
+static Chunk* chunk_current(Parser* parser)
 {
-    scanner_init(source);
+    return parser->compiler->chunk;
+}
+
+/**
+ * Report an error at a given token
+ *
+ * Once we have reported an error we enter panic mode and
+ * suppress any further errors. Those would most likely be
+ * cascading from the first one and only confuse the user.
+ */
+static void error_at(Parser* parser, Token* token, const char* message)
+{
+    if (parser->panic_mode) return;
+    parser->panic_mode = true;
+
+    fprintf(stderr, "[line %d] Error", token->line);
+
+    if (TOKEN_TYPE(*token) == TOKEN_EOF)
+    {
+        fprintf(stderr, " at end");
+    }
+    else if (TOKEN_TYPE(*token) == TOKEN_ERROR)
+    {
+        // Nothing, the message is the lexeme.
+    }
+    else
+    {
+        fprintf(stderr, " at '%.*s'", TOKEN_LENGTH(*token), token_lexeme(&parser->tokens.scanner, *token));
+    }
+
+    fprintf(stderr, ": %s\n", message);
+    parser->had_error = true;
+}
+
+static void error(Parser* parser, const char* message)
+{
+    error_at(parser, &parser->previous, message);
+}
+
+static void error_at_current(Parser* parser, const char* message)
+{
+    error_at(parser, &parser->current, message);
+}
+
+/**
+ * Step forward through the token stream
+ *
+ * The scanner does not report lexical errors itself, it
+ * hands us error tokens instead. We report those here and
+ * keep scanning until we find a token worth parsing.
+ */
+static void advance(Parser* parser)
+{
+    parser->previous = parser->current;
 
-    int line = -1;
     for (;;)
     {
-        Token token = token_scan();
-        if (token.line != line)
+        parser->current = token_next(&parser->tokens);
+        if (TOKEN_TYPE(parser->current) != TOKEN_ERROR) break;
+
+        error_at_current(parser, token_error_message(parser->current));
+    }
+}
+
+/**
+ * Consume a token of an expected type
+ *
+ * If the current token is not of the expected type,
+ * we report an error with the given message.
+ */
+static void consume(Parser* parser, TokenType type, const char* message)
+{
+    if (TOKEN_TYPE(parser->current) == type)
+    {
+        advance(parser);
+        return;
+    }
+
+    error_at_current(parser, message);
+}
+
+static bool check(Parser* parser, TokenType type)
+{
+    return TOKEN_TYPE(parser->current) == type;
+}
+
+/**
+ * Consume the current token if it has a given type
+ *
+ * @return whether the token was consumed
+ */
+static bool match(Parser* parser, TokenType type)
+{
+    if (!check(parser, type)) return false;
+    advance(parser);
+    return true;
+}
+
+/**
+ * Append a single byte to the chunk being compiled
+ *
+ * The line of the previous token is recorded with the
+ * byte so that runtime errors can be tied back to the source.
+ */
+static void emit_byte(Parser* parser, uint8_t byte)
+{
+    chunk_write(chunk_current(parser), byte, parser->previous.line);
+}
+
+/**
+ * Append the opcode of an instruction
+ *
+ * Any operands follow with `emit_byte`. We remember where
+ * the instruction starts so the folding code can tell which
+ * instruction produced the value of an operand.
+ */
+static void emit_op(Parser* parser, uint8_t op)
+{
+    parser->last_op = chunk_current(parser)->count;
+    emit_byte(parser, op);
+}
+
+/**
+ * Append a two byte operand, low byte first
+ */
+static void emit_short(Parser* parser, uint16_t value)
+{
+    emit_byte(parser, (uint8_t)(value & 0xff));
+    emit_byte(parser, (uint8_t)(value >> 8));
+}
+
+/**
+ * Emit a return without a value
+ *
+ * Functions return nil when they don't return anything else.
+ * The script returns nothing at all.
+ */
+static void emit_return(Parser* parser)
+{
+    if (parser->compiler->type == TYPE_FUNCTION) emit_op(parser, OP_NIL);
+    emit_op(parser, OP_RETURN);
+}
+
+/**
+ * Emit the cheapest instruction that loads a value
+ *
+ * nil and the booleans have their own instructions, so
+ * results of constant folding don't always need a constant.
+ * Other values go in the constant table, which reuses the
+ * entry of an identical constant if there is one.
+ */
+static void emit_constant(Parser* parser, Value value)
+{
+    if (IS_NIL(value))
+    {
+        emit_op(parser, OP_NIL);
+    }
+    else if (IS_BOOL(value))
+    {
+        emit_op(parser, AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    }
+    else
+    {
+        parser->last_op = chunk_current(parser)->count;
+        int constant = chunk_constant_write(chunk_current(parser), value, parser->previous.line);
+        if (constant > CONSTANT_LONG_MAX)
+        {
+            error(parser, "Too many constants in one chunk.");
+        }
+    }
+}
+
+/**
+ * Check whether a span of code loads a single constant
+ *
+ * @param start offset where the code of an operand begins
+ * @param end offset just past the operand's code
+ * @param value set to the constant when there is one
+ * @return whether the operand is a lone constant
+ */
+static bool constant_span(Parser* parser, int start, int end, Value* value)
+{
+    Chunk* chunk = chunk_current(parser);
+    int length = end - start;
+
+    if (length == 2 && chunk->code[start] == OP_CONSTANT)
+    {
+        *value = chunk->constants.values[chunk->code[start + 1]];
+        return true;
+    }
+
+    if (length == 4 && chunk->code[start] == OP_CONSTANT_LONG)
+    {
+        int constant = chunk->code[start + 1] |
+            (chunk->code[start + 2] << 8) |
+            (chunk->code[start + 3] << 16);
+        *value = chunk->constants.values[constant];
+        return true;
+    }
+
+    if (length != 1) return false;
+
+    switch (chunk->code[start])
+    {
+        case OP_NIL:   *value = NIL_VAL; return true;
+        case OP_TRUE:  *value = BOOL_VAL(true); return true;
+        case OP_FALSE: *value = BOOL_VAL(false); return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Throw away the code and constants emitted since a point
+ *
+ * Only used on operands that are a lone constant, so any
+ * constants added since then are referenced by nothing else.
+ */
+static void code_rewind(Parser* parser, int start, int constants)
+{
+    chunk_truncate(chunk_current(parser), start);
+    chunk_current(parser)->constants.count = constants;
+}
+
+/**
+ * Check whether an instruction always leaves a number
+ *
+ * The arithmetic instructions either produce a number or
+ * fail with a runtime error, so an operand computed by one
+ * of them is known to be a number at compile time. Addition
+ * is not one of them since it also concatenates strings.
+ */
+static bool op_yields_number(uint8_t op)
+{
+    switch (op)
+    {
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NEGATE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Evaluate a binary operator on two constants
+ *
+ * @return whether the operator could be folded, which
+ * is not the case when it would fail at runtime
+ *
+ * The comparisons mirror the instructions the compiler
+ * emits for them, so `>=` is the negation of `<`, which
+ * matters when one of the operands is NaN. Adding two string
+ * literals interns their concatenation in `vm`.
+ */
+static bool binary_fold(VM* vm, TokenType operator_type, Value a, Value b, Value* result)
+{
+    switch (operator_type)
+    {
+        case TOKEN_EQUAL_EQUAL:
+            *result = BOOL_VAL(values_equal(a, b));
+            return true;
+        case TOKEN_BANG_EQUAL:
+            *result = BOOL_VAL(!values_equal(a, b));
+            return true;
+        default:
+            break;
+    }
+
+    if (operator_type == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b))
+    {
+        *result = OBJ_VAL(string_concatenate(vm, AS_STRING(a), AS_STRING(b)));
+        return true;
+    }
+
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+
+    switch (operator_type)
+    {
+        case TOKEN_GREATER:       *result = BOOL_VAL(x > y); return true;
+        case TOKEN_GREATER_EQUAL: *result = BOOL_VAL(!(x < y)); return true;
+        case TOKEN_LESS:          *result = BOOL_VAL(x < y); return true;
+        case TOKEN_LESS_EQUAL:    *result = BOOL_VAL(!(x > y)); return true;
+        case TOKEN_PLUS:          *result = NUMBER_VAL(x + y); return true;
+        case TOKEN_MINUS:         *result = NUMBER_VAL(x - y); return true;
+        case TOKEN_STAR:          *result = NUMBER_VAL(x * y); return true;
+        case TOKEN_SLASH:         *result = NUMBER_VAL(x / y); return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Check whether `x op constant` is always just `x`
+ *
+ * Only identities that hold for every double are used:
+ * `x + 0` is not one of them since -0 + 0 is +0, while
+ * `x + -0`, `x - 0`, `x * 1` and `x / 1` are.
+ */
+static bool binary_identity(TokenType operator_type, Value constant)
+{
+    if (!IS_NUMBER(constant)) return false;
+
+    double y = AS_NUMBER(constant);
+
+    switch (operator_type)
+    {
+        case TOKEN_PLUS:  return y == 0 && signbit(y);
+        case TOKEN_MINUS: return y == 0 && !signbit(y);
+        case TOKEN_STAR:
+        case TOKEN_SLASH:
+            return y == 1;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Start compiling a function
+ *
+ * @param name the function's name, NULL for anonymous functions
+ * and the script
+ *
+ * Slot 0 of a function's stack window holds the function being
+ * called, so it is taken by a local no name can refer to.
+ */
+static void compiler_init(Parser* parser, Compiler* compiler, FunctionType type, ObjString* name, Chunk* chunk)
+{
+    compiler->enclosing = parser->compiler;
+    compiler->function = NULL;
+    compiler->type = type;
+    compiler->chunk = chunk;
+    compiler->locals = NULL;
+    compiler->local_count = 0;
+    compiler->local_capacity = 0;
+    compiler->captures = NULL;
+    compiler->capture_count = 0;
+    compiler->capture_capacity = 0;
+    compiler->scope_depth = 0;
+    parser->compiler = compiler;
+
+    if (type == TYPE_SCRIPT) return;
+
+    compiler->function = function_new(parser->vm);
+    compiler->function->name = name;
+    compiler->chunk = &compiler->function->chunk;
+
+    compiler->local_capacity = GROW_CAPACITY(0);
+    compiler->locals = GROW_ARRAY(NULL, Local, 0, compiler->local_capacity);
+    compiler->local_count = 1;
+    compiler->locals[0].name = NULL;
+    compiler->locals[0].depth = 0;
+    compiler->locals[0].captured = false;
+    compiler->locals[0].assigned = false;
+}
+
+/**
+ * Settle the captures of locals from a slot upwards
+ *
+ * Called as those locals go out of scope, when everything that
+ * could assign them has been compiled. Captures of locals that
+ * never were assigned are turned into copies.
+ */
+static void captures_resolve(Parser* parser, int first)
+{
+    Compiler* compiler = parser->compiler;
+    int kept = 0;
+
+    for (int i = 0; i < compiler->capture_count; i++)
+    {
+        Capture capture = compiler->captures[i];
+        if (capture.slot < first)
+        {
+            compiler->captures[kept++] = capture;
+            continue;
+        }
+
+        if (!compiler->locals[capture.slot].assigned)
         {
-            printf("%4d ", token.line);
-            line = token.line;
+            compiler->chunk->code[capture.offset] = CAPTURE_LOCAL_VALUE;
+        }
+    }
+
+    compiler->capture_count = kept;
+}
+
+/**
+ * Finish compiling a function
+ *
+ * @return the compiled function, NULL for the script
+ *
+ * The locals still in scope are the function's parameters and
+ * the locals of its body. They are never popped one by one: the
+ * whole stack window goes away when the function returns.
+ */
+static ObjFunction* compiler_end(Parser* parser)
+{
+    Compiler* compiler = parser->compiler;
+
+    captures_resolve(parser, 0);
+    emit_return(parser);
+    if (!parser->had_error)
+    {
+        chunk_optimize(chunk_current(parser));
+    }
+#ifdef DEBUG_PRINT_CODE
+    if (!parser->had_error)
+    {
+        ObjFunction* function = compiler->function;
+        const char* name = "code";
+        if (function != NULL) name = function->name != NULL ? function->name->chars : "<fn>";
+        chunk_disassemble(chunk_current(parser), name);
+    }
+#endif
+
+    FREE_ARRAY(Local, compiler->locals, compiler->local_capacity);
+    FREE_ARRAY(Capture, compiler->captures, compiler->capture_capacity);
+    parser->compiler = compiler->enclosing;
+    return compiler->function;
+}
+
+static void expression(Parser* parser);
+static void statement(Parser* parser);
+static void declaration(Parser* parser);
+static void function(Parser* parser, ObjString* name, int self);
+static ParseRule* rule_get(TokenType type);
+static void precedence_parse(Parser* parser, Precedence precedence);
+
+/**
+ * Compile a binary expression
+ *
+ * By the time we get here the left operand has already
+ * been compiled and its value will be on the stack. We compile
+ * the right operand with one level higher precedence, since
+ * the binary operators are left associative, then emit the
+ * instruction that combines the two.
+ *
+ * When both operands turned out to be lone constants we fold
+ * them instead: their code is thrown away and the result is
+ * emitted as a single constant. Since the result is a lone
+ * constant again, whole trees of literal arithmetic collapse.
+ * An operator whose right operand is an identity element is
+ * dropped entirely when the left operand is known to be a number.
+ */
+static void binary(Parser* parser, bool can_assign)
+{
+    TokenType operator_type = TOKEN_TYPE(parser->previous);
+    int left_start = parser->left_start;
+    int left_constants = parser->left_constants;
+    int left_op = parser->last_op;
+    int right_start = chunk_current(parser)->count;
+    int right_constants = chunk_current(parser)->constants.count;
+
+    ParseRule* rule = rule_get(operator_type);
+    precedence_parse(parser, (Precedence)(rule->precedence + 1));
+
+    Value a;
+    Value b;
+    int right_end = chunk_current(parser)->count;
+    if (constant_span(parser, right_start, right_end, &b))
+    {
+        Value result;
+        bool left_constant = constant_span(parser, left_start, right_start, &a);
+
+        if (left_constant && binary_fold(parser->vm, operator_type, a, b, &result))
+        {
+            code_rewind(parser, left_start, left_constants);
+            emit_constant(parser, result);
+            return;
+        }
+
+        if (!left_constant && left_op >= left_start &&
+            op_yields_number(chunk_current(parser)->code[left_op]) &&
+            binary_identity(operator_type, b))
+        {
+            code_rewind(parser, right_start, right_constants);
+            parser->last_op = left_op;
+            return;
+        }
+    }
+
+    switch (operator_type)
+    {
+        case TOKEN_BANG_EQUAL:
+            emit_op(parser, OP_EQUAL);
+            emit_op(parser, OP_NOT);
+            break;
+        case TOKEN_EQUAL_EQUAL:   emit_op(parser, OP_EQUAL); break;
+        case TOKEN_GREATER:       emit_op(parser, OP_GREATER); break;
+        case TOKEN_GREATER_EQUAL:
+            emit_op(parser, OP_LESS);
+            emit_op(parser, OP_NOT);
+            break;
+        case TOKEN_LESS:          emit_op(parser, OP_LESS); break;
+        case TOKEN_LESS_EQUAL:
+            emit_op(parser, OP_GREATER);
+            emit_op(parser, OP_NOT);
+            break;
+        case TOKEN_PLUS:          emit_op(parser, OP_ADD); break;
+        case TOKEN_MINUS:         emit_op(parser, OP_SUBTRACT); break;
+        case TOKEN_STAR:          emit_op(parser, OP_MULTIPLY); break;
+        case TOKEN_SLASH:         emit_op(parser, OP_DIVIDE); break;
+        default:
+            return; // Unreachable
+    }
+}
+
+/**
+ * Compile the arguments of a call
+ *
+ * @return the number of arguments
+ */
+static int argument_list(Parser* parser)
+{
+    int argc = 0;
+    if (!check(parser, TOKEN_RIGHT_PAREN))
+    {
+        do
+        {
+            expression(parser);
+            if (argc == PARAMETERS_MAX)
+            {
+                error(parser, "Can't have more than 255 arguments.");
+            }
+            argc++;
+        } while (match(parser, TOKEN_COMMA));
+    }
+
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    return argc;
+}
+
+/**
+ * Compile a call
+ *
+ * The callee is already on the stack and the arguments are
+ * pushed above it. Calls with few arguments, which is most of
+ * them, use an instruction that has the count built in.
+ */
+static void call(Parser* parser, bool can_assign)
+{
+    int argc = argument_list(parser);
+    if (argc <= CALL_SHORT_MAX)
+    {
+        emit_op(parser, (uint8_t)(OP_CALL_0 + argc));
+        return;
+    }
+
+    emit_op(parser, OP_CALL);
+    emit_byte(parser, (uint8_t)argc);
+}
+
+/**
+ * Compile a literal
+ *
+ * The keywords true, false and nil each get a dedicated
+ * instruction, so they don't take up room in the constant table.
+ */
+static void literal(Parser* parser, bool can_assign)
+{
+    switch (TOKEN_TYPE(parser->previous))
+    {
+        case TOKEN_FALSE: emit_op(parser, OP_FALSE); break;
+        case TOKEN_NIL:   emit_op(parser, OP_NIL); break;
+        case TOKEN_TRUE:  emit_op(parser, OP_TRUE); break;
+        default:
+            return; // Unreachable
+    }
+}
+
+/**
+ * Compile a parenthesized expression
+ *
+ * Grouping has no runtime semantics of its own, it only
+ * lets a lower precedence expression appear where a higher
+ * one is expected.
+ */
+static void grouping(Parser* parser, bool can_assign)
+{
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+}
+
+static void number(Parser* parser, bool can_assign)
+{
+    double value = strtod(token_lexeme(&parser->tokens.scanner, parser->previous), NULL);
+    emit_constant(parser, NUMBER_VAL(value));
+}
+
+/**
+ * Compile a string literal
+ *
+ * The string is interned right away, so every occurrence
+ * of the same literal shares one object and one constant.
+ */
+static void string(Parser* parser, bool can_assign)
+{
+    const char* lexeme = token_lexeme(&parser->tokens.scanner, parser->previous);
+    int length = (int)TOKEN_LENGTH(parser->previous) - 2;
+    emit_constant(parser, OBJ_VAL(string_copy(parser->vm, lexeme + 1, length)));
+}
+
+static ObjString* identifier_string(Parser* parser, Token* name)
+{
+    const char* lexeme = token_lexeme(&parser->tokens.scanner, *name);
+    return string_copy(parser->vm, lexeme, (int)TOKEN_LENGTH(*name));
+}
+
+/**
+ * Get the global slot for a variable name
+ *
+ * Slots are handed out by the VM, so every chunk compiled for
+ * it agrees on them. Resolving names here means the running
+ * code never looks a global up by name.
+ */
+static uint16_t global_slot(Parser* parser, ObjString* name)
+{
+    int slot = vm_global_slot(parser->vm, name);
+    if (slot == -1)
+    {
+        error(parser, "Too many global variables.");
+        return 0;
+    }
+
+    return (uint16_t)slot;
+}
+
+/**
+ * Find the stack slot of a local variable
+ *
+ * @return the slot, or -1 if no local has that name
+ *
+ * The innermost declaration wins, so we search from the most
+ * recently declared local down. Interned names compare by
+ * pointer.
+ */
+static int local_resolve(Parser* parser, Compiler* compiler, ObjString* name)
+{
+    for (int i = compiler->local_count - 1; i >= 0; i--)
+    {
+        Local* local = &compiler->locals[i];
+        if (local->name == name)
+        {
+            if (local->depth == -1)
+            {
+                error(parser, "Can't read local variable in its own initializer.");
+            }
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Add a variable to the captures of a function
+ *
+ * @return the index of the capture
+ *
+ * A function refers to each captured variable by index in
+ * the closure's captures, however often the variable is used.
+ */
+static int upvalue_add(Parser* parser, Compiler* compiler, uint16_t index, bool is_local)
+{
+    int count = compiler->function->upvalue_count;
+
+    for (int i = 0; i < count; i++)
+    {
+        Upvalue* upvalue = &compiler->upvalues[i];
+        if (upvalue->index == index && upvalue->is_local == is_local) return i;
+    }
+
+    if (count == UPVALUES_MAX)
+    {
+        error(parser, "Too many closure variables in function.");
+        return 0;
+    }
+
+    compiler->upvalues[count].index = index;
+    compiler->upvalues[count].is_local = is_local;
+    return compiler->function->upvalue_count++;
+}
+
+/**
+ * Find a variable of an enclosing function
+ *
+ * @return the index of the capture, or -1 if no enclosing
+ * function has a local of that name
+ *
+ * A local of the function directly around is captured from
+ * its stack slot. One further out is first captured by every
+ * function in between, and each passes its capture on.
+ */
+static int upvalue_resolve(Parser* parser, Compiler* compiler, ObjString* name)
+{
+    if (compiler->enclosing == NULL) return -1;
+
+    int local = local_resolve(parser, compiler->enclosing, name);
+    if (local != -1)
+    {
+        compiler->enclosing->locals[local].captured = true;
+        return upvalue_add(parser, compiler, (uint16_t)local, true);
+    }
+
+    int upvalue = upvalue_resolve(parser, compiler->enclosing, name);
+    if (upvalue != -1)
+    {
+        return upvalue_add(parser, compiler, (uint16_t)upvalue, false);
+    }
+
+    return -1;
+}
+
+/**
+ * Note that a captured variable is assigned
+ *
+ * The mark ends up on the local the capture leads back to, so
+ * none of its captures is turned into a copy.
+ */
+static void upvalue_assign(Compiler* compiler, int index)
+{
+    Upvalue* upvalue = &compiler->upvalues[index];
+    if (upvalue->is_local)
+    {
+        compiler->enclosing->locals[upvalue->index].assigned = true;
+        return;
+    }
+
+    upvalue_assign(compiler->enclosing, upvalue->index);
+}
+
+/**
+ * Emit an instruction addressing a local's stack slot
+ *
+ * The first 256 slots fit a one byte operand, the rest use the
+ * long form of the instruction with a two byte operand.
+ */
+static void emit_local(Parser* parser, uint8_t op, uint8_t op_long, int slot)
+{
+    if (slot <= UINT8_MAX)
+    {
+        emit_op(parser, op);
+        emit_byte(parser, (uint8_t)slot);
+    }
+    else
+    {
+        emit_op(parser, op_long);
+        emit_short(parser, (uint16_t)slot);
+    }
+}
+
+/**
+ * Compile a read of or an assignment to a variable
+ *
+ * Assignment has the lowest precedence, so an `=` after the
+ * name only makes this an assignment when we are parsing at
+ * that level. Otherwise `a * b = c` would assign to `b`.
+ *
+ * Names are looked up as locals of the function being compiled,
+ * then as locals of the functions around it, which are captured.
+ * Names that are neither are globals.
+ */
+static void named_variable(Parser* parser, Token name, bool can_assign)
+{
+    Compiler* compiler = parser->compiler;
+    ObjString* string = identifier_string(parser, &name);
+    int local = local_resolve(parser, compiler, string);
+    int upvalue = local == -1 ? upvalue_resolve(parser, compiler, string) : -1;
+    bool assign = can_assign && match(parser, TOKEN_EQUAL);
+
+    if (assign) expression(parser);
+
+    if (local != -1)
+    {
+        if (assign)
+        {
+            compiler->locals[local].assigned = true;
+            emit_local(parser, OP_SET_LOCAL, OP_SET_LOCAL_LONG, local);
         }
         else
         {
-            printf("    | ");
+            emit_local(parser, OP_GET_LOCAL, OP_GET_LOCAL_LONG, local);
+        }
+        return;
+    }
+
+    if (upvalue != -1)
+    {
+        if (assign) upvalue_assign(compiler, upvalue);
+        emit_op(parser, assign ? OP_SET_UPVALUE : OP_GET_UPVALUE);
+        emit_byte(parser, (uint8_t)upvalue);
+        return;
+    }
+
+    uint16_t slot = global_slot(parser, string);
+    emit_op(parser, assign ? OP_SET_GLOBAL : OP_GET_GLOBAL);
+    emit_short(parser, slot);
+}
+
+static void variable(Parser* parser, bool can_assign)
+{
+    named_variable(parser, parser->previous, can_assign);
+}
+
+/**
+ * Compile a unary expression
+ *
+ * The operand is compiled first so its value is on the stack
+ * when the operator instruction runs. Like binary expressions,
+ * a unary operator applied to a lone constant is folded.
+ */
+static void unary(Parser* parser, bool can_assign)
+{
+    TokenType operator_type = TOKEN_TYPE(parser->previous);
+    int operand_start = chunk_current(parser)->count;
+    int operand_constants = chunk_current(parser)->constants.count;
+
+    precedence_parse(parser, PREC_UNARY);
+
+    Value operand;
+    if (constant_span(parser, operand_start, chunk_current(parser)->count, &operand))
+    {
+        if (operator_type == TOKEN_BANG)
+        {
+            code_rewind(parser, operand_start, operand_constants);
+            emit_constant(parser, BOOL_VAL(IS_NIL(operand) ||
+                (IS_BOOL(operand) && !AS_BOOL(operand))));
+            return;
         }
-        printf("%2d '%.*s'\n", token.type, token.length, token.start);
 
-        if (token.type == TOKEN_EOF) break;
+        if (operator_type == TOKEN_MINUS && IS_NUMBER(operand))
+        {
+            code_rewind(parser, operand_start, operand_constants);
+            emit_constant(parser, NUMBER_VAL(-AS_NUMBER(operand)));
+            return;
+        }
     }
+
+    switch (operator_type)
+    {
+        case TOKEN_BANG:  emit_op(parser, OP_NOT); break;
+        case TOKEN_MINUS: emit_op(parser, OP_NEGATE); break;
+        default:
+            return; // Unreachable
+    }
+}
+
+/**
+ * Compile an anonymous function expression
+ */
+static void lambda(Parser* parser, bool can_assign)
+{
+    function(parser, NULL, -1);
+}
+
+ParseRule rules[] = {
+    [TOKEN_LEFT_PAREN]    = { grouping, call,   PREC_CALL },
+    [TOKEN_RIGHT_PAREN]   = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_LEFT_BRACE]    = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_RIGHT_BRACE]   = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_COMMA]         = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_DOT]           = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_MINUS]         = { unary,    binary, PREC_TERM },
+    [TOKEN_PLUS]          = { NULL,     binary, PREC_TERM },
+    [TOKEN_SEMICOLON]     = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_SLASH]         = { NULL,     binary, PREC_FACTOR },
+    [TOKEN_STAR]          = { NULL,     binary, PREC_FACTOR },
+    [TOKEN_BANG]          = { unary,    NULL,   PREC_NONE },
+    [TOKEN_BANG_EQUAL]    = { NULL,     binary, PREC_EQUALITY },
+    [TOKEN_EQUAL]         = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_EQUAL_EQUAL]   = { NULL,     binary, PREC_EQUALITY },
+    [TOKEN_GREATER]       = { NULL,     binary, PREC_COMPARISON },
+    [TOKEN_GREATER_EQUAL] = { NULL,     binary, PREC_COMPARISON },
+    [TOKEN_LESS]          = { NULL,     binary, PREC_COMPARISON },
+    [TOKEN_LESS_EQUAL]    = { NULL,     binary, PREC_COMPARISON },
+    [TOKEN_IDENTIFIER]    = { variable, NULL,   PREC_NONE },
+    [TOKEN_STRING]        = { string,   NULL,   PREC_NONE },
+    [TOKEN_NUMBER]        = { number,   NULL,   PREC_NONE },
+    [TOKEN_AND]           = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_CLASS]         = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_ELSE]          = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_FALSE]         = { literal,  NULL,   PREC_NONE },
+    [TOKEN_FOR]           = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_FN]            = { lambda,   NULL,   PREC_NONE },
+    [TOKEN_IF]            = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_NIL]           = { literal,  NULL,   PREC_NONE },
+    [TOKEN_OR]            = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_PRINT]         = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_RETURN]        = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_SUPER]         = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_THIS]          = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_TRUE]          = { literal,  NULL,   PREC_NONE },
+    [TOKEN_LET]           = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_WHILE]         = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_ERROR]         = { NULL,     NULL,   PREC_NONE },
+    [TOKEN_EOF]           = { NULL,     NULL,   PREC_NONE },
+};
+
+/**
+ * Parse an expression at a given precedence level or higher
+ *
+ * This is the core of the Pratt parser. The first token always
+ * belongs to some prefix expression. After compiling it, we keep
+ * folding it into infix expressions for as long as the next
+ * token binds at least as tightly as the requested precedence.
+ */
+static void precedence_parse(Parser* parser, Precedence precedence)
+{
+    advance(parser);
+    int start = chunk_current(parser)->count;
+    int constants = chunk_current(parser)->constants.count;
+
+    ParseFn prefix_rule = rule_get(TOKEN_TYPE(parser->previous))->prefix;
+    if (prefix_rule == NULL)
+    {
+        error(parser, "Expect expression.");
+        return;
+    }
+
+    bool can_assign = precedence <= PREC_ASSIGNMENT;
+    prefix_rule(parser, can_assign);
+
+    while (precedence <= rule_get(TOKEN_TYPE(parser->current))->precedence)
+    {
+        advance(parser);
+        ParseFn infix_rule = rule_get(TOKEN_TYPE(parser->previous))->infix;
+        parser->left_start = start;
+        parser->left_constants = constants;
+        infix_rule(parser, can_assign);
+    }
+
+    // An `=` that nothing consumed follows something that
+    // can't be assigned to.
+    if (can_assign && match(parser, TOKEN_EQUAL))
+    {
+        error(parser, "Invalid assignment target.");
+    }
+}
+
+static ParseRule* rule_get(TokenType type)
+{
+    return &rules[type];
+}
+
+static void expression(Parser* parser)
+{
+    precedence_parse(parser, PREC_ASSIGNMENT);
+}
+
+/**
+ * Declare a local variable in the current scope
+ *
+ * The local isn't usable until its initializer has been
+ * compiled, see `let_declaration`.
+ */
+static void local_add(Parser* parser, ObjString* name)
+{
+    Compiler* compiler = parser->compiler;
+
+    for (int i = compiler->local_count - 1; i >= 0; i--)
+    {
+        Local* local = &compiler->locals[i];
+        if (local->depth != -1 && local->depth < compiler->scope_depth) break;
+
+        if (local->name == name)
+        {
+            error(parser, "Already a variable with this name in this scope.");
+        }
+    }
+
+    if (compiler->local_count == LOCALS_MAX)
+    {
+        error(parser, "Too many local variables.");
+        return;
+    }
+
+    if (compiler->local_count == compiler->local_capacity)
+    {
+        int capacity_old = compiler->local_capacity;
+        compiler->local_capacity = GROW_CAPACITY(capacity_old);
+        compiler->locals = GROW_ARRAY(compiler->locals, Local, capacity_old, compiler->local_capacity);
+    }
+
+    Local* local = &compiler->locals[compiler->local_count++];
+    local->name = name;
+    local->depth = -1;
+    local->captured = false;
+    local->assigned = false;
+}
+
+/**
+ * Make the most recently declared local usable
+ *
+ * Nothing is marked when declaring the local failed.
+ */
+static void local_initialize(Parser* parser)
+{
+    Compiler* compiler = parser->compiler;
+    Local* local = &compiler->locals[compiler->local_count - 1];
+    if (local->depth == -1) local->depth = compiler->scope_depth;
+}
+
+/**
+ * Compile a variable declaration
+ *
+ * A variable declared without an initializer starts out nil.
+ * The name is resolved before the initializer is parsed, while
+ * its token is still at hand.
+ *
+ * Inside a block the variable is a local: the initializer's
+ * value is simply left on the stack, where it becomes the
+ * local's slot. Only globals need an instruction to define them.
+ */
+static void let_declaration(Parser* parser)
+{
+    consume(parser, TOKEN_IDENTIFIER, "Expect variable name.");
+    ObjString* name = identifier_string(parser, &parser->previous);
+
+    uint16_t slot = 0;
+    if (parser->compiler->scope_depth > 0)
+    {
+        local_add(parser, name);
+    }
+    else
+    {
+        slot = global_slot(parser, name);
+    }
+
+    if (match(parser, TOKEN_EQUAL))
+    {
+        expression(parser);
+    }
+    else
+    {
+        emit_op(parser, OP_NIL);
+    }
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+
+    if (parser->compiler->scope_depth > 0)
+    {
+        local_initialize(parser);
+        return;
+    }
+
+    emit_op(parser, OP_DEFINE_GLOBAL);
+    emit_short(parser, slot);
+}
+
+static void scope_begin(Parser* parser)
+{
+    parser->compiler->scope_depth++;
+}
+
+static void block(Parser* parser)
+{
+    while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF))
+    {
+        declaration(parser);
+    }
+
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+}
+
+/**
+ * Emit the instruction that creates a function's value
+ *
+ * @param self the slot of the local the function is declared
+ * as, or -1
+ *
+ * A function that captures nothing needs no closure: the
+ * function itself is loaded as a constant, and creating it
+ * allocates nothing. Otherwise OP_CLOSURE is followed by how to
+ * capture each variable.
+ *
+ * A function declared as a local is in scope in its own body,
+ * but it only lands in its slot once OP_CLOSURE has run. There
+ * is no value to copy before then, so capturing itself marks
+ * the local as assigned, which keeps it captured by reference.
+ */
+static void closure_emit(Parser* parser, Compiler* compiler, ObjFunction* function, int self)
+{
+    if (function->upvalue_count == 0)
+    {
+        emit_constant(parser, OBJ_VAL(function));
+        return;
+    }
+
+    Chunk* chunk = chunk_current(parser);
+    int constant = chunk_constant_add(chunk, OBJ_VAL(function));
+    if (constant > CONSTANT_LONG_MAX)
+    {
+        error(parser, "Too many constants in one chunk.");
+    }
+
+    emit_op(parser, OP_CLOSURE);
+    emit_byte(parser, (uint8_t)(constant & 0xff));
+    emit_byte(parser, (uint8_t)((constant >> 8) & 0xff));
+    emit_byte(parser, (uint8_t)((constant >> 16) & 0xff));
+
+    Compiler* current = parser->compiler;
+    for (int i = 0; i < function->upvalue_count; i++)
+    {
+        Upvalue* upvalue = &compiler->upvalues[i];
+        if (!upvalue->is_local)
+        {
+            emit_byte(parser, CAPTURE_UPVALUE);
+            emit_short(parser, upvalue->index);
+            continue;
+        }
+
+        if (upvalue->index == self) current->locals[self].assigned = true;
+
+        if (current->capture_count == current->capture_capacity)
+        {
+            int capacity_old = current->capture_capacity;
+            current->capture_capacity = GROW_CAPACITY(capacity_old);
+            current->captures = GROW_ARRAY(current->captures, Capture, capacity_old, current->capture_capacity);
+        }
+        Capture* capture = &current->captures[current->capture_count++];
+        capture->slot = upvalue->index;
+        capture->offset = chunk->count;
+
+        emit_byte(parser, CAPTURE_LOCAL);
+        emit_short(parser, upvalue->index);
+    }
+}
+
+/**
+ * Compile a function's parameters and body
+ *
+ * @param name the function's name, NULL for an anonymous one
+ * @param self the slot of the local the function is declared
+ * as, or -1
+ *
+ * The function gets a compiler of its own. Once its body is
+ * done, the code to create its value is emitted in the
+ * function around it.
+ */
+static void function(Parser* parser, ObjString* name, int self)
+{
+    Compiler compiler;
+    compiler_init(parser, &compiler, TYPE_FUNCTION, name, NULL);
+    scope_begin(parser);
+
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' before parameters.");
+    if (!check(parser, TOKEN_RIGHT_PAREN))
+    {
+        do
+        {
+            if (++compiler.function->arity > PARAMETERS_MAX)
+            {
+                error_at_current(parser, "Can't have more than 255 parameters.");
+            }
+            consume(parser, TOKEN_IDENTIFIER, "Expect parameter name.");
+            local_add(parser, identifier_string(parser, &parser->previous));
+            local_initialize(parser);
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    block(parser);
+
+    ObjFunction* compiled = compiler_end(parser);
+    closure_emit(parser, &compiler, compiled, self);
+}
+
+/**
+ * Compile a function declaration
+ *
+ * The name is defined before the body is compiled, so the
+ * function can call itself.
+ */
+static void fn_declaration(Parser* parser)
+{
+    consume(parser, TOKEN_IDENTIFIER, "Expect function name.");
+    ObjString* name = identifier_string(parser, &parser->previous);
+
+    if (parser->compiler->scope_depth > 0)
+    {
+        local_add(parser, name);
+        local_initialize(parser);
+        function(parser, name, parser->compiler->local_count - 1);
+        return;
+    }
+
+    uint16_t slot = global_slot(parser, name);
+    function(parser, name, -1);
+    emit_op(parser, OP_DEFINE_GLOBAL);
+    emit_short(parser, slot);
+}
+
+static void print_statement(Parser* parser)
+{
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after value.");
+    emit_op(parser, OP_PRINT);
+}
+
+/**
+ * Turn a call that was just emitted into a tail call
+ *
+ * @return whether the last instruction was a call
+ *
+ * The value of an expression is whatever its last instruction
+ * leaves, so when that is a call, nothing happens to the result
+ * after the call and the call can replace the caller's frame.
+ */
+static bool tail_call_emit(Parser* parser)
+{
+    Chunk* chunk = chunk_current(parser);
+    int op = parser->last_op;
+    if (op < 0) return false;
+
+    int argc;
+    if (op == chunk->count - 1 && chunk->code[op] >= OP_CALL_0 && chunk->code[op] <= OP_CALL_3)
+    {
+        argc = chunk->code[op] - OP_CALL_0;
+    }
+    else if (op == chunk->count - 2 && chunk->code[op] == OP_CALL)
+    {
+        argc = chunk->code[op + 1];
+    }
+    else
+    {
+        return false;
+    }
+
+    // Keep the call's line for errors the call reports.
+    int line = chunk_line_get(chunk, op);
+    chunk_truncate(chunk, op);
+    chunk_write(chunk, OP_TAIL_CALL, line);
+    chunk_write(chunk, (uint8_t)argc, line);
+    return true;
+}
+
+/**
+ * Compile a return statement
+ *
+ * A bare `return` returns nil, like falling off the end
+ * of the function. Returning the result of a call compiles to
+ * a tail call, which is the return itself.
+ */
+static void return_statement(Parser* parser)
+{
+    if (parser->compiler->type == TYPE_SCRIPT)
+    {
+        error(parser, "Can't return from top-level code.");
+    }
+
+    if (match(parser, TOKEN_SEMICOLON))
+    {
+        emit_return(parser);
+        return;
+    }
+
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after return value.");
+    if (!tail_call_emit(parser)) emit_op(parser, OP_RETURN);
+}
+
+/**
+ * Compile an expression evaluated for its side effect
+ *
+ * Statements leave the stack as they found it, so the
+ * value of the expression is discarded.
+ */
+static void expression_statement(Parser* parser)
+{
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after expression.");
+    emit_op(parser, OP_POP);
+}
+
+/**
+ * Skip ahead to the next statement after an error
+ *
+ * Tokens are thrown away until we pass a semicolon or reach
+ * a keyword that starts a statement. Errors reported after
+ * that point are independent of the first one again.
+ */
+static void synchronize(Parser* parser)
+{
+    parser->panic_mode = false;
+
+    while (TOKEN_TYPE(parser->current) != TOKEN_EOF)
+    {
+        if (TOKEN_TYPE(parser->previous) == TOKEN_SEMICOLON) return;
+
+        switch (TOKEN_TYPE(parser->current))
+        {
+            case TOKEN_CLASS:
+            case TOKEN_FN:
+            case TOKEN_LET:
+            case TOKEN_FOR:
+            case TOKEN_IF:
+            case TOKEN_WHILE:
+            case TOKEN_PRINT:
+            case TOKEN_RETURN:
+                return;
+            default:
+                break;
+        }
+
+        advance(parser);
+    }
+}
+
+static void declaration(Parser* parser)
+{
+    if (match(parser, TOKEN_FN))
+    {
+        fn_declaration(parser);
+    }
+    else if (match(parser, TOKEN_LET))
+    {
+        let_declaration(parser);
+    }
+    else
+    {
+        statement(parser);
+    }
+
+    if (parser->panic_mode) synchronize(parser);
+}
+
+/**
+ * Emit instructions popping a number of values
+ */
+static void emit_pops(Parser* parser, int count)
+{
+    while (count > 0)
+    {
+        int popped = count < UINT8_MAX ? count : UINT8_MAX;
+        if (popped == 1)
+        {
+            emit_op(parser, OP_POP);
+        }
+        else
+        {
+            emit_op(parser, OP_POPN);
+            emit_byte(parser, (uint8_t)popped);
+        }
+        count -= popped;
+    }
+}
+
+/**
+ * Leave a block, discarding its locals
+ *
+ * The locals are at the top of the stack, so runs of them are
+ * dropped by a single OP_POPN rather than a pop each. A local
+ * that closures share through an upvalue cell is closed instead,
+ * which moves its value into the cell. Locals that closures only
+ * copied are popped like any other.
+ */
+static void scope_end(Parser* parser)
+{
+    Compiler* compiler = parser->compiler;
+    compiler->scope_depth--;
+
+    int first = compiler->local_count;
+    while (first > 0 && compiler->locals[first - 1].depth > compiler->scope_depth)
+    {
+        first--;
+    }
+    captures_resolve(parser, first);
+
+    int count = 0;
+    while (compiler->local_count > first)
+    {
+        Local* local = &compiler->locals[--compiler->local_count];
+        if (local->captured && local->assigned)
+        {
+            emit_pops(parser, count);
+            count = 0;
+            emit_op(parser, OP_CLOSE_UPVALUE);
+        }
+        else
+        {
+            count++;
+        }
+    }
+    emit_pops(parser, count);
+}
+
+static void statement(Parser* parser)
+{
+    if (match(parser, TOKEN_PRINT))
+    {
+        print_statement(parser);
+    }
+    else if (match(parser, TOKEN_RETURN))
+    {
+        return_statement(parser);
+    }
+    else if (match(parser, TOKEN_LEFT_BRACE))
+    {
+        scope_begin(parser);
+        block(parser);
+        scope_end(parser);
+    }
+    else
+    {
+        expression_statement(parser);
+    }
+}
+
+/**
+ * Compile everything the parser's token stream yields
+ */
+static bool tokens_compile(Parser* parser, VM* vm, Chunk* chunk)
+{
+    parser->vm = vm;
+    parser->compiler = NULL;
+    parser->had_error = false;
+    parser->panic_mode = false;
+    parser->last_op = -1;
+
+    Compiler compiler;
+    compiler_init(parser, &compiler, TYPE_SCRIPT, NULL, chunk);
+
+    advance(parser);
+    while (!match(parser, TOKEN_EOF))
+    {
+        declaration(parser);
+    }
+    compiler_end(parser);
+    token_stream_free(&parser->tokens);
+
+    return !parser->had_error;
+}
+
+/**
+ * Compile source code into a chunk of bytecode
+ *
+ * @param vm the virtual machine that will run the chunk
+ * @param source the source code to compile
+ * @param chunk the chunk the bytecode is written to
+ * @return whether the source compiled without errors
+ *
+ * This is a single pass compiler: there is no syntax tree,
+ * each parse function emits its bytecode as soon as it has
+ * recognized its piece of the grammar.
+ *
+ * All of the compiler's state lives in a parser on this
+ * function's stack, so separate sources can be compiled
+ * concurrently on different threads as long as each has
+ * its own VM to hold its strings and globals.
+ */
+bool compile(VM* vm, const char* source, Chunk* chunk)
+{
+    Parser parser;
+    token_stream_init(&parser.tokens, source, false);
+    return tokens_compile(&parser, vm, chunk);
+}
+
+/**
+ * Compile a large source, lexing it on several threads
+ *
+ * @param length the length of the source
+ * @param threads the most threads to lex with
+ *
+ * Each thread gets at least LEX_PIECE_MIN bytes, since smaller
+ * pieces aren't worth a thread. The whole source is lexed
+ * before parsing starts, so this holds all of its tokens.
+ */
+bool compile_parallel(VM* vm, const char* source, size_t length, Chunk* chunk, int threads)
+{
+    size_t pieces = length / LEX_PIECE_MIN;
+    if (pieces > (size_t)threads) pieces = (size_t)threads;
+    if (pieces < 2) return compile(vm, source, chunk);
+
+    Parser parser;
+    token_stream_init_parallel(&parser.tokens, source, length, (int)pieces);
+    return tokens_compile(&parser, vm, chunk);
+}
+
+/**
+ * Compile source code read from a stream
+ *
+ * The source is scanned as it is read, so the memory used
+ * is bounded by the bytecode, not by the length of the source.
+ */
+bool compile_file(VM* vm, FILE* file, Chunk* chunk)
+{
+    Parser parser;
+    token_stream_init_file(&parser.tokens, file);
+    return tokens_compile(&parser, vm, chunk);
 }
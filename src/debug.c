@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include "debug.h"
+#include "object.h"
 #include "value.h"
 
 /**
@@ -41,12 +42,82 @@ void chunk_disassemble(Chunk* chunk, const char* name)
 static int instruction_constant(const char* name, Chunk* chunk, int offset)
 {
     uint8_t constant = chunk->code[offset + 1];
-    printf("%-16s %4d '", name, constant);
+    printf("%-20s %4d '", name, constant);
     value_print(chunk->constants.values[constant]);
     printf("'\n");
     return offset + 2;
 }
 
+/**
+ * Print a constant instruction with a long operand
+ *
+ * Like `instruction_constant`, except the index of the
+ * constant is three bytes wide, stored low byte first.
+ */
+static int instruction_constant_long(const char* name, Chunk* chunk, int offset)
+{
+    int constant = chunk->code[offset + 1] |
+        (chunk->code[offset + 2] << 8) |
+        (chunk->code[offset + 3] << 16);
+    printf("%-20s %4d '", name, constant);
+    value_print(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 4;
+}
+
+/**
+ * Print an instruction with a one byte operand
+ *
+ * Used for stack slots and counts, which are printed as is.
+ */
+static int instruction_byte(const char* name, Chunk* chunk, int offset)
+{
+    uint8_t operand = chunk->code[offset + 1];
+    printf("%-20s %4d\n", name, operand);
+    return offset + 2;
+}
+
+/**
+ * Print an instruction with a two byte slot operand
+ *
+ * The operand is stored low byte first.
+ */
+static int instruction_slot(const char* name, Chunk* chunk, int offset)
+{
+    int slot = chunk->code[offset + 1] | (chunk->code[offset + 2] << 8);
+    printf("%-20s %4d\n", name, slot);
+    return offset + 3;
+}
+
+/**
+ * Print a closure instruction and its captures
+ *
+ * The function constant has a three byte index. Every
+ * variable the closure captures follows on a line of its own.
+ */
+static int instruction_closure(const char* name, Chunk* chunk, int offset)
+{
+    int constant = chunk->code[offset + 1] |
+        (chunk->code[offset + 2] << 8) |
+        (chunk->code[offset + 3] << 16);
+    offset += 4;
+    printf("%-20s %4d '", name, constant);
+    value_print(chunk->constants.values[constant]);
+    printf("'\n");
+
+    ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
+    for (int i = 0; i < function->upvalue_count; i++)
+    {
+        uint8_t kind = chunk->code[offset];
+        int index = chunk->code[offset + 1] | (chunk->code[offset + 2] << 8);
+        const char* kinds[] = { "local", "value", "upvalue" };
+        printf("%04d    |                      %s %d\n", offset, kinds[kind], index);
+        offset += 3;
+    }
+
+    return offset;
+}
+
 /**
  * Print a simple instruction name and return next offset
  *
@@ -83,13 +154,14 @@ static int instruction_simple(const char* name, int offset)
 int instruction_disassemble(Chunk* chunk, int offset)
 {
     printf("%04d ", offset);
-    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1])
+    int line = chunk_line_get(chunk, offset);
+    if (offset > 0 && line == chunk_line_get(chunk, offset - 1))
     {
         printf("   | ");
     }
     else
     {
-        printf("%4d ", chunk->lines[offset]);
+        printf("%4d ", line);
     }
 
     uint8_t instruction = chunk->code[offset];
@@ -98,6 +170,20 @@ int instruction_disassemble(Chunk* chunk, int offset)
     {
         case OP_CONSTANT:
             return instruction_constant("OP_CONSTANT", chunk, offset);
+        case OP_CONSTANT_LONG:
+            return instruction_constant_long("OP_CONSTANT_LONG", chunk, offset);
+        case OP_NIL:
+            return instruction_simple("OP_NIL", offset);
+        case OP_TRUE:
+            return instruction_simple("OP_TRUE", offset);
+        case OP_FALSE:
+            return instruction_simple("OP_FALSE", offset);
+        case OP_EQUAL:
+            return instruction_simple("OP_EQUAL", offset);
+        case OP_GREATER:
+            return instruction_simple("OP_GREATER", offset);
+        case OP_LESS:
+            return instruction_simple("OP_LESS", offset);
         case OP_ADD:
             return instruction_simple("OP_ADD", offset);
         case OP_SUBTRACT:
@@ -106,8 +192,58 @@ int instruction_disassemble(Chunk* chunk, int offset)
             return instruction_simple("OP_MULTIPLY", offset);
         case OP_DIVIDE:
             return instruction_simple("OP_DIVIDE", offset);
+        case OP_ADD_CONSTANT:
+            return instruction_constant("OP_ADD_CONSTANT", chunk, offset);
+        case OP_SUBTRACT_CONSTANT:
+            return instruction_constant("OP_SUBTRACT_CONSTANT", chunk, offset);
+        case OP_MULTIPLY_CONSTANT:
+            return instruction_constant("OP_MULTIPLY_CONSTANT", chunk, offset);
+        case OP_DIVIDE_CONSTANT:
+            return instruction_constant("OP_DIVIDE_CONSTANT", chunk, offset);
+        case OP_NOT:
+            return instruction_simple("OP_NOT", offset);
         case OP_NEGATE:
             return instruction_simple("OP_NEGATE", offset);
+        case OP_PRINT:
+            return instruction_simple("OP_PRINT", offset);
+        case OP_POP:
+            return instruction_simple("OP_POP", offset);
+        case OP_POPN:
+            return instruction_byte("OP_POPN", chunk, offset);
+        case OP_GET_LOCAL:
+            return instruction_byte("OP_GET_LOCAL", chunk, offset);
+        case OP_GET_LOCAL_LONG:
+            return instruction_slot("OP_GET_LOCAL_LONG", chunk, offset);
+        case OP_SET_LOCAL:
+            return instruction_byte("OP_SET_LOCAL", chunk, offset);
+        case OP_SET_LOCAL_LONG:
+            return instruction_slot("OP_SET_LOCAL_LONG", chunk, offset);
+        case OP_DEFINE_GLOBAL:
+            return instruction_slot("OP_DEFINE_GLOBAL", chunk, offset);
+        case OP_GET_GLOBAL:
+            return instruction_slot("OP_GET_GLOBAL", chunk, offset);
+        case OP_SET_GLOBAL:
+            return instruction_slot("OP_SET_GLOBAL", chunk, offset);
+        case OP_GET_UPVALUE:
+            return instruction_byte("OP_GET_UPVALUE", chunk, offset);
+        case OP_SET_UPVALUE:
+            return instruction_byte("OP_SET_UPVALUE", chunk, offset);
+        case OP_CLOSURE:
+            return instruction_closure("OP_CLOSURE", chunk, offset);
+        case OP_CLOSE_UPVALUE:
+            return instruction_simple("OP_CLOSE_UPVALUE", offset);
+        case OP_CALL:
+            return instruction_byte("OP_CALL", chunk, offset);
+        case OP_CALL_0:
+            return instruction_simple("OP_CALL_0", offset);
+        case OP_CALL_1:
+            return instruction_simple("OP_CALL_1", offset);
+        case OP_CALL_2:
+            return instruction_simple("OP_CALL_2", offset);
+        case OP_CALL_3:
+            return instruction_simple("OP_CALL_3", offset);
+        case OP_TAIL_CALL:
+            return instruction_byte("OP_TAIL_CALL", chunk, offset);
         case OP_RETURN:
             return instruction_simple("OP_RETURN", offset);
         default:
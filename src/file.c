@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "file.h"
+#include "memory.h"
+
+/**
+ * Read a stream to its end into the heap
+ *
+ * This is the fallback for anything we can't map: pipes,
+ * stdin, and systems without mmap. We can't know the size
+ * up front, so the buffer grows as we go.
+ */
+static bool stream_read(FILE* stream, MappedFile* file)
+{
+    size_t capacity = 0;
+    size_t length = 0;
+    char* buffer = NULL;
+
+    for (;;)
+    {
+        if (capacity < length + 4096 + 1)
+        {
+            size_t capacity_old = capacity;
+            capacity = capacity_old < 8192 ? 8192 : capacity_old * 2;
+            buffer = GROW_ARRAY(buffer, char, capacity_old, capacity);
+            if (buffer == NULL) return false;
+        }
+
+        size_t count = fread(buffer + length, 1, capacity - length - 1, stream);
+        length += count;
+
+        if (count == 0)
+        {
+            if (ferror(stream))
+            {
+                FREE_ARRAY(char, buffer, capacity);
+                return false;
+            }
+            break;
+        }
+    }
+
+    buffer[length] = '\0';
+    file->data = buffer;
+    file->length = length;
+    file->mapped_length = 0;
+    return true;
+}
+
+static bool path_read(const char* path, MappedFile* file)
+{
+    FILE* stream = fopen(path, "rb");
+    if (stream == NULL) return false;
+
+    bool read = stream_read(stream, file);
+    fclose(stream);
+    return read;
+}
+
+/**
+ * Make the contents of a file available in memory
+ *
+ * @param path the file to load, or "-" for stdin
+ * @param file filled in with the contents
+ * @return whether the file could be loaded
+ *
+ * Regular files are mapped read-only straight from the page
+ * cache, so nothing is copied and pages are only faulted in
+ * as the scanner reaches them. The bytes past the end of the
+ * file in its last page are guaranteed to read as zero, which
+ * gives us the NUL terminator for free. When the file exactly
+ * fills its last page there is no such byte, so those files
+ * and anything that isn't a regular file are read instead.
+ *
+ * A mapped file that is truncated while we run would fault,
+ * like any program that maps its input.
+ */
+bool file_map(const char* path, MappedFile* file)
+{
+    if (strcmp(path, "-") == 0) return stream_read(stdin, file);
+
+#ifdef HAVE_MMAP
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor == -1) return false;
+
+    struct stat status;
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    if (fstat(descriptor, &status) == 0 && S_ISREG(status.st_mode) &&
+        status.st_size > 0 && page_size > 0 &&
+        status.st_size % page_size != 0)
+    {
+        size_t length = (size_t)status.st_size;
+        void* data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+        if (data != MAP_FAILED)
+        {
+            close(descriptor);
+            madvise(data, length, MADV_SEQUENTIAL);
+
+            file->data = data;
+            file->length = length;
+            file->mapped_length = length;
+            return true;
+        }
+    }
+
+    close(descriptor);
+#endif
+
+    return path_read(path, file);
+}
+
+/**
+ * Release the contents of a file
+ */
+void file_unmap(MappedFile* file)
+{
+#ifdef HAVE_MMAP
+    if (file->mapped_length > 0)
+    {
+        munmap((void*)file->data, file->mapped_length);
+    }
+    else
+#endif
+    {
+        free((void*)file->data);
+    }
+
+    file->data = NULL;
+    file->length = 0;
+    file->mapped_length = 0;
+}
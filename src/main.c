@@ -2,9 +2,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "cache.h"
 #include "chunk.h"
 #include "debug.h"
 #include "common.h"
+#include "compiler.h"
+#include "file.h"
+#include "precompile.h"
 #include "vm.h"
 
 /**
@@ -14,7 +18,7 @@
  * support multiline interpretation and we 
  * have a hard limit on line length (1024).
  */
-static void repl()
+static void repl(VM* vm)
 {
     char line[1024];
     for (;;)
@@ -27,81 +31,147 @@ static void repl()
             break;
         }
 
-        vm_interpret(line);
+        vm_interpret(vm, line);
     }
 }
 
+static void chunk_run(VM* vm, Chunk* chunk)
+{
+    InterpretResult result = vm_interpret_chunk(vm, chunk);
+    chunk_free(chunk);
+
+    if (result == INTERPRET_COMPILE_ERROR) exit(65);
+    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+}
+
 /**
- * Read source code from a file
+ * Run source code read from a stream
+ *
+ * The compiler scans the source as it arrives, so a script
+ * piped in from a generator is never held in memory whole.
+ * Streamed scripts are never cached.
  */
-static char* file_read(const char* path)
+static void stream_run(VM* vm, FILE* stream)
 {
-    //TODO(TODD): error checking 
-    FILE* file = fopen(path, "rb");
+    Chunk chunk;
+    chunk_init(&chunk);
 
-    if (file == NULL)
+    if (!compile_file(vm, stream, &chunk))
     {
-        fprintf(stderr, "Could not open file \"%s\".\n", path);
-        exit(74);
+        chunk_free(&chunk);
+        exit(65);
     }
 
-    fseek(file, 0L, SEEK_END);
-    size_t file_size = ftell(file);
-    rewind(file);
+    chunk_run(vm, &chunk);
+}
 
-    char* buffer = (char*)malloc(file_size + 1);
+/**
+ * Run source code from a file
+ *
+ * The compiled bytecode is cached next to the script. If
+ * the cache was written for the current contents of the
+ * script we run it directly and skip the compiler, otherwise
+ * we compile and refresh the cache for the next run. A path
+ * of "-" streams the script from stdin.
+ *
+ * The script is mapped into memory rather than copied, so
+ * the compiler scans the file's pages directly. Large scripts
+ * are lexed on all cores.
+ */
+static void file_run(VM* vm, const char* path)
+{
+    if (strcmp(path, "-") == 0)
+    {
+        stream_run(vm, stdin);
+        return;
+    }
 
-    if (buffer == NULL)
+    MappedFile source;
+    if (!file_map(path, &source))
     {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
         exit(74);
     }
 
-    size_t bytes_read = fread(buffer, sizeof(char), file_size, file);
+    uint64_t hash = cache_hash(source.data, source.length);
+    char* cache_path = cache_path_make(path);
+
+    Chunk chunk;
+    chunk_init(&chunk);
 
-    if (bytes_read < file_size)
+    if (cache_path == NULL || !cache_load(vm, cache_path, hash, source.length, &chunk))
     {
-        fprintf(stderr, "Could not read file \"%s\".\n", path); 
-        exit(74);
+        if (!compile_parallel(vm, source.data, source.length, &chunk, precompile_thread_count()))
+        {
+            chunk_free(&chunk);
+            free(cache_path);
+            file_unmap(&source);
+            exit(65);
+        }
+
+        if (cache_path != NULL) cache_store(vm, cache_path, hash, source.length, &chunk);
     }
 
-    buffer[bytes_read] = '\0';
+    free(cache_path);
+    file_unmap(&source);
 
-    fclose(file);
-    return buffer;
+    chunk_run(vm, &chunk);
 }
 
 /**
- * Run source code from a file
+ * Compile scripts ahead of time without running them
+ *
+ * Usage: clox --compile [-j threads] path...
+ *
+ * Writes the bytecode cache of every script, compiling
+ * them in parallel, so a deployment can warm the caches
+ * of its whole script tree in one go.
  */
-static void file_run(const char* path)
+static int files_compile(int argc, const char* argv[])
 {
-    char* source = file_read(path);
-    InterpretResult result = vm_interpret(source);
-    free(source);
+    int threads = precompile_thread_count();
+    int first = 2;
 
-    if (result == INTERPRET_COMPILE_ERROR) exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+    if (argc > 3 && strcmp(argv[2], "-j") == 0)
+    {
+        threads = atoi(argv[3]);
+        first = 4;
+    }
+
+    if (first >= argc || threads < 1)
+    {
+        fprintf(stderr, "Usage: clox --compile [-j threads] path...\n");
+        return 64;
+    }
+
+    int failures = precompile_files(&argv[first], argc - first, threads);
+    return failures == 0 ? 0 : 65;
 }
 
 int main(int argc, const char* argv[]) 
 {
-    vm_init();
+    if (argc >= 2 && strcmp(argv[1], "--compile") == 0)
+    {
+        return files_compile(argc, argv);
+    }
+
+    VM vm;
+    vm_init(&vm);
 
     if (argc == 1)
     {
-        repl();
+        repl(&vm);
     }
     else if (argc == 2)
     {
-        file_run(argv[1]);
+        file_run(&vm, argv[1]);
     }
     else
     {
-        fprintf(stderr, "Usage: clox [path]\n");
+        fprintf(stderr, "Usage: clox [path]\n       clox --compile [-j threads] path...\n");
         exit(64);
     }
 
-    vm_free();
+    vm_free(&vm);
     return 0;
 }
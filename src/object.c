@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+/**
+ * Hash the characters of a string
+ *
+ * This is 32-bit FNV-1a. It works a byte at a time, so the
+ * hash of a concatenation can carry on from the hash of its
+ * left operand rather than starting over.
+ */
+static uint32_t hash_continue(uint32_t hash, const char* chars, int length)
+{
+    for (int i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)chars[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+uint32_t string_hash(const char* chars, int length)
+{
+    return hash_continue(FNV_OFFSET_BASIS, chars, length);
+}
+
+/**
+ * Allocate an object and link it into the VM's list of objects
+ *
+ * @param size the size of the whole object, header included
+ */
+static Obj* object_allocate(VM* vm, size_t size, ObjType type)
+{
+    Obj* object = (Obj*)reallocate(NULL, 0, size);
+    object->type = type;
+    object->next = vm->objects;
+    vm->objects = object;
+    return object;
+}
+
+ObjFunction* function_new(VM* vm)
+{
+    ObjFunction* function = (ObjFunction*)object_allocate(vm, sizeof(ObjFunction), OBJ_FUNCTION);
+    function->arity = 0;
+    function->upvalue_count = 0;
+    function->name = NULL;
+    chunk_init(&function->chunk);
+    return function;
+}
+
+/**
+ * Allocate a closure over a function
+ *
+ * The captures are left for OP_CLOSURE to fill in.
+ */
+ObjClosure* closure_new(VM* vm, ObjFunction* function)
+{
+    size_t size = sizeof(ObjClosure) + sizeof(Value) * (size_t)function->upvalue_count;
+    ObjClosure* closure = (ObjClosure*)object_allocate(vm, size, OBJ_CLOSURE);
+    closure->function = function;
+    closure->upvalue_count = function->upvalue_count;
+    return closure;
+}
+
+/**
+ * Allocate an open upvalue for a stack slot
+ */
+ObjUpvalue* upvalue_new(VM* vm, Value* slot)
+{
+    ObjUpvalue* upvalue = (ObjUpvalue*)object_allocate(vm, sizeof(ObjUpvalue), OBJ_UPVALUE);
+    upvalue->location = slot;
+    upvalue->closed = NIL_VAL;
+    upvalue->next = NULL;
+    return upvalue;
+}
+
+/**
+ * Allocate a string with room for its characters
+ *
+ * The string is linked into the VM's list of objects but not
+ * interned yet, since its characters haven't been filled in.
+ */
+static ObjString* string_allocate(VM* vm, int length)
+{
+    size_t size = sizeof(ObjString) + (size_t)length + 1;
+    ObjString* string = (ObjString*)object_allocate(vm, size, OBJ_STRING);
+    string->length = length;
+    string->chars[length] = '\0';
+    return string;
+}
+
+static void string_free(ObjString* string)
+{
+    reallocate(string, sizeof(ObjString) + (size_t)string->length + 1, 0);
+}
+
+/**
+ * Intern a freshly built string
+ *
+ * @return the string that was already interned with the same
+ * characters, or the new string itself
+ *
+ * A duplicate is freed again straight away. It is always the
+ * most recent object, so it is still at the head of the list.
+ */
+static ObjString* string_intern(VM* vm, ObjString* string)
+{
+    ObjString* interned = table_find_string(&vm->strings, string->chars, string->length, string->hash);
+    if (interned != NULL)
+    {
+        vm->objects = string->obj.next;
+        string_free(string);
+        return interned;
+    }
+
+    table_set(&vm->strings, string, NIL_VAL);
+    return string;
+}
+
+/**
+ * Get the string with the given characters
+ *
+ * @param vm the virtual machine the string belongs to
+ * @param chars the characters, which need not be terminated
+ * @param length the number of characters
+ *
+ * The characters are only copied if no such string has been
+ * interned yet, so looking up a known string allocates nothing.
+ */
+ObjString* string_copy(VM* vm, const char* chars, int length)
+{
+    uint32_t hash = string_hash(chars, length);
+    ObjString* interned = table_find_string(&vm->strings, chars, length, hash);
+    if (interned != NULL) return interned;
+
+    ObjString* string = string_allocate(vm, length);
+    memcpy(string->chars, chars, (size_t)length);
+    string->hash = hash;
+    table_set(&vm->strings, string, NIL_VAL);
+    return string;
+}
+
+/**
+ * Concatenate two strings
+ *
+ * The result is built in place in a single allocation and
+ * only the characters of `b` need hashing.
+ */
+ObjString* string_concatenate(VM* vm, ObjString* a, ObjString* b)
+{
+    ObjString* string = string_allocate(vm, a->length + b->length);
+    memcpy(string->chars, a->chars, (size_t)a->length);
+    memcpy(string->chars + a->length, b->chars, (size_t)b->length);
+    string->hash = hash_continue(a->hash, b->chars, b->length);
+    return string_intern(vm, string);
+}
+
+static void function_print(ObjFunction* function)
+{
+    if (function->name == NULL)
+    {
+        printf("<fn>");
+        return;
+    }
+
+    printf("<fn %s>", function->name->chars);
+}
+
+void object_print(Value value)
+{
+    switch (OBJ_TYPE(value))
+    {
+        case OBJ_CLOSURE:
+            function_print(AS_CLOSURE(value)->function);
+            break;
+        case OBJ_FUNCTION:
+            function_print(AS_FUNCTION(value));
+            break;
+        case OBJ_STRING:
+            printf("%s", AS_CSTRING(value));
+            break;
+        case OBJ_UPVALUE:
+            printf("upvalue");
+            break;
+    }
+}
+
+static void object_free(Obj* object)
+{
+    switch (object->type)
+    {
+        case OBJ_CLOSURE:
+        {
+            ObjClosure* closure = (ObjClosure*)object;
+            reallocate(closure, sizeof(ObjClosure) + sizeof(Value) * (size_t)closure->upvalue_count, 0);
+            break;
+        }
+        case OBJ_FUNCTION:
+        {
+            ObjFunction* function = (ObjFunction*)object;
+            chunk_free(&function->chunk);
+            reallocate(function, sizeof(ObjFunction), 0);
+            break;
+        }
+        case OBJ_STRING:
+            string_free((ObjString*)object);
+            break;
+        case OBJ_UPVALUE:
+            reallocate(object, sizeof(ObjUpvalue), 0);
+            break;
+    }
+}
+
+/**
+ * Free every object a virtual machine allocated
+ */
+void objects_free(VM* vm)
+{
+    Obj* object = vm->objects;
+    while (object != NULL)
+    {
+        Obj* next = object->next;
+        object_free(object);
+        object = next;
+    }
+    vm->objects = NULL;
+}
@@ -0,0 +1,132 @@
+#include "chunk.h"
+#include "common.h"
+#include "memory.h"
+#include "object.h"
+#include "optimizer.h"
+
+/**
+ * Get the size of an instruction in bytes
+ *
+ * @param chunk the chunk holding the instruction
+ * @param offset byte offset of the instruction's opcode
+ * @return the size of the opcode and its operands
+ */
+static int instruction_length(Chunk* chunk, int offset)
+{
+    switch (chunk->code[offset])
+    {
+        case OP_CONSTANT:
+        case OP_ADD_CONSTANT:
+        case OP_SUBTRACT_CONSTANT:
+        case OP_MULTIPLY_CONSTANT:
+        case OP_DIVIDE_CONSTANT:
+        case OP_POPN:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            return 2;
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_LOCAL_LONG:
+        case OP_SET_LOCAL_LONG:
+            return 3;
+        case OP_CONSTANT_LONG:
+            return 4;
+        case OP_CLOSURE:
+        {
+            // Each captured variable adds a kind and an index.
+            int constant = chunk->code[offset + 1] |
+                (chunk->code[offset + 2] << 8) |
+                (chunk->code[offset + 3] << 16);
+            ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
+            return 4 + 3 * function->upvalue_count;
+        }
+        default:
+            return 1;
+    }
+}
+
+/**
+ * Get the superinstruction for a constant followed by an operator
+ *
+ * @param instruction the instruction following an OP_CONSTANT
+ * @return the fused opcode, or -1 if the pair can't be fused
+ */
+static int superinstruction(uint8_t instruction)
+{
+    switch (instruction)
+    {
+        case OP_ADD:      return OP_ADD_CONSTANT;
+        case OP_SUBTRACT: return OP_SUBTRACT_CONSTANT;
+        case OP_MULTIPLY: return OP_MULTIPLY_CONSTANT;
+        case OP_DIVIDE:   return OP_DIVIDE_CONSTANT;
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Run a peephole pass over a compiled chunk
+ *
+ * @param chunk the chunk to optimize in place
+ *
+ * We slide a window over the instructions looking for an
+ * OP_CONSTANT immediately followed by an arithmetic operator.
+ * The constant is always the right operand of that operator,
+ * so the pair can be replaced by one superinstruction that
+ * reads the constant and combines it with the top of the stack.
+ * That is one dispatch instead of two and no push and pop of
+ * the constant. Fused instructions take the line of the operator
+ * since that is the one that can report a runtime error. Only
+ * number constants are fused, so the fused instructions never
+ * have to concatenate strings.
+ *
+ * The code is rewritten into a new array because the fused
+ * instructions are shorter than the pairs they replace.
+ */
+void chunk_optimize(Chunk* chunk)
+{
+    Chunk optimized;
+    chunk_init(&optimized);
+
+    int offset = 0;
+    while (offset < chunk->count)
+    {
+        int length = instruction_length(chunk, offset);
+
+        if (chunk->code[offset] == OP_CONSTANT && offset + length < chunk->count &&
+            IS_NUMBER(chunk->constants.values[chunk->code[offset + 1]]))
+        {
+            int fused = superinstruction(chunk->code[offset + length]);
+            if (fused != -1)
+            {
+                int line = chunk_line_get(chunk, offset + length);
+                chunk_write(&optimized, (uint8_t)fused, line);
+                chunk_write(&optimized, chunk->code[offset + 1], line);
+                offset += length + 1;
+                continue;
+            }
+        }
+
+        int line = chunk_line_get(chunk, offset);
+        for (int i = 0; i < length; i++)
+        {
+            chunk_write(&optimized, chunk->code[offset + i], line);
+        }
+        offset += length;
+    }
+
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(LineStart, chunk->lines, chunk->line_capacity);
+
+    chunk->code = optimized.code;
+    chunk->count = optimized.count;
+    chunk->capacity = optimized.capacity;
+    chunk->lines = optimized.lines;
+    chunk->line_count = optimized.line_count;
+    chunk->line_capacity = optimized.line_capacity;
+}
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_PTHREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "cache.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "file.h"
+#include "precompile.h"
+#include "vm.h"
+
+/**
+ * The scripts left to compile, shared by the workers
+ *
+ * Workers claim one script at a time, so a few large
+ * scripts don't leave the other threads idle while one
+ * thread works through a fixed share of the list.
+ */
+typedef struct
+{
+    const char* const* paths;
+    int count;
+    int next;
+    int failures;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_t lock;
+#endif
+} CompileQueue;
+
+/**
+ * Compile one script and write its bytecode cache
+ *
+ * @return whether the script compiled and its cache was written
+ *
+ * A cache that is already up to date is left alone. The
+ * script gets a VM of its own to hold the strings it creates,
+ * which is freed again with them once the cache is written.
+ */
+static bool file_precompile(const char* path)
+{
+    MappedFile source;
+    if (!file_map(path, &source))
+    {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        return false;
+    }
+
+    uint64_t hash = cache_hash(source.data, source.length);
+    char* cache_path = cache_path_make(path);
+
+    VM vm;
+    vm_init(&vm);
+
+    Chunk chunk;
+    chunk_init(&chunk);
+
+    bool success = cache_load(&vm, cache_path, hash, source.length, &chunk);
+    if (!success)
+    {
+        chunk_free(&chunk);
+        chunk_init(&chunk);
+
+        if (!compile(&vm, source.data, &chunk))
+        {
+            fprintf(stderr, "Could not compile \"%s\".\n", path);
+        }
+        else if (!cache_store(&vm, cache_path, hash, source.length, &chunk))
+        {
+            fprintf(stderr, "Could not write \"%s\".\n", cache_path);
+        }
+        else
+        {
+            success = true;
+        }
+    }
+
+    chunk_free(&chunk);
+    vm_free(&vm);
+    free(cache_path);
+    file_unmap(&source);
+
+    return success;
+}
+
+/**
+ * Take the next script off the queue
+ *
+ * @return the index of the script, or -1 once the queue is empty
+ */
+static int queue_take(CompileQueue* queue)
+{
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&queue->lock);
+#endif
+    int index = queue->next < queue->count ? queue->next++ : -1;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&queue->lock);
+#endif
+    return index;
+}
+
+static void queue_fail(CompileQueue* queue)
+{
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&queue->lock);
+#endif
+    queue->failures++;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&queue->lock);
+#endif
+}
+
+/**
+ * Compile scripts until the queue runs dry
+ *
+ * Every compilation has its own parser, scanner, chunk and
+ * VM, so workers share nothing but the queue.
+ */
+static void* worker_run(void* argument)
+{
+    CompileQueue* queue = (CompileQueue*)argument;
+
+    int index;
+    while ((index = queue_take(queue)) != -1)
+    {
+        if (!file_precompile(queue->paths[index])) queue_fail(queue);
+    }
+
+    return NULL;
+}
+
+/**
+ * The number of workers to use when none is given
+ *
+ * One per online core. Without threads everything is
+ * compiled on the calling thread.
+ */
+int precompile_thread_count()
+{
+#if defined(HAVE_PTHREADS) && defined(_SC_NPROCESSORS_ONLN)
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores > 0) return (int)cores;
+#endif
+    return 1;
+}
+
+/**
+ * Compile a list of scripts into bytecode caches
+ *
+ * @param paths the scripts to compile
+ * @param count the number of scripts
+ * @param threads the number of workers to compile with
+ * @return the number of scripts that failed to compile
+ *
+ * The calling thread is one of the workers. If a thread
+ * can't be started the remaining workers pick up its share.
+ */
+int precompile_files(const char* const* paths, int count, int threads)
+{
+    CompileQueue queue;
+    queue.paths = paths;
+    queue.count = count;
+    queue.next = 0;
+    queue.failures = 0;
+
+    if (threads > count) threads = count;
+
+#ifdef HAVE_PTHREADS
+    pthread_mutex_init(&queue.lock, NULL);
+
+    pthread_t* workers = NULL;
+    int started = 0;
+    if (threads > 1)
+    {
+        workers = malloc(sizeof(pthread_t) * (threads - 1));
+        if (workers != NULL)
+        {
+            while (started < threads - 1 &&
+                   pthread_create(&workers[started], NULL, worker_run, &queue) == 0)
+            {
+                started++;
+            }
+        }
+    }
+
+    worker_run(&queue);
+
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(workers);
+    pthread_mutex_destroy(&queue.lock);
+#else
+    (void)threads;
+    worker_run(&queue);
+#endif
+
+    return queue.failures;
+}
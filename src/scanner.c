@@ -1,23 +1,209 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define HAVE_READ
+#endif
+
 #include "common.h"
+#include "memory.h"
 #include "scanner.h"
 
-typedef struct
+#if !defined(DISABLE_SIMD_SCANNER) && defined(__GNUC__)
+#if defined(__AVX2__)
+#define SIMD_SCANNER
+#include <immintrin.h>
+#define BLOCK_SIZE 32
+#define BLOCK_BITS 0xffffffffu
+typedef __m256i Block;
+#define BLOCK_LOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+#define BLOCK_MATCH(block, c) \
+    ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8((block), _mm256_set1_epi8(c))))
+#elif defined(__SSE2__)
+#define SIMD_SCANNER
+#include <emmintrin.h>
+#define BLOCK_SIZE 16
+#define BLOCK_BITS 0xffffu
+typedef __m128i Block;
+#define BLOCK_LOAD(p) _mm_loadu_si128((const __m128i*)(p))
+#define BLOCK_MATCH(block, c) \
+    ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8((block), _mm_set1_epi8(c))))
+#endif
+#endif
+
+/**
+ * Initialize a scanner
+ *
+ * @param scanner the scanner to initialize
+ * @param source NUL terminated source code to scan
+ *
+ * All of the scanner's state lives in the struct, so any
+ * number of sources can be scanned at once, even on
+ * different threads.
+ */
+void scanner_init(Scanner* scanner, const char* source)
+{
+    scanner_init_length(scanner, source, strlen(source));
+}
+
+/**
+ * Initialize a scanner for a source of known length
+ *
+ * @param length the length of the source, which must be
+ * followed by a NUL
+ */
+void scanner_init_length(Scanner* scanner, const char* source, size_t length)
 {
-    const char* start;
-    const char* current;
-    int line;
-} Scanner;
+    scanner->source = source;
+    scanner->start = source;
+    scanner->current = source;
+    scanner->end = source + length;
+    scanner->line = 1;
+    scanner->source_offset = 0;
+    scanner->reader = NULL;
+    scanner->keep = NULL;
+}
 
-Scanner scanner;
+/**
+ * The input of a streaming scanner
+ *
+ * The window holds the text from the start of the oldest token
+ * still needed to the last byte read, followed by a NUL. It is
+ * refilled a block at a time, moving the text still needed to
+ * the front first, so it stays about as large as a block plus
+ * the longest token, however long the input is.
+ */
+struct ScanReader
+{
+    FILE* file;
+    int fd;
+    char* buffer;
+    size_t length;
+    size_t capacity;
+    bool exhausted;
+    bool failed;
+};
+
+static void reader_init(Scanner* scanner, FILE* file, int fd)
+{
+    ScanReader* reader = GROW_ARRAY(NULL, ScanReader, 0, 1);
+    reader->file = file;
+    reader->fd = fd;
+    reader->capacity = SCAN_BLOCK_SIZE * 2;
+    reader->buffer = GROW_ARRAY(NULL, char, 0, reader->capacity + 1);
+    reader->buffer[0] = '\0';
+    reader->length = 0;
+    reader->exhausted = false;
+    reader->failed = false;
+
+    scanner_init(scanner, reader->buffer);
+    scanner->reader = reader;
+}
 
-void scanner_init(const char* source)
+/**
+ * Initialize a scanner that reads its source from a stream
+ *
+ * The source is read in blocks as tokens are scanned, so it
+ * never needs to be in memory all at once. Free the scanner
+ * with `scanner_free` when done.
+ */
+void scanner_init_file(Scanner* scanner, FILE* file)
 {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;
+    reader_init(scanner, file, -1);
+}
+
+/**
+ * Initialize a scanner that reads its source from a file descriptor
+ */
+void scanner_init_fd(Scanner* scanner, int fd)
+{
+    reader_init(scanner, NULL, fd);
+}
+
+void scanner_free(Scanner* scanner)
+{
+    ScanReader* reader = scanner->reader;
+    if (reader == NULL) return;
+
+    FREE_ARRAY(char, reader->buffer, reader->capacity + 1);
+    FREE_ARRAY(ScanReader, reader, 1);
+    scanner->reader = NULL;
+}
+
+static size_t block_read(ScanReader* reader, char* destination, size_t size)
+{
+    if (reader->file != NULL)
+    {
+        size_t count = fread(destination, 1, size, reader->file);
+        if (count == 0 && ferror(reader->file)) reader->failed = true;
+        return count;
+    }
+
+#ifdef HAVE_READ
+    for (;;)
+    {
+        ssize_t count = read(reader->fd, destination, size);
+        if (count >= 0) return (size_t)count;
+        if (errno != EINTR)
+        {
+            reader->failed = true;
+            return 0;
+        }
+    }
+#else
+    reader->failed = true;
+    return 0;
+#endif
+}
+
+/**
+ * Slide the window forward and read the next block
+ *
+ * @param resume where scanning picks up again afterwards
+ * @return false if the input is used up and nothing changed
+ *
+ * Everything in front of `resume` and of the scanner's keep
+ * mark is dropped. The scanner's pointers are moved along with
+ * the text they point into.
+ */
+static bool window_refill(Scanner* scanner, const char* resume)
+{
+    ScanReader* reader = scanner->reader;
+    if (reader->exhausted) return false;
+
+    const char* keep = resume;
+    if (scanner->keep != NULL && scanner->keep < keep) keep = scanner->keep;
+
+    size_t discard = (size_t)(keep - reader->buffer);
+    size_t kept = reader->length - discard;
+    memmove(reader->buffer, keep, kept);
+    reader->length = kept;
+    scanner->source_offset += discard;
+
+    if (reader->capacity - kept < SCAN_BLOCK_SIZE)
+    {
+        size_t capacity = reader->capacity * 2;
+        reader->buffer = GROW_ARRAY(reader->buffer, char,
+            reader->capacity + 1, capacity + 1);
+        reader->capacity = capacity;
+    }
+
+    size_t count = block_read(reader, reader->buffer + kept, SCAN_BLOCK_SIZE);
+    if (count == 0) reader->exhausted = true;
+    reader->length += count;
+    reader->buffer[reader->length] = '\0';
+
+    scanner->source = reader->buffer;
+    scanner->end = reader->buffer + reader->length;
+    scanner->current = reader->buffer + (resume - keep);
+    scanner->start = scanner->current;
+    if (scanner->keep != NULL) scanner->keep = reader->buffer + (scanner->keep - keep);
+
+    return true;
 }
 
 /**
@@ -35,172 +221,368 @@ static bool is_digit(char c)
     return c >= '0' && c <= '9';
 }
 
-static bool is_at_end()
+static bool is_at_end(Scanner* scanner)
 {
-    return *scanner.current == '\0';
+    return *scanner->current == '\0';
 }
 
-static Token token_make(TokenType type)
+typedef enum
+{
+    SCAN_UNTERMINATED_STRING,
+    SCAN_UNEXPECTED_CHARACTER,
+    SCAN_TOKEN_TOO_LONG,
+    SCAN_SOURCE_TOO_LONG,
+    SCAN_READ_FAILED,
+} ScanError;
+
+static const char* scan_errors[] = {
+    [SCAN_UNTERMINATED_STRING]  = "Unterminated string.",
+    [SCAN_UNEXPECTED_CHARACTER] = "Unexpected character.",
+    [SCAN_TOKEN_TOO_LONG]       = "Token too long.",
+    [SCAN_SOURCE_TOO_LONG]      = "Source too long.",
+    [SCAN_READ_FAILED]          = "Could not read source.",
+};
+
+static Token token_error(Scanner* scanner, ScanError error)
 {
     Token token;
-    token.type = type;
-    token.start = scanner.start;
-    token.length = (int)(scanner.current - scanner.start);
-    token.line = scanner.line;
+    token.offset = (uint32_t)error;
+    token.line = scanner->line;
+    token.type_length = TOKEN_ERROR | (uint32_t)strlen(scan_errors[error]) << 8;
 
     return token;
 }
 
-static Token token_error(const char* message)
+static Token token_make(Scanner* scanner, TokenType type)
 {
+    uint64_t offset = scanner->source_offset + (uint64_t)(scanner->start - scanner->source);
+    ptrdiff_t length = scanner->current - scanner->start;
+
+    if (offset > UINT32_MAX && scanner->reader == NULL)
+    {
+        return token_error(scanner, SCAN_SOURCE_TOO_LONG);
+    }
+    if (length > TOKEN_LENGTH_MAX) return token_error(scanner, SCAN_TOKEN_TOO_LONG);
+
     Token token;
-    token.type = TOKEN_ERROR;
-    token.start = message;
-    token.length = (int)strlen(message);
-    token.line = scanner.line;
+    token.offset = (uint32_t)offset;
+    token.line = scanner->line;
+    token.type_length = (uint32_t)type | (uint32_t)length << 8;
 
     return token;
 }
 
+/**
+ * Find the text of a token
+ *
+ * For a streaming scanner, only tokens at or after the keep
+ * mark, or scanned since the last refill, are still in memory.
+ * The subtraction is done in 32 bits so that it is right even
+ * after the offsets have wrapped.
+ */
+const char* token_lexeme(Scanner* scanner, Token token)
+{
+    return scanner->source + (uint32_t)(token.offset - (uint32_t)scanner->source_offset);
+}
+
+/**
+ * Get the message of an error token
+ */
+const char* token_error_message(Token token)
+{
+    return scan_errors[token.offset];
+}
+
 /**
  * Get the next character
  */
-static char advance()
+static char advance(Scanner* scanner)
 {
-    scanner.current++;
-    return scanner.current[-1];
+    scanner->current++;
+    return scanner->current[-1];
 }
 
 /**
  * Check on the current character
  */
-static char peek() 
+static char peek(Scanner* scanner) 
 {
-    return *scanner.current;
+    return *scanner->current;
 }
 
 /**
  * Peek one step beyond the current character
  */
-static char peek_next()
+static char peek_next(Scanner* scanner)
 {
-    if (is_at_end()) return '\0';
+    if (is_at_end(scanner)) return '\0';
     // look one past the current character
-    return scanner.current[1];
+    return scanner->current[1];
 }
 
-static void whitespace_skip()
+#ifdef SIMD_SCANNER
+/**
+ * Vectorized scanning
+ *
+ * Runs of whitespace, comments and string bodies are scanned
+ * a block of 16 (SSE2) or 32 (AVX2) bytes at a time. Each
+ * comparison yields a bitmask with one bit per byte, the
+ * first interesting byte is its lowest set bit, and the
+ * newlines skipped over are counted with a popcount.
+ *
+ * Blocks are loaded from the cursor on, and only while the
+ * whole block lies within the source and its terminating NUL,
+ * so nothing outside the source is ever read. The last few
+ * bytes, too few for a block, are left to the byte-at-a-time
+ * loops that follow.
+ */
+static bool block_fits(Scanner* scanner)
 {
+    return scanner->end - scanner->current >= BLOCK_SIZE - 1;
+}
+
+/**
+ * Move the cursor to the first stop byte in the block at the cursor
+ *
+ * @param newlines the newlines in the block
+ * @param stop the stop bytes in the block, never zero
+ */
+static void block_stop(Scanner* scanner, uint32_t newlines, uint32_t stop)
+{
+    uint32_t before = (stop & -stop) - 1;
+    scanner->line += __builtin_popcount(newlines & before);
+    scanner->current += __builtin_ctz(stop);
+}
+
+/**
+ * Skip whole blocks of spaces, tabs, carriage returns and newlines
+ *
+ * @return whether the run ended in one of them
+ */
+static bool blank_blocks_skip(Scanner* scanner)
+{
+    while (block_fits(scanner))
+    {
+        Block bytes = BLOCK_LOAD(scanner->current);
+        uint32_t newlines = BLOCK_MATCH(bytes, '\n');
+        uint32_t blank = newlines | BLOCK_MATCH(bytes, ' ') |
+            BLOCK_MATCH(bytes, '\t') | BLOCK_MATCH(bytes, '\r');
+        uint32_t stop = ~blank & BLOCK_BITS;
+
+        if (stop != 0)
+        {
+            block_stop(scanner, newlines, stop);
+            return true;
+        }
+
+        scanner->line += __builtin_popcount(newlines);
+        scanner->current += BLOCK_SIZE;
+    }
+    return false;
+}
+
+/**
+ * Skip whole blocks of a comment
+ *
+ * @return whether the comment ended in one of them
+ */
+static bool comment_blocks_skip(Scanner* scanner)
+{
+    while (block_fits(scanner))
+    {
+        Block bytes = BLOCK_LOAD(scanner->current);
+        uint32_t stop = BLOCK_MATCH(bytes, '\n') | BLOCK_MATCH(bytes, '\0');
+
+        if (stop != 0)
+        {
+            scanner->current += __builtin_ctz(stop);
+            return true;
+        }
+
+        scanner->current += BLOCK_SIZE;
+    }
+    return false;
+}
+
+/**
+ * Skip whole blocks of a string body
+ *
+ * @return whether the string ended in one of them
+ */
+static bool string_blocks_skip(Scanner* scanner)
+{
+    while (block_fits(scanner))
+    {
+        Block bytes = BLOCK_LOAD(scanner->current);
+        uint32_t newlines = BLOCK_MATCH(bytes, '\n');
+        uint32_t stop = BLOCK_MATCH(bytes, '"') | BLOCK_MATCH(bytes, '\0');
+
+        if (stop != 0)
+        {
+            block_stop(scanner, newlines, stop);
+            return true;
+        }
+
+        scanner->line += __builtin_popcount(newlines);
+        scanner->current += BLOCK_SIZE;
+    }
+    return false;
+}
+#endif
+
+/**
+ * Skip spaces, tabs, carriage returns and newlines
+ */
+static void blank_skip(Scanner* scanner)
+{
+#ifdef SIMD_SCANNER
+    // Most runs are the single space between two tokens,
+    // which isn't worth setting up a block for.
+    if (scanner->current[0] == ' ' && scanner->current[1] > ' ')
+    {
+        scanner->current++;
+        return;
+    }
+    if (blank_blocks_skip(scanner)) return;
+#endif
+
     for (;;)
     {
-        char c = peek();
-        switch (c)
+        switch (peek(scanner))
         {
+            case '\n':
+                scanner->line++;
+                // Fall through
             case ' ':
             case '\r':
             case '\t':
-                advance();
+                advance(scanner);
                 break;
 
+            default:
+                return;
+        }
+    }
+}
+
+/**
+ * Skip to the end of a comment
+ *
+ * The cursor stops on the newline, which is left for
+ * `blank_skip` to count.
+ */
+static void comment_skip(Scanner* scanner)
+{
+#ifdef SIMD_SCANNER
+    if (comment_blocks_skip(scanner)) return;
+#endif
+
+    while (peek(scanner) != '\n' && !is_at_end(scanner)) advance(scanner);
+}
+
+/**
+ * Skip to the closing quote of a string, or the end of the source
+ */
+static void string_body_skip(Scanner* scanner)
+{
+#ifdef SIMD_SCANNER
+    if (string_blocks_skip(scanner)) return;
+#endif
+
+    while (peek(scanner) != '"' && !is_at_end(scanner))
+    {
+        if (peek(scanner) == '\n') scanner->line++;
+        advance(scanner);
+    }
+}
+
+/**
+ * Skip blanks and comments
+ *
+ * @return where to scan again from if the source turns out to
+ *         go on past its end
+ *
+ * That is the cursor, unless it stopped at the end inside a
+ * comment, which has to be scanned again from its start.
+ */
+static const char* whitespace_skip(Scanner* scanner)
+{
+    const char* resume = scanner->current;
+    for (;;)
+    {
+        char c = peek(scanner);
+        switch (c)
+        {
+            case ' ':
+            case '\r':
+            case '\t':
             case '\n':
-                scanner.line++;
-                advance();
+                blank_skip(scanner);
+                resume = scanner->current;
                 break;
 
             case '/':
-                if (peek_next() == '/')
+                if (peek_next(scanner) == '/')
                 {
                     // Comments go to the end of the line
-                    while (peek() != '\n' && !is_at_end()) advance();
+                    resume = scanner->current;
+                    comment_skip(scanner);
                 }
                 else
                 {
-                    return;
+                    return resume;
                 }
                 break;
 
             default:
-                return;
+                return resume;
         }
     }
 }
 
 /**
- * Check if we are parsing a keyword
- *
- * We need to verify two things: 1. the lexeme must be exactly 
- * as long as the keyword and 2. the remaining characters must 
- * match exactly. If both of this conditions aren't met, then 
- * we must be dealing with a regular identifier.
+ * A reserved word and the token it scans as
  */
-static TokenType keyword_check(int start, int length, const char* rest, TokenType type)
+typedef struct
 {
-    if (scanner.current - scanner.start == start + length &&
-        memcmp(scanner.start + start, rest, length) == 0)
-    {
-        return type;
-    }
+    const char* name;
+    int length;
+    TokenType type;
+} Keyword;
 
-    return TOKEN_IDENTIFIER;
-}
+#include "keywords.inc"
 
 /**
  * Get the identifier type of a lexeme
  *
- * We check to see if are encountering a keyword
- * by using a trie. This lets us do the minimal amount
- * of work to check if the series of characters are one 
- * of our keywords, making this thing fast.
+ * The keyword table is a perfect hash over the length and
+ * the first and last characters of the lexeme, generated by
+ * tools/keywords.py. No two keywords share a slot, so the
+ * only keyword the lexeme could be is the one in its slot,
+ * and a single compare tells whether it is.
  */
-static TokenType identifier_type()
+static TokenType identifier_type(Scanner* scanner)
 {
-    switch (scanner.start[0])
+    int length = (int)(scanner->current - scanner->start);
+    if (length < KEYWORD_LENGTH_MIN || length > KEYWORD_LENGTH_MAX) return TOKEN_IDENTIFIER;
+
+    unsigned char first = (unsigned char)scanner->start[0];
+    unsigned char last = (unsigned char)scanner->start[length - 1];
+    const Keyword* keyword = &keywords[KEYWORD_HASH(length, first, last)];
+
+    if (keyword->length == length && memcmp(scanner->start, keyword->name, length) == 0)
     {
-        case 'a': return keyword_check(1, 2, "nd", TOKEN_AND);
-        case 'c': return keyword_check(1, 4, "lass", TOKEN_CLASS);
-        case 'e': return keyword_check(1, 3, "lse", TOKEN_CLASS);
-        case 'f':
-            if (scanner.current - scanner.start > 2)
-            {
-                switch (scanner.start[1])
-                {
-                    case 'a': return keyword_check(2, 3, "lse", TOKEN_ELSE);
-                    case 'o': return keyword_check(2, 1, "r", TOKEN_OR);
-                }
-            }
-            else
-            {
-                return keyword_check(1, 1, "n", TOKEN_FN);
-            }
-            break;
-        case 'i': return keyword_check(1, 1, "f", TOKEN_IF);
-        case 'l': return keyword_check(1, 2, "et", TOKEN_LET);
-        case 'n': return keyword_check(1, 2, "il", TOKEN_NIL);
-        case 'o': return keyword_check(1, 1, "r", TOKEN_OR);
-        case 'p': return keyword_check(1, 4, "rint", TOKEN_PRINT);
-        case 'r': return keyword_check(1, 5, "eturn", TOKEN_RETURN);
-        case 's': return keyword_check(1, 4, "uper", TOKEN_SUPER);
-        case 't':
-            if (scanner.current - scanner.start > 1)
-            {
-                switch (scanner.start[1])
-                {
-                    case 'h': return keyword_check(2, 2, "is", TOKEN_THIS);
-                    case 'r': return keyword_check(2, 2, "ue", TOKEN_TRUE);
-                }
-            }
-            break;
-        case 'w': return keyword_check(1, 4, "hile", TOKEN_WHILE);
+        return keyword->type;
     }
 
     return TOKEN_IDENTIFIER;
 }
 
-static Token identifier_make()
+static Token identifier_make(Scanner* scanner)
 {
-    while (is_alpha(peek()) || is_digit(peek())) advance();
+    while (is_alpha(peek(scanner)) || is_digit(peek(scanner))) advance(scanner);
 
-    return token_make(identifier_type());
+    return token_make(scanner, identifier_type(scanner));
 }
 
 /**
@@ -211,35 +593,31 @@ static Token identifier_make()
  * the compiler will conver the lexeme into 
  * the number.
  */
-static Token number_make()
+static Token number_make(Scanner* scanner)
 {
-    while (is_digit(peek())) advance();
+    while (is_digit(peek(scanner))) advance(scanner);
 
     // Look for a fractional part
-    if (peek() == '.' && is_digit(peek_next()))
+    if (peek(scanner) == '.' && is_digit(peek_next(scanner)))
     {
         // consume the "."
-        advance();
+        advance(scanner);
     }
 
-    while (is_digit(peek())) advance();
+    while (is_digit(peek(scanner))) advance(scanner);
 
-    return token_make(TOKEN_NUMBER);
+    return token_make(scanner, TOKEN_NUMBER);
 }
 
-static Token string_make()
+static Token string_make(Scanner* scanner)
 {
-    while (peek() != '"' && !is_at_end())
-    {
-        if (peek() == '\n') scanner.line++;
-        advance();
-    }
+    string_body_skip(scanner);
 
-    if (is_at_end()) return token_error("Unterminated string.");
+    if (is_at_end(scanner)) return token_error(scanner, SCAN_UNTERMINATED_STRING);
 
     // The closing quote
-    advance();
-    return token_make(TOKEN_STRING);
+    advance(scanner);
+    return token_make(scanner, TOKEN_STRING);
 }
 
 
@@ -253,51 +631,92 @@ static Token string_make()
  * return false. If it is, return true. Our `scan_token`
  * will check each possible case.
  */
-static bool pair(char expected)
+static bool pair(Scanner* scanner, char expected)
 {
-    if (is_at_end()) return false;
-    if (*scanner.current != expected) return false;
+    if (is_at_end(scanner)) return false;
+    if (*scanner->current != expected) return false;
 
-    scanner.current++;
+    scanner->current++;
     return true;
 }
 
-Token token_scan()
+static Token window_scan(Scanner* scanner)
 {
-    whitespace_skip();
-    scanner.start = scanner.current;
+    scanner->start = scanner->current;
 
-    if (is_at_end()) return token_make(TOKEN_EOF);
+    if (is_at_end(scanner)) return token_make(scanner, TOKEN_EOF);
 
-    char c = advance();
-    if (is_alpha(c)) return identifier_make();
-    if (is_digit(c)) return number_make();
+    char c = advance(scanner);
+    if (is_alpha(c)) return identifier_make(scanner);
+    if (is_digit(c)) return number_make(scanner);
 
     switch (c)
     {
-        case '(': return token_make(TOKEN_LEFT_PAREN);
-        case ')': return token_make(TOKEN_RIGHT_PAREN);
-        case '{': return token_make(TOKEN_LEFT_BRACE);
-        case '}': return token_make(TOKEN_RIGHT_BRACE);
-        case ';': return token_make(TOKEN_SEMICOLON);
-        case ',': return token_make(TOKEN_COMMA);
-        case '.': return token_make(TOKEN_DOT);
-        case '-': return token_make(TOKEN_MINUS);
-        case '+': return token_make(TOKEN_PLUS);
-        case '/': return token_make(TOKEN_SLASH);
-        case '*': return token_make(TOKEN_STAR);
+        case '(': return token_make(scanner, TOKEN_LEFT_PAREN);
+        case ')': return token_make(scanner, TOKEN_RIGHT_PAREN);
+        case '{': return token_make(scanner, TOKEN_LEFT_BRACE);
+        case '}': return token_make(scanner, TOKEN_RIGHT_BRACE);
+        case ';': return token_make(scanner, TOKEN_SEMICOLON);
+        case ',': return token_make(scanner, TOKEN_COMMA);
+        case '.': return token_make(scanner, TOKEN_DOT);
+        case '-': return token_make(scanner, TOKEN_MINUS);
+        case '+': return token_make(scanner, TOKEN_PLUS);
+        case '/': return token_make(scanner, TOKEN_SLASH);
+        case '*': return token_make(scanner, TOKEN_STAR);
         // Potential two character tokens
         case '!': 
-            return token_make(pair('=') ? TOKEN_BANG_EQUAL: TOKEN_BANG);
+            return token_make(scanner, pair(scanner, '=') ? TOKEN_BANG_EQUAL: TOKEN_BANG);
         case '=':
-            return token_make(pair('=') ? TOKEN_EQUAL_EQUAL: TOKEN_EQUAL);
+            return token_make(scanner, pair(scanner, '=') ? TOKEN_EQUAL_EQUAL: TOKEN_EQUAL);
         case '<':
-            return token_make(pair('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+            return token_make(scanner, pair(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
         case '>':
-            return token_make(pair('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+            return token_make(scanner, pair(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
         // Literals
-        case '"': return string_make();
+        case '"': return string_make(scanner);
     }
 
-    return token_error("Unexpected character.");
+    return token_error(scanner, SCAN_UNEXPECTED_CHARACTER);
+}
+
+/**
+ * Scan the next token
+ *
+ * A streaming scanner can only see up to the end of its window,
+ * where the NUL looks like the end of the source. Any token that
+ * got within a character of it may really continue in the next
+ * block, so we read more and scan that token again. Blanks and
+ * comments before it are not scanned again, short of a comment
+ * the window cut off, so however long a run of them is, it is
+ * neither rescanned nor held in the window. This happens once
+ * per block, and a token is never handed out half scanned.
+ */
+Token token_scan(Scanner* scanner)
+{
+    if (scanner->reader == NULL)
+    {
+        whitespace_skip(scanner);
+        return window_scan(scanner);
+    }
+
+    for (;;)
+    {
+        const char* resume = whitespace_skip(scanner);
+        int line = scanner->line;
+        Token token = window_scan(scanner);
+
+        ScanReader* reader = scanner->reader;
+        if (reader->buffer + reader->length - scanner->current > 1) return token;
+
+        if (!window_refill(scanner, resume))
+        {
+            if (reader->failed)
+            {
+                reader->failed = false;
+                return token_error(scanner, SCAN_READ_FAILED);
+            }
+            return token;
+        }
+        scanner->line = line;
+    }
 }
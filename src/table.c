@@ -0,0 +1,287 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+
+// Distances are stored plus one in a byte. Anything further
+// from home than fits is stored as this and worked out from
+// the key's hash when needed, which only happens when a lot of
+// keys share a hash.
+#define DISTANCE_SATURATED 255
+
+void table_init(Table* table)
+{
+    table->count = 0;
+    table->capacity = 0;
+    table->entries = NULL;
+    table->distances = NULL;
+}
+
+void table_free(Table* table)
+{
+    FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(uint8_t, table->distances, table->capacity);
+    table_init(table);
+}
+
+/**
+ * Get the distance of the entry in a slot, plus one
+ */
+static inline int distance_get(Entry* entries, uint8_t* distances, uint32_t mask, uint32_t slot)
+{
+    int distance = distances[slot];
+    if (distance != DISTANCE_SATURATED) return distance;
+
+    return (int)((slot - (entries[slot].key->hash & mask)) & mask) + 1;
+}
+
+static inline void distance_set(uint8_t* distances, uint32_t slot, int distance)
+{
+    distances[slot] = (uint8_t)(distance < DISTANCE_SATURATED ? distance : DISTANCE_SATURATED);
+}
+
+/**
+ * Find the slot holding a key
+ *
+ * @return the slot, or -1 if the key is not in the table
+ *
+ * Entries are ordered by distance along any probe sequence, so
+ * once we reach an empty slot or an entry nearer its home than
+ * the key would be at this point, the key can't be further on.
+ */
+static int slot_find(Table* table, ObjString* key)
+{
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    uint32_t slot = key->hash & mask;
+
+    for (int distance = 1;; distance++)
+    {
+        if (table->entries[slot].key == key) return (int)slot;
+        if (table->distances[slot] < distance &&
+            distance_get(table->entries, table->distances, mask, slot) < distance)
+        {
+            return -1;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+}
+
+/**
+ * Place an entry whose key isn't in the table yet
+ *
+ * Walks the probe sequence of the new entry, swapping it with
+ * every entry that is nearer its home slot, until the entry in
+ * hand lands in an empty slot.
+ */
+static void entry_place(Entry* entries, uint8_t* distances, int capacity, ObjString* key, Value value)
+{
+    uint32_t mask = (uint32_t)capacity - 1;
+    uint32_t slot = key->hash & mask;
+    Entry entry = { key, value };
+    int distance = 1;
+
+    for (;;)
+    {
+        if (distances[slot] == 0)
+        {
+            entries[slot] = entry;
+            distance_set(distances, slot, distance);
+            return;
+        }
+
+        int resident = distance_get(entries, distances, mask, slot);
+        if (resident < distance)
+        {
+            Entry swapped = entries[slot];
+            entries[slot] = entry;
+            distance_set(distances, slot, distance);
+            entry = swapped;
+            distance = resident;
+        }
+
+        slot = (slot + 1) & mask;
+        distance++;
+    }
+}
+
+/**
+ * Move every entry into arrays of a new capacity
+ *
+ * The keys are known to be distinct, so the entries are
+ * placed without looking for existing keys first.
+ */
+static void table_resize(Table* table, int capacity)
+{
+    Entry* entries = GROW_ARRAY(NULL, Entry, 0, capacity);
+    uint8_t* distances = GROW_ARRAY(NULL, uint8_t, 0, capacity);
+    memset(distances, 0, (size_t)capacity);
+    for (int i = 0; i < capacity; i++)
+    {
+        entries[i].key = NULL;
+    }
+
+    for (int i = 0; i < table->capacity; i++)
+    {
+        if (table->distances[i] == 0) continue;
+
+        Entry* entry = &table->entries[i];
+        entry_place(entries, distances, capacity, entry->key, entry->value);
+    }
+
+    FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(uint8_t, table->distances, table->capacity);
+    table->entries = entries;
+    table->distances = distances;
+    table->capacity = capacity;
+}
+
+/**
+ * Make room for a number of entries
+ *
+ * @param count the number of entries the table should hold
+ * without growing
+ *
+ * Resizes at most once, straight to the final capacity, rather
+ * than doubling repeatedly as a run of inserts would.
+ */
+void table_reserve(Table* table, int count)
+{
+    int capacity = table->capacity;
+    while ((int64_t)count * TABLE_MAX_LOAD_DENOMINATOR > (int64_t)capacity * TABLE_MAX_LOAD_NUMERATOR)
+    {
+        capacity = GROW_CAPACITY(capacity);
+    }
+
+    if (capacity != table->capacity) table_resize(table, capacity);
+}
+
+/**
+ * Look up the value of a key
+ *
+ * @return whether the key is in the table
+ */
+bool table_get(Table* table, ObjString* key, Value* value)
+{
+    if (table->count == 0) return false;
+
+    int slot = slot_find(table, key);
+    if (slot == -1) return false;
+
+    *value = table->entries[slot].value;
+    return true;
+}
+
+/**
+ * Set the value of a key
+ *
+ * @return whether the key is new to the table
+ */
+bool table_set(Table* table, ObjString* key, Value value)
+{
+    if (table->count > 0)
+    {
+        int slot = slot_find(table, key);
+        if (slot != -1)
+        {
+            table->entries[slot].value = value;
+            return false;
+        }
+    }
+
+    table_reserve(table, table->count + 1);
+    entry_place(table->entries, table->distances, table->capacity, key, value);
+
+    table->count++;
+    return true;
+}
+
+/**
+ * Remove a key from the table
+ *
+ * @return whether the key was in the table
+ *
+ * The entries after it that aren't in their home slot are
+ * shifted back one slot each, which leaves the table exactly
+ * as if the key had never been inserted.
+ */
+bool table_delete(Table* table, ObjString* key)
+{
+    if (table->count == 0) return false;
+
+    int slot = slot_find(table, key);
+    if (slot == -1) return false;
+
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    uint32_t hole = (uint32_t)slot;
+    uint32_t next = (hole + 1) & mask;
+
+    while (table->distances[next] > 1)
+    {
+        int distance = distance_get(table->entries, table->distances, mask, next);
+        table->entries[hole] = table->entries[next];
+        distance_set(table->distances, hole, distance - 1);
+        hole = next;
+        next = (next + 1) & mask;
+    }
+
+    table->entries[hole].key = NULL;
+    table->distances[hole] = 0;
+    table->count--;
+    return true;
+}
+
+/**
+ * Copy every entry of one table into another
+ *
+ * The destination is sized for both tables up front.
+ */
+void table_add_all(Table* from, Table* to)
+{
+    table_reserve(to, to->count + from->count);
+
+    for (int i = 0; i < from->capacity; i++)
+    {
+        if (from->distances[i] != 0)
+        {
+            table_set(to, from->entries[i].key, from->entries[i].value);
+        }
+    }
+}
+
+/**
+ * Find an interned string by its characters
+ *
+ * This is the one place keys are compared by content rather
+ * than by pointer: it is how a new string finds out whether it
+ * has been interned already. The cached hashes and lengths rule
+ * out nearly every mismatch before the characters are compared.
+ */
+ObjString* table_find_string(Table* table, const char* chars, int length, uint32_t hash)
+{
+    if (table->count == 0) return NULL;
+
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    uint32_t slot = hash & mask;
+
+    for (int distance = 1;; distance++)
+    {
+        if (table->distances[slot] < distance &&
+            distance_get(table->entries, table->distances, mask, slot) < distance)
+        {
+            return NULL;
+        }
+
+        ObjString* key = table->entries[slot].key;
+        if (key->hash == hash && key->length == length &&
+            memcmp(key->chars, chars, (size_t)length) == 0)
+        {
+            return key;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+}
@@ -0,0 +1,433 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#include "memory.h"
+#include "token.h"
+
+static bool token_is_eof(Token token)
+{
+    return TOKEN_TYPE(token) == TOKEN_EOF;
+}
+
+/**
+ * Scan the whole source into the token array
+ */
+static void batch_fill(TokenStream* stream)
+{
+    for (;;)
+    {
+        if (stream->capacity < (int)stream->scanned + 1)
+        {
+            int capacity_old = stream->capacity;
+            stream->capacity = GROW_CAPACITY(capacity_old);
+            stream->tokens = GROW_ARRAY(stream->tokens, Token, capacity_old, stream->capacity);
+        }
+
+        Token token = token_scan(&stream->scanner);
+        stream->tokens[stream->scanned++] = token;
+        if (token_is_eof(token)) return;
+    }
+}
+
+/**
+ * Mark the oldest text a streaming scanner has to keep
+ *
+ * The parser holds on to the last two tokens it consumed and
+ * may still need their lexemes, so the scanner must not slide
+ * its window past them. Error tokens have no lexeme.
+ */
+static void ring_keep(TokenStream* stream)
+{
+    Scanner* scanner = &stream->scanner;
+    scanner->keep = scanner->current;
+
+    for (uint32_t back = 2; back > 0; back--)
+    {
+        if (stream->position < back) continue;
+
+        Token token = stream->tokens[(stream->position - back) & stream->mask];
+        if (TOKEN_TYPE(token) == TOKEN_ERROR) continue;
+
+        const char* lexeme = token_lexeme(scanner, token);
+        if (lexeme < scanner->keep) scanner->keep = lexeme;
+    }
+}
+
+/**
+ * Top the ring up with freshly scanned tokens
+ *
+ * The scanner runs in a tight loop until the ring is full
+ * again or it hits the end of the source, rather than being
+ * called once for every token the parser asks for. The two
+ * slots behind the current position are left alone.
+ */
+static void ring_fill(TokenStream* stream)
+{
+    if (stream->scanned > 0 && token_is_eof(stream->tokens[(stream->scanned - 1) & stream->mask]))
+    {
+        return;
+    }
+
+    if (stream->scanner.reader != NULL) ring_keep(stream);
+
+    while (stream->scanned - stream->position < (uint32_t)stream->capacity - 2)
+    {
+        Token token = token_scan(&stream->scanner);
+        stream->tokens[stream->scanned++ & stream->mask] = token;
+        if (token_is_eof(token)) return;
+    }
+}
+
+/**
+ * Start streaming tokens from a source
+ *
+ * @param source NUL terminated source code
+ * @param batch whether to scan everything up front
+ */
+void token_stream_init(TokenStream* stream, const char* source, bool batch)
+{
+    scanner_init(&stream->scanner, source);
+    stream->position = 0;
+    stream->scanned = 0;
+    stream->batch = batch;
+
+    if (batch)
+    {
+        stream->tokens = NULL;
+        stream->capacity = 0;
+        stream->mask = UINT32_MAX;
+        batch_fill(stream);
+    }
+    else
+    {
+        stream->capacity = TOKEN_RING_SIZE;
+        stream->tokens = GROW_ARRAY(NULL, Token, 0, TOKEN_RING_SIZE);
+        stream->mask = TOKEN_RING_SIZE - 1;
+    }
+}
+
+/**
+ * Start streaming tokens from a file, pipe or stdin
+ *
+ * Always streams through the ring, so neither the source nor
+ * its tokens are ever held in memory all at once.
+ */
+void token_stream_init_file(TokenStream* stream, FILE* file)
+{
+    token_stream_init(stream, "", false);
+    scanner_init_file(&stream->scanner, file);
+}
+
+void token_stream_free(TokenStream* stream)
+{
+    scanner_free(&stream->scanner);
+    FREE_ARRAY(Token, stream->tokens, stream->capacity);
+    stream->tokens = NULL;
+    stream->capacity = 0;
+}
+
+/**
+ * Get a token that hasn't been scanned yet
+ *
+ * The slow path of `token_peek`. Refills the ring, and maps
+ * positions past the end of the source to the EOF token.
+ */
+Token token_stream_fill(TokenStream* stream, uint32_t position)
+{
+    if (!stream->batch) ring_fill(stream);
+    if (position >= stream->scanned) position = stream->scanned - 1;
+
+    return stream->tokens[position & stream->mask];
+}
+
+/**
+ * One piece of a source lexed in parallel
+ *
+ * The piece runs from just after a newline to just after a
+ * later one. Its tokens are those that start inside it, so the
+ * last one may run on into the next piece. Lines are counted
+ * from the start of the piece until the pieces are merged.
+ */
+typedef struct
+{
+    const char* source;
+    size_t length;
+    size_t begin;
+    size_t end;
+    bool last;
+    Token* tokens;
+    int count;
+    int capacity;
+    // Where the scanner stood after the piece's last token.
+    size_t resume;
+    int resume_line;
+    int newlines;
+} LexPiece;
+
+static void piece_append(LexPiece* piece, Token token)
+{
+    if (piece->capacity < piece->count + 1)
+    {
+        int capacity_old = piece->capacity;
+        piece->capacity = GROW_CAPACITY(capacity_old);
+        piece->tokens = GROW_ARRAY(piece->tokens, Token, capacity_old, piece->capacity);
+    }
+
+    piece->tokens[piece->count++] = token;
+}
+
+/**
+ * Lex a piece on the assumption that it starts between tokens
+ *
+ * That is right unless a string literal from an earlier piece
+ * runs across the start of this one, which the merge detects
+ * and repairs. Comments can't: they end at a newline.
+ */
+static void* piece_lex(void* argument)
+{
+    LexPiece* piece = (LexPiece*)argument;
+
+    Scanner scanner;
+    scanner_init_length(&scanner, piece->source, piece->length);
+    scanner.current = piece->source + piece->begin;
+
+    for (;;)
+    {
+        const char* resume = scanner.current;
+        int line = scanner.line;
+        Token token = token_scan(&scanner);
+
+        if (!piece->last && (size_t)(scanner.start - piece->source) >= piece->end)
+        {
+            piece->resume = (size_t)(resume - piece->source);
+            piece->resume_line = line;
+            break;
+        }
+
+        piece_append(piece, token);
+        if (token_is_eof(token)) break;
+    }
+
+    const char* cursor = piece->source + piece->begin;
+    const char* end = piece->source + piece->end;
+    piece->newlines = 0;
+    while ((cursor = memchr(cursor, '\n', (size_t)(end - cursor))) != NULL)
+    {
+        piece->newlines++;
+        cursor++;
+    }
+
+    return NULL;
+}
+
+static void stream_append(TokenStream* stream, Token token)
+{
+    if (stream->capacity < (int)stream->scanned + 1)
+    {
+        int capacity_old = stream->capacity;
+        stream->capacity = GROW_CAPACITY(capacity_old);
+        stream->tokens = GROW_ARRAY(stream->tokens, Token, capacity_old, stream->capacity);
+    }
+
+    stream->tokens[stream->scanned++] = token;
+}
+
+/**
+ * Append a piece's speculative tokens, from `first` on
+ *
+ * @param line_base the line the piece starts on
+ */
+static void piece_take(TokenStream* stream, LexPiece* piece, int first, int line_base)
+{
+    int count = piece->count - first;
+    if (stream->capacity < (int)stream->scanned + count)
+    {
+        int capacity_old = stream->capacity;
+        stream->capacity = (int)stream->scanned + count;
+        stream->tokens = GROW_ARRAY(stream->tokens, Token, capacity_old, stream->capacity);
+    }
+
+    Token* tokens = stream->tokens + stream->scanned;
+    memcpy(tokens, piece->tokens + first, sizeof(Token) * count);
+    for (int i = 0; i < count; i++)
+    {
+        tokens[i].line += line_base - 1;
+    }
+    stream->scanned += (uint32_t)count;
+}
+
+/**
+ * Stitch the pieces' tokens together in order
+ *
+ * We follow where a sequential scan would be. When it left the
+ * previous piece past the start of this one, the speculative
+ * tokens up to there are wrong, so we rescan from that point
+ * until we reach the start of a token the speculative scan
+ * also found. From there on the tokens are the same, since a
+ * token depends only on where scanning starts.
+ */
+static void pieces_merge(TokenStream* stream, LexPiece* pieces, int count)
+{
+    const char* source = pieces[0].source;
+
+    // Nearly every token is taken from the pieces as is.
+    int total = 0;
+    for (int p = 0; p < count; p++)
+    {
+        total += pieces[p].count;
+    }
+    stream->capacity = total;
+    stream->tokens = GROW_ARRAY(NULL, Token, 0, total);
+
+    size_t resume = 0;
+    int line = 1;
+    int line_base = 1;
+
+    for (int p = 0; p < count; p++)
+    {
+        LexPiece* piece = &pieces[p];
+
+        if (resume <= piece->begin)
+        {
+            piece_take(stream, piece, 0, line_base);
+            resume = piece->resume;
+            line = piece->resume_line + line_base - 1;
+            line_base += piece->newlines;
+            continue;
+        }
+
+        Scanner scanner;
+        scanner_init_length(&scanner, source, pieces[0].length);
+        scanner.current = source + resume;
+        scanner.line = line;
+
+        int next = 0;
+        for (;;)
+        {
+            const char* before = scanner.current;
+            int before_line = scanner.line;
+            Token token = token_scan(&scanner);
+            size_t start = (size_t)(scanner.start - source);
+
+            if (!piece->last && start >= piece->end)
+            {
+                resume = (size_t)(before - source);
+                line = before_line;
+                break;
+            }
+
+            while (next < piece->count && piece->tokens[next].offset < start) next++;
+            if (next < piece->count && piece->tokens[next].offset == start &&
+                TOKEN_TYPE(piece->tokens[next]) != TOKEN_ERROR &&
+                TOKEN_TYPE(token) != TOKEN_ERROR)
+            {
+                piece_take(stream, piece, next, line_base);
+                resume = piece->resume;
+                line = piece->resume_line + line_base - 1;
+                break;
+            }
+
+            stream_append(stream, token);
+            if (token_is_eof(token)) break;
+        }
+
+        line_base += piece->newlines;
+    }
+}
+
+/**
+ * Lex a source in parallel into a batch stream
+ *
+ * @param length the length of the source, which must be
+ * followed by a NUL
+ * @param pieces how many pieces to split the source into,
+ * each lexed on its own thread
+ *
+ * The source is split after newlines and the pieces lexed at
+ * the same time, each speculating that it doesn't start inside
+ * a string. The merge repairs the few pieces where that was
+ * wrong, so the result is exactly what `token_stream_init`
+ * gives in batch mode.
+ */
+void token_stream_init_parallel(TokenStream* stream, const char* source, size_t length, int pieces)
+{
+    if (pieces < 1) pieces = 1;
+
+    LexPiece* piece = GROW_ARRAY(NULL, LexPiece, 0, pieces);
+    size_t begin = 0;
+    for (int p = 0; p < pieces; p++)
+    {
+        size_t end = length;
+        if (p < pieces - 1)
+        {
+            end = length / pieces * (p + 1);
+            if (end < begin) end = begin;
+            const char* newline = memchr(source + end, '\n', length - end);
+            end = newline == NULL ? length : (size_t)(newline - source) + 1;
+        }
+
+        piece[p].source = source;
+        piece[p].length = length;
+        piece[p].begin = begin;
+        piece[p].end = end;
+        piece[p].last = p == pieces - 1;
+        piece[p].tokens = NULL;
+        piece[p].count = 0;
+        piece[p].capacity = 0;
+        piece[p].resume = end;
+        piece[p].resume_line = 1;
+        begin = end;
+    }
+
+#ifdef HAVE_PTHREADS
+    pthread_t* threads = GROW_ARRAY(NULL, pthread_t, 0, pieces);
+    bool* started = GROW_ARRAY(NULL, bool, 0, pieces);
+    for (int p = 1; p < pieces; p++)
+    {
+        started[p] = pthread_create(&threads[p], NULL, piece_lex, &piece[p]) == 0;
+    }
+
+    piece_lex(&piece[0]);
+
+    for (int p = 1; p < pieces; p++)
+    {
+        if (started[p])
+        {
+            pthread_join(threads[p], NULL);
+        }
+        else
+        {
+            piece_lex(&piece[p]);
+        }
+    }
+
+    FREE_ARRAY(pthread_t, threads, pieces);
+    FREE_ARRAY(bool, started, pieces);
+#else
+    for (int p = 0; p < pieces; p++)
+    {
+        piece_lex(&piece[p]);
+    }
+#endif
+
+    scanner_init_length(&stream->scanner, source, length);
+    stream->tokens = NULL;
+    stream->capacity = 0;
+    stream->mask = UINT32_MAX;
+    stream->position = 0;
+    stream->scanned = 0;
+    stream->batch = true;
+
+    pieces_merge(stream, piece, pieces);
+
+    for (int p = 0; p < pieces; p++)
+    {
+        FREE_ARRAY(Token, piece[p].tokens, piece[p].capacity);
+    }
+    FREE_ARRAY(LexPiece, piece, pieces);
+}
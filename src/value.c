@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include "memory.h"
+#include "object.h"
 #include "value.h"
 
 /**
@@ -53,12 +54,106 @@ void value_array_write(ValueArray* array, Value value)
 }
 
 /**
- * Print a constant value
+ * Print a value
  *
- * This value is held in our constants array
- * in each chunk.
+ * Values are held on the stack of the virtual
+ * machine and in the constants array of each chunk.
  */
 void value_print(Value value)
 {
-    printf("%g", value);
+#ifdef NAN_BOXING
+    if (IS_BOOL(value))
+    {
+        printf(AS_BOOL(value) ? "true" : "false");
+    }
+    else if (IS_NIL(value))
+    {
+        printf("nil");
+    }
+    else if (IS_NUMBER(value))
+    {
+        printf("%g", AS_NUMBER(value));
+    }
+    else if (IS_OBJ(value))
+    {
+        object_print(value);
+    }
+    else if (IS_UNDEFINED(value))
+    {
+        printf("<undefined>");
+    }
+#else
+    switch (value.type)
+    {
+        case VAL_BOOL:
+            printf(AS_BOOL(value) ? "true" : "false");
+            break;
+        case VAL_NIL: printf("nil"); break;
+        case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
+        case VAL_OBJ: object_print(value); break;
+        case VAL_UNDEFINED: printf("<undefined>"); break;
+    }
+#endif
+}
+
+/**
+ * Check whether two values are equal
+ *
+ * Values of different types are never equal. Numbers are
+ * compared as doubles, even when NaN-boxed, so that NaN is
+ * not equal to itself and zero equals negative zero. Objects
+ * are compared by identity. Strings are interned, so that is
+ * the same as comparing their characters.
+ */
+bool values_equal(Value a, Value b)
+{
+#ifdef NAN_BOXING
+    if (IS_NUMBER(a) && IS_NUMBER(b))
+    {
+        return AS_NUMBER(a) == AS_NUMBER(b);
+    }
+
+    return a == b;
+#else
+    if (a.type != b.type) return false;
+
+    switch (a.type)
+    {
+        case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
+        case VAL_NIL:    return true;
+        case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
+        case VAL_OBJ:    return AS_OBJ(a) == AS_OBJ(b);
+        case VAL_UNDEFINED: return true;
+        default:
+            return false; // Unreachable
+    }
+#endif
+}
+
+/**
+ * Check whether two values are the very same value
+ *
+ * Unlike `values_equal` this compares representations:
+ * 0 and -0 are different, while a NaN is identical to
+ * itself. This is what deduplicating constants needs.
+ */
+bool values_identical(Value a, Value b)
+{
+#ifdef NAN_BOXING
+    return a == b;
+#else
+    if (a.type != b.type) return false;
+
+    switch (a.type)
+    {
+        case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
+        case VAL_NIL:    return true;
+        case VAL_NUMBER:
+            return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+        case VAL_OBJ:    return AS_OBJ(a) == AS_OBJ(b);
+        case VAL_UNDEFINED: return true;
+        default:
+            return false; // Unreachable
+    }
+#endif
 }
@@ -1,11 +1,19 @@
+#include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
 #include "value.h"
 #include "vm.h"
 
-VM vm;
+// Frames a trace shows at each end of a deep call stack.
+#define TRACE_FRAMES 10
+
+static InterpretResult vm_run(VM* vm);
 
 /**
  * Reset the virtual machien stack
@@ -14,30 +22,190 @@ VM vm;
  * to be pointed at the begging of the stack
  * array, indicating that the stack is empty.
  */
-static void vm_stack_reset()
+static void vm_stack_reset(VM* vm)
 {
-    vm.stack_top = vm.stack;
+    vm->stack_top = vm->stack;
+    vm->frame_count = 0;
+    vm->open_upvalues = NULL;
 }
 
-void vm_init() 
+/**
+ * Initialize a virtual machine
+ *
+ * The stack starts out small, most scripts never need
+ * more than a handful of slots. It grows on demand.
+ *
+ * A VM shares no state with any other, so separate VMs
+ * can run on separate threads at the same time.
+ */
+void vm_init(VM* vm)
 {
-    vm_stack_reset();
+    vm->stack = GROW_ARRAY(NULL, Value, 0, STACK_INITIAL);
+    vm->stack_capacity = STACK_INITIAL;
+    vm->frames = GROW_ARRAY(NULL, CallFrame, 0, FRAMES_MAX);
+    vm_stack_reset(vm);
+    table_init(&vm->strings);
+    vm->objects = NULL;
+    table_init(&vm->global_slots);
+    value_array_init(&vm->globals);
+    value_array_init(&vm->global_names);
 }
 
+void vm_free(VM* vm)
+{
+    FREE_ARRAY(Value, vm->stack, vm->stack_capacity);
+    vm->stack = NULL;
+    vm->stack_top = NULL;
+    vm->stack_capacity = 0;
+    FREE_ARRAY(CallFrame, vm->frames, FRAMES_MAX);
+    vm->frames = NULL;
+    table_free(&vm->global_slots);
+    value_array_free(&vm->globals);
+    value_array_free(&vm->global_names);
+    table_free(&vm->strings);
+    objects_free(vm);
+}
+
+/**
+ * Get the slot of a global variable
+ *
+ * @param vm the virtual machine the global belongs to
+ * @param name the name of the global
+ * @return the slot, or -1 if there are too many globals
+ *
+ * A name seen for the first time gets the next free slot,
+ * which starts out undefined. Slots are never given back, so
+ * code compiled earlier, say on a previous line of the REPL,
+ * keeps referring to the right variable.
+ */
+int vm_global_slot(VM* vm, ObjString* name)
+{
+    Value slot;
+    if (table_get(&vm->global_slots, name, &slot)) return (int)AS_NUMBER(slot);
+
+    if (vm->globals.count == GLOBALS_MAX) return -1;
+
+    int index = vm->globals.count;
+    table_set(&vm->global_slots, name, NUMBER_VAL(index));
+    value_array_write(&vm->globals, UNDEFINED_VAL);
+    value_array_write(&vm->global_names, OBJ_VAL(name));
+    return index;
+}
+
+/**
+ * Grow the virtual machine stack
+ *
+ * @return false if the stack is already at STACK_MAX
+ *
+ * The stack doubles in size, which may move it. Anything
+ * pointing into the old stack is moved along with it.
+ */
+static bool vm_stack_grow(VM* vm)
+{
+    if (vm->stack_capacity >= STACK_MAX) return false;
+
+    int capacity_old = vm->stack_capacity;
+    int capacity = GROW_CAPACITY(capacity_old);
+    if (capacity > STACK_MAX) capacity = STACK_MAX;
+
+    Value* stack_old = vm->stack;
+    ptrdiff_t top = vm->stack_top - vm->stack;
+    vm->stack = GROW_ARRAY(vm->stack, Value, capacity_old, capacity);
+    vm->stack_capacity = capacity;
+    vm->stack_top = vm->stack + top;
+
+    for (int i = 0; i < vm->frame_count; i++)
+    {
+        vm->frames[i].slots = vm->stack + (vm->frames[i].slots - stack_old);
+    }
 
-void vm_free() {}
+    for (ObjUpvalue* upvalue = vm->open_upvalues; upvalue != NULL; upvalue = upvalue->next)
+    {
+        upvalue->location = vm->stack + (upvalue->location - stack_old);
+    }
+
+    return true;
+}
+
+/**
+ * Get the chunk a frame is running
+ */
+static inline Chunk* frame_chunk(VM* vm, CallFrame* frame)
+{
+    return frame->function == NULL ? vm->chunk : &frame->function->chunk;
+}
+
+/**
+ * Get the upvalue cell for a stack slot
+ *
+ * Closures capturing the same variable must share one cell, so
+ * an open upvalue for the slot is reused if there is one. The
+ * open upvalues are kept sorted from the top of the stack down,
+ * which lets the search stop early and makes closing cheap.
+ */
+static ObjUpvalue* upvalue_capture(VM* vm, Value* slot)
+{
+    ObjUpvalue* previous = NULL;
+    ObjUpvalue* upvalue = vm->open_upvalues;
+    while (upvalue != NULL && upvalue->location > slot)
+    {
+        previous = upvalue;
+        upvalue = upvalue->next;
+    }
+
+    if (upvalue != NULL && upvalue->location == slot) return upvalue;
+
+    ObjUpvalue* created = upvalue_new(vm, slot);
+    created->next = upvalue;
+    if (previous == NULL)
+    {
+        vm->open_upvalues = created;
+    }
+    else
+    {
+        previous->next = created;
+    }
+
+    return created;
+}
+
+/**
+ * Close every open upvalue at or above a stack slot
+ *
+ * Each variable's value moves off the stack into its cell.
+ */
+static void upvalues_close(VM* vm, Value* last)
+{
+    while (vm->open_upvalues != NULL && vm->open_upvalues->location >= last)
+    {
+        ObjUpvalue* upvalue = vm->open_upvalues;
+        upvalue->closed = *upvalue->location;
+        upvalue->location = &upvalue->closed;
+        vm->open_upvalues = upvalue->next;
+    }
+}
 
 /**
  * Push to the top of the virtual machine stack
  *
  * Appends a value to the top of the stack (where 
  * the `stack_top` pointer currently resides) and 
- * moves the stack top pointer up one index.
+ * moves the stack top pointer up one index. The
+ * stack is grown first if it is full.
+ *
+ * @return false if the stack is full at STACK_MAX, in which
+ * case nothing is pushed and the caller reports the overflow
  */
-void vm_stack_push(Value value)
+bool vm_stack_push(VM* vm, Value value)
 {
-    *vm.stack_top = value;
-    vm.stack_top++;
+    if (vm->stack_top == vm->stack + vm->stack_capacity && !vm_stack_grow(vm))
+    {
+        return false;
+    }
+
+    *vm->stack_top = value;
+    vm->stack_top++;
+    return true;
 }
 
 /**
@@ -46,28 +214,151 @@ void vm_stack_push(Value value)
  * Move the `stack_top` pointer back one step and
  * get the value at that location.
  */
-Value vm_stack_pop()
+Value vm_stack_pop(VM* vm)
 {
-    vm.stack_top--;
-    return *vm.stack_top;
+    vm->stack_top--;
+    return *vm->stack_top;
 }
 
+/**
+ * Report a runtime error
+ *
+ * The message is followed by a trace of the calls in progress,
+ * innermost first, each with the source line it had reached.
+ * Every frame's instruction pointer has already moved past the
+ * instruction that failed or made the call, hence the minus one.
+ * Of a deep stack, such as one that overflowed, only the frames
+ * at either end are shown and the rest are counted. The stack
+ * is reset since the script is aborted.
+ */
+static void runtime_error(VM* vm, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputs("\n", stderr);
+
+    int skipped = vm->frame_count - 2 * TRACE_FRAMES;
+    for (int i = vm->frame_count - 1; i >= 0; i--)
+    {
+        if (skipped > 1 && i == TRACE_FRAMES + skipped - 1)
+        {
+            fprintf(stderr, "...%d more frames...\n", skipped);
+            i = TRACE_FRAMES;
+            continue;
+        }
+
+        CallFrame* frame = &vm->frames[i];
+        Chunk* chunk = frame_chunk(vm, frame);
+        size_t instruction = frame->ip - chunk->code - 1;
+        int line = chunk_line_get(chunk, (int)instruction);
+        fprintf(stderr, "[line %d] in ", line);
+
+        ObjFunction* function = frame->function;
+        if (function == NULL)
+        {
+            fprintf(stderr, "script\n");
+        }
+        else if (function->name == NULL)
+        {
+            fprintf(stderr, "<fn>()\n");
+        }
+        else
+        {
+            fprintf(stderr, "%s()\n", function->name->chars);
+        }
+    }
+
+    vm_stack_reset(vm);
+}
+
+/**
+ * Check whether a value is falsey
+ *
+ * Only nil and false are falsey, every other
+ * value behaves like true in a condition.
+ */
+static bool is_falsey(Value value)
+{
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+#ifdef DEBUG_TRACE_EXECUTION
+/**
+ * Print the state of the virtual machine
+ *
+ * Shows the contents of the stack followed by the
+ * instruction that is about to be executed.
+ */
+static void execution_trace(VM* vm)
+{
+    printf("          ");
+    for (Value* slot = vm->stack; slot < vm->stack_top; slot++)
+    {
+        printf("[  ");
+        value_print(*slot);
+        printf(" ]");
+    }
+    printf("\n");
+    CallFrame* frame = &vm->frames[vm->frame_count - 1];
+    Chunk* chunk = frame_chunk(vm, frame);
+    instruction_disassemble(chunk, (int)(frame->ip - chunk->code));
+}
+#endif
+
 /*
  * Interpret the code
  *
- * @param chunk the chunk of memory
+ * @param vm the virtual machine to run the code on
+ * @param source the source code to interpret
+ *
+ * The source is compiled into a fresh chunk which is
+ * then handed to `vm_interpret_chunk`.
+ */
+InterpretResult vm_interpret(VM* vm, const char* source)
+{
+    Chunk chunk;
+    chunk_init(&chunk);
+
+    if (!compile(vm, source, &chunk))
+    {
+        chunk_free(&chunk);
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    InterpretResult result = vm_interpret_chunk(vm, &chunk);
+
+    chunk_free(&chunk);
+    return result;
+}
+
+/**
+ * Interpret an already compiled chunk
+ *
+ * @param vm the virtual machine to run the code on
+ * @param chunk the chunk of bytecode to run
  *
  * The virtual machine will make its way through
  * the bytecode, keeping track of where it is. We
  * keep track of the what instruction is being run
- * with `vm.ip`, a byte pointer commonly known as an
- * instruction pointer. This is also commonly referred
- * to as a program counter.
+ * with each frame's `ip`, a byte pointer commonly known
+ * as an instruction pointer. This is also commonly referred
+ * to as a program counter. The script runs in the first
+ * frame, with its locals at the bottom of the stack.
  */
-InterpretResult vm_interpret(const char* source)
+InterpretResult vm_interpret_chunk(VM* vm, Chunk* chunk)
 {
-    compile(source);
-    return INTERPRET_OK; 
+    vm->chunk = chunk;
+
+    CallFrame* frame = &vm->frames[0];
+    frame->function = NULL;
+    frame->closure = NULL;
+    frame->ip = chunk->code;
+    frame->slots = vm->stack_top;
+    vm->frame_count = 1;
+
+    return vm_run(vm);
 }
 
 /**
@@ -76,78 +367,534 @@ InterpretResult vm_interpret(const char* source)
  * The beating heart of Clox. This is where the
  * the code will spend 90% of its time. Loop continuously
  * reading and executing a single bytecode at a time.
+ *
+ * Each handler is introduced with `CASE` and finished with
+ * `DISPATCH`. In the portable build these are plain switch
+ * cases and `DISPATCH` goes back around the loop, so every
+ * instruction funnels through the one indirect branch of the
+ * switch. With `COMPUTED_GOTO` every handler also gets a label,
+ * and `DISPATCH` jumps straight from the end of one handler to
+ * the next through `dispatch_table`. Each handler then has its
+ * own indirect branch, which gives the branch predictor a much
+ * better chance of guessing the next opcode.
  */
-static InterpretResult vm_run()
+static InterpretResult vm_run(VM* vm)
 {
-    #define READ_BYTE() (*vm.ip++)
+    // The hot interpreter state lives in locals so the C compiler
+    // can keep it in registers. It is only written back to `vm`
+    // with STATE_STORE when something outside the loop needs it.
+    // The rest of the current frame is cached alongside it and
+    // reloaded whenever a call or return switches frames.
+    CallFrame* frame = &vm->frames[vm->frame_count - 1];
+    uint8_t* ip = frame->ip;
+    Value* stack_top = vm->stack_top;
+    Value* stack_end = vm->stack + vm->stack_capacity;
+    Value* constants = frame_chunk(vm, frame)->constants.values;
+    // Only the compiler adds global slots, so the array
+    // can't move while the chunk runs.
+    Value* globals = vm->globals.values;
+    // The stack slot of the frame's first local. It moves along
+    // with the stack when the stack grows.
+    Value* slots = frame->slots;
+    // The closure whose code is running, NULL for the script
+    // and for functions that capture nothing.
+    ObjClosure* closure = frame->closure;
+
+    #define STATE_STORE() \
+        do { \
+            frame->ip = ip; \
+            vm->stack_top = stack_top; \
+        } while (false)
+
+    #define READ_BYTE() (*ip++)
     // Read the next byte from bytecode, treat the resulting number as an
     // index, and look up the corresponding location in the chunk's constant table.
-    #define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
-    #define BINARY_OP(op) \
+    #define READ_CONSTANT() (constants[READ_BYTE()])
+    #define READ_CONSTANT_LONG() (constants[READ_LONG()])
+    #define READ_SHORT() (ip += 2, (uint16_t)(ip[-2] | (ip[-1] << 8)))
+    #define READ_LONG() (ip += 3, ip[-3] | (ip[-2] << 8) | (ip[-1] << 16))
+    // Only instructions that leave the stack taller than they
+    // found it push, so they are the only ones that can overflow.
+    #define PUSH(value) \
+        do { \
+            if (stack_top == stack_end) \
+            { \
+                STATE_STORE(); \
+                if (!vm_stack_grow(vm)) RUNTIME_ERROR("Stack overflow."); \
+                stack_top = vm->stack_top; \
+                stack_end = vm->stack + vm->stack_capacity; \
+                slots = frame->slots; \
+            } \
+            *stack_top++ = (value); \
+        } while (false)
+    #define POP() (*--stack_top)
+    #define PEEK(distance) (stack_top[-1 - (distance)])
+    #define RUNTIME_ERROR(...) \
+        do { \
+            STATE_STORE(); \
+            runtime_error(vm, __VA_ARGS__); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } while (false)
+    // Binary operators replace their left operand in place
+    // rather than popping both operands and pushing the result.
+    #define BINARY_OP(value_type, op) \
+        do { \
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) \
+            { \
+                RUNTIME_ERROR("Operands must be numbers."); \
+            } \
+            double b = AS_NUMBER(POP()); \
+            PEEK(0) = value_type(AS_NUMBER(PEEK(0)) op b); \
+        } while (false)
+    // Superinstructions take their right operand from the
+    // constant table instead of the stack.
+    #define BINARY_CONSTANT_OP(value_type, op) \
+        do { \
+            Value b = READ_CONSTANT(); \
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(b)) \
+            { \
+                RUNTIME_ERROR("Operands must be numbers."); \
+            } \
+            PEEK(0) = value_type(AS_NUMBER(PEEK(0)) op AS_NUMBER(b)); \
+        } while (false)
+
+    // Declares `function` and `target` for the value being called
+    // and checks that it can be called with `argc` arguments.
+    #define CALLEE_RESOLVE(argc) \
+        Value callee = PEEK(argc); \
+        ObjClosure* target = NULL; \
+        ObjFunction* function; \
+        if (IS_CLOSURE(callee)) \
+        { \
+            target = AS_CLOSURE(callee); \
+            function = target->function; \
+        } \
+        else if (IS_FUNCTION(callee)) \
+        { \
+            function = AS_FUNCTION(callee); \
+        } \
+        else \
+        { \
+            RUNTIME_ERROR("Can only call functions."); \
+        } \
+        if ((argc) != function->arity) \
+        { \
+            RUNTIME_ERROR("Expected %d arguments but got %d.", function->arity, (argc)); \
+        }
+    // A call pushes a frame whose window starts at the callee,
+    // so the arguments become the callee's first locals right
+    // where the caller pushed them, without being copied. In the
+    // OP_CALL_n handlers `argc` is a constant, which folds the
+    // address arithmetic.
+    #define CALL(argc) \
         do { \
-            double b = vm_stack_pop(); \
-            double a = vm_stack_pop(); \
-            vm_stack_push(a op b); \
+            CALLEE_RESOLVE(argc); \
+            if (vm->frame_count == FRAMES_MAX) RUNTIME_ERROR("Stack overflow."); \
+            frame->ip = ip; \
+            frame = &vm->frames[vm->frame_count++]; \
+            frame->function = function; \
+            frame->closure = target; \
+            frame->slots = stack_top - (argc) - 1; \
+            ip = function->chunk.code; \
+            constants = function->chunk.constants.values; \
+            slots = frame->slots; \
+            closure = target; \
         } while (false)
 
+    #ifdef DEBUG_TRACE_EXECUTION
+        #define TRACE() \
+            do { \
+                STATE_STORE(); \
+                execution_trace(vm); \
+            } while (false)
+    #else
+        #define TRACE() do {} while (false)
+    #endif
+
+    #ifdef COMPUTED_GOTO
+        static void* dispatch_table[] = {
+            [OP_CONSTANT]          = &&do_OP_CONSTANT,
+            [OP_CONSTANT_LONG]     = &&do_OP_CONSTANT_LONG,
+            [OP_NIL]               = &&do_OP_NIL,
+            [OP_TRUE]              = &&do_OP_TRUE,
+            [OP_FALSE]             = &&do_OP_FALSE,
+            [OP_EQUAL]             = &&do_OP_EQUAL,
+            [OP_GREATER]           = &&do_OP_GREATER,
+            [OP_LESS]              = &&do_OP_LESS,
+            [OP_ADD]               = &&do_OP_ADD,
+            [OP_SUBTRACT]          = &&do_OP_SUBTRACT,
+            [OP_MULTIPLY]          = &&do_OP_MULTIPLY,
+            [OP_DIVIDE]            = &&do_OP_DIVIDE,
+            [OP_ADD_CONSTANT]      = &&do_OP_ADD_CONSTANT,
+            [OP_SUBTRACT_CONSTANT] = &&do_OP_SUBTRACT_CONSTANT,
+            [OP_MULTIPLY_CONSTANT] = &&do_OP_MULTIPLY_CONSTANT,
+            [OP_DIVIDE_CONSTANT]   = &&do_OP_DIVIDE_CONSTANT,
+            [OP_NOT]               = &&do_OP_NOT,
+            [OP_NEGATE]            = &&do_OP_NEGATE,
+            [OP_PRINT]             = &&do_OP_PRINT,
+            [OP_POP]               = &&do_OP_POP,
+            [OP_POPN]              = &&do_OP_POPN,
+            [OP_GET_LOCAL]         = &&do_OP_GET_LOCAL,
+            [OP_GET_LOCAL_LONG]    = &&do_OP_GET_LOCAL_LONG,
+            [OP_SET_LOCAL]         = &&do_OP_SET_LOCAL,
+            [OP_SET_LOCAL_LONG]    = &&do_OP_SET_LOCAL_LONG,
+            [OP_DEFINE_GLOBAL]     = &&do_OP_DEFINE_GLOBAL,
+            [OP_GET_GLOBAL]        = &&do_OP_GET_GLOBAL,
+            [OP_SET_GLOBAL]        = &&do_OP_SET_GLOBAL,
+            [OP_GET_UPVALUE]       = &&do_OP_GET_UPVALUE,
+            [OP_SET_UPVALUE]       = &&do_OP_SET_UPVALUE,
+            [OP_CLOSURE]           = &&do_OP_CLOSURE,
+            [OP_CLOSE_UPVALUE]     = &&do_OP_CLOSE_UPVALUE,
+            [OP_CALL]              = &&do_OP_CALL,
+            [OP_CALL_0]            = &&do_OP_CALL_0,
+            [OP_CALL_1]            = &&do_OP_CALL_1,
+            [OP_CALL_2]            = &&do_OP_CALL_2,
+            [OP_CALL_3]            = &&do_OP_CALL_3,
+            [OP_TAIL_CALL]         = &&do_OP_TAIL_CALL,
+            [OP_RETURN]            = &&do_OP_RETURN,
+        };
+
+        #define CASE(op) case op: do_##op
+        #define DISPATCH() \
+            do { \
+                TRACE(); \
+                goto *dispatch_table[READ_BYTE()]; \
+            } while (false)
+    #else
+        #define CASE(op) case op
+        #define DISPATCH() continue
+    #endif
+
     for (;;)
     {
-        #ifdef DEBUG_TRACE_EXECUTION
-            printf("          ");
-            for (Value* slot = vm.stack; slot < vm.stack_top; slot++)
-            {
-                printf("[  ");
-                value_print(*slot);
-                printf(" ]");
-            }
-            printf("\n");
-            instruction_disassemble(vm.chunk, (int)(vm.ip - vm.chunk->code));
-        #endif
+        TRACE();
 
         uint8_t instruction;
         switch (instruction = READ_BYTE())
         {
-            case OP_CONSTANT:
+            CASE(OP_CONSTANT):
+            {
+                PUSH(READ_CONSTANT());
+                DISPATCH();
+            }
+            CASE(OP_CONSTANT_LONG):
+            {
+                PUSH(READ_CONSTANT_LONG());
+                DISPATCH();
+            }
+            CASE(OP_NIL):
+            {
+                PUSH(NIL_VAL);
+                DISPATCH();
+            }
+            CASE(OP_TRUE):
+            {
+                PUSH(BOOL_VAL(true));
+                DISPATCH();
+            }
+            CASE(OP_FALSE):
+            {
+                PUSH(BOOL_VAL(false));
+                DISPATCH();
+            }
+            CASE(OP_EQUAL):
+            {
+                Value b = POP();
+                PEEK(0) = BOOL_VAL(values_equal(PEEK(0), b));
+                DISPATCH();
+            }
+            CASE(OP_GREATER):
+            {
+                BINARY_OP(BOOL_VAL, >);
+                DISPATCH();
+            }
+            CASE(OP_LESS):
+            {
+                BINARY_OP(BOOL_VAL, <);
+                DISPATCH();
+            }
+            CASE(OP_ADD):
+            {
+                if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1)))
+                {
+                    ObjString* b = AS_STRING(POP());
+                    PEEK(0) = OBJ_VAL(string_concatenate(vm, AS_STRING(PEEK(0)), b));
+                }
+                else if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1)))
+                {
+                    double b = AS_NUMBER(POP());
+                    PEEK(0) = NUMBER_VAL(AS_NUMBER(PEEK(0)) + b);
+                }
+                else
+                {
+                    RUNTIME_ERROR("Operands must be two numbers or two strings.");
+                }
+                DISPATCH();
+            }
+            CASE(OP_SUBTRACT):
             {
-                Value constant = READ_CONSTANT();
-                vm_stack_push(constant);
-                break;
+                BINARY_OP(NUMBER_VAL, -);
+                DISPATCH();
             }
-            case OP_ADD:
+            CASE(OP_MULTIPLY):
             {
-                BINARY_OP(+);
-                break;
+                BINARY_OP(NUMBER_VAL, *);
+                DISPATCH();
             }
-            case OP_SUBTRACT:
+            CASE(OP_DIVIDE):
             {
-                BINARY_OP(-);
-                break;
+                BINARY_OP(NUMBER_VAL, /);
+                DISPATCH();
             }
-            case OP_MULTIPLY:
+            CASE(OP_ADD_CONSTANT):
             {
-                BINARY_OP(*);
-                break;
+                // Only number constants are fused, strings
+                // are concatenated by a plain OP_ADD.
+                Value b = READ_CONSTANT();
+                if (!IS_NUMBER(PEEK(0)))
+                {
+                    RUNTIME_ERROR("Operands must be two numbers or two strings.");
+                }
+                PEEK(0) = NUMBER_VAL(AS_NUMBER(PEEK(0)) + AS_NUMBER(b));
+                DISPATCH();
             }
-            case OP_DIVIDE:
+            CASE(OP_SUBTRACT_CONSTANT):
             {
-                BINARY_OP(/);
-                break;
+                BINARY_CONSTANT_OP(NUMBER_VAL, -);
+                DISPATCH();
             }
-            case OP_NEGATE:
+            CASE(OP_MULTIPLY_CONSTANT):
             {
-                vm_stack_push(-vm_stack_pop());
-                break;
+                BINARY_CONSTANT_OP(NUMBER_VAL, *);
+                DISPATCH();
             }
-            case OP_RETURN:
+            CASE(OP_DIVIDE_CONSTANT):
             {
-                value_print(vm_stack_pop());
+                BINARY_CONSTANT_OP(NUMBER_VAL, /);
+                DISPATCH();
+            }
+            CASE(OP_NOT):
+            {
+                PEEK(0) = BOOL_VAL(is_falsey(PEEK(0)));
+                DISPATCH();
+            }
+            CASE(OP_NEGATE):
+            {
+                if (!IS_NUMBER(PEEK(0)))
+                {
+                    RUNTIME_ERROR("Operand must be a number.");
+                }
+                PEEK(0) = NUMBER_VAL(-AS_NUMBER(PEEK(0)));
+                DISPATCH();
+            }
+            CASE(OP_PRINT):
+            {
+                value_print(POP());
                 printf("\n");
-                return INTERPRET_OK;
+                DISPATCH();
+            }
+            CASE(OP_POP):
+            {
+                stack_top--;
+                DISPATCH();
+            }
+            CASE(OP_POPN):
+            {
+                stack_top -= READ_BYTE();
+                DISPATCH();
+            }
+            // The value is read before pushing it, since a push
+            // that grows the stack moves the slots.
+            CASE(OP_GET_LOCAL):
+            {
+                Value value = slots[READ_BYTE()];
+                PUSH(value);
+                DISPATCH();
+            }
+            CASE(OP_GET_LOCAL_LONG):
+            {
+                Value value = slots[READ_SHORT()];
+                PUSH(value);
+                DISPATCH();
+            }
+            CASE(OP_SET_LOCAL):
+            {
+                slots[READ_BYTE()] = PEEK(0);
+                DISPATCH();
+            }
+            CASE(OP_SET_LOCAL_LONG):
+            {
+                slots[READ_SHORT()] = PEEK(0);
+                DISPATCH();
+            }
+            CASE(OP_DEFINE_GLOBAL):
+            {
+                uint16_t slot = READ_SHORT();
+                globals[slot] = POP();
+                DISPATCH();
+            }
+            // A slot is undefined until the definition of its global
+            // has run, so reads and writes check for that. This is the
+            // only check left, the lookup itself is an indexed load.
+            CASE(OP_GET_GLOBAL):
+            {
+                uint16_t slot = READ_SHORT();
+                Value value = globals[slot];
+                if (IS_UNDEFINED(value))
+                {
+                    RUNTIME_ERROR("Undefined variable '%s'.", AS_CSTRING(vm->global_names.values[slot]));
+                }
+                PUSH(value);
+                DISPATCH();
+            }
+            CASE(OP_SET_GLOBAL):
+            {
+                uint16_t slot = READ_SHORT();
+                if (IS_UNDEFINED(globals[slot]))
+                {
+                    RUNTIME_ERROR("Undefined variable '%s'.", AS_CSTRING(vm->global_names.values[slot]));
+                }
+                globals[slot] = PEEK(0);
+                DISPATCH();
+            }
+            // A capture is either the variable's value itself or,
+            // for variables that are assigned, the cell holding it.
+            // Script code never sees a cell, so telling them apart
+            // is a type check.
+            CASE(OP_GET_UPVALUE):
+            {
+                Value value = closure->upvalues[READ_BYTE()];
+                if (IS_UPVALUE(value)) value = *AS_UPVALUE(value)->location;
+                PUSH(value);
+                DISPATCH();
+            }
+            // Only variables captured by reference are assigned.
+            CASE(OP_SET_UPVALUE):
+            {
+                *AS_UPVALUE(closure->upvalues[READ_BYTE()])->location = PEEK(0);
+                DISPATCH();
+            }
+            CASE(OP_CLOSURE):
+            {
+                ObjFunction* function = AS_FUNCTION(constants[READ_LONG()]);
+                ObjClosure* created = closure_new(vm, function);
+                for (int i = 0; i < created->upvalue_count; i++)
+                {
+                    uint8_t kind = READ_BYTE();
+                    uint16_t index = READ_SHORT();
+                    switch (kind)
+                    {
+                        case CAPTURE_LOCAL:
+                            created->upvalues[i] = OBJ_VAL(upvalue_capture(vm, slots + index));
+                            break;
+                        case CAPTURE_LOCAL_VALUE:
+                            created->upvalues[i] = slots[index];
+                            break;
+                        default:
+                            created->upvalues[i] = closure->upvalues[index];
+                            break;
+                    }
+                }
+                PUSH(OBJ_VAL(created));
+                DISPATCH();
+            }
+            CASE(OP_CLOSE_UPVALUE):
+            {
+                upvalues_close(vm, stack_top - 1);
+                stack_top--;
+                DISPATCH();
+            }
+            CASE(OP_CALL):
+            {
+                int argc = READ_BYTE();
+                CALL(argc);
+                DISPATCH();
+            }
+            CASE(OP_CALL_0):
+            {
+                CALL(0);
+                DISPATCH();
+            }
+            CASE(OP_CALL_1):
+            {
+                CALL(1);
+                DISPATCH();
+            }
+            CASE(OP_CALL_2):
+            {
+                CALL(2);
+                DISPATCH();
+            }
+            CASE(OP_CALL_3):
+            {
+                CALL(3);
+                DISPATCH();
+            }
+            // A call whose result is returned as is reuses the caller's
+            // frame. The caller's variables that closures share are
+            // closed as on a return, then the callee and its arguments
+            // slide down to the start of the window. Nothing is left
+            // of the caller, so a chain of tail calls runs in constant
+            // frame and stack space.
+            CASE(OP_TAIL_CALL):
+            {
+                int argc = READ_BYTE();
+                CALLEE_RESOLVE(argc);
+                upvalues_close(vm, slots);
+                memmove(slots, stack_top - argc - 1, sizeof(Value) * (size_t)(argc + 1));
+                stack_top = slots + argc + 1;
+
+                frame->function = function;
+                frame->closure = target;
+                ip = function->chunk.code;
+                constants = function->chunk.constants.values;
+                closure = target;
+                DISPATCH();
+            }
+            // Returning drops the callee's whole window and leaves the
+            // result where the callee was. Variables of the window that
+            // closures share move into their cells first.
+            CASE(OP_RETURN):
+            {
+                // The script is the outermost frame and returns no value.
+                if (vm->frame_count == 1)
+                {
+                    STATE_STORE();
+                    vm->frame_count = 0;
+                    return INTERPRET_OK;
+                }
+
+                Value result = POP();
+                upvalues_close(vm, slots);
+                vm->frame_count--;
+                stack_top = slots;
+                *stack_top++ = result;
+
+                frame = &vm->frames[vm->frame_count - 1];
+                ip = frame->ip;
+                slots = frame->slots;
+                closure = frame->closure;
+                constants = frame_chunk(vm, frame)->constants.values;
+                DISPATCH();
             }
         }
     }
 
+    #undef STATE_STORE
     #undef READ_BYTE
     #undef READ_CONSTANT
+    #undef READ_CONSTANT_LONG
+    #undef READ_SHORT
+    #undef READ_LONG
+    #undef PUSH
+    #undef POP
+    #undef PEEK
+    #undef RUNTIME_ERROR
     #undef BINARY_OP
+    #undef BINARY_CONSTANT_OP
+    #undef CALLEE_RESOLVE
+    #undef CALL
+    #undef TRACE
+    #undef CASE
+    #undef DISPATCH
 }
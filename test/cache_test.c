@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_STAT
+#include <sys/stat.h>
+#endif
+
+#include "unity_fixture.h"
+
+#include "cache.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "object.h"
+#include "precompile.h"
+#include "vm.h"
+
+#define CACHE_PATH "cache_test.cloxc"
+
+static const char* cache_source =
+    "let greeting = \"hello\" + \" \" + \"world\";\n"
+    "fn adder(x) { return fn (y) { return x + y; }; }\n"
+    "fn counter() { let n = 0; fn next() { n = n + 1; return n; } return next; }\n"
+    "let count = counter();\n"
+    "count(); count();\n"
+    "let r = adder(40)(count());\n";
+
+static VM vm;
+
+static Value global_get(const char* name)
+{
+    int slot = vm_global_slot(&vm, string_copy(&vm, name, (int)strlen(name)));
+    return vm.globals.values[slot];
+}
+
+/**
+ * Compile the source and write its cache file
+ */
+static void cache_write(void)
+{
+    VM compiling;
+    vm_init(&compiling);
+    Chunk chunk;
+    chunk_init(&chunk);
+    TEST_ASSERT_TRUE(compile(&compiling, cache_source, &chunk));
+
+    size_t length = strlen(cache_source);
+    TEST_ASSERT_TRUE(cache_store(&compiling, CACHE_PATH, cache_hash(cache_source, length), length, &chunk));
+
+    chunk_free(&chunk);
+    vm_free(&compiling);
+}
+
+/**
+ * Load the cache file into the test's VM
+ */
+static bool cache_read(Chunk* chunk)
+{
+    size_t length = strlen(cache_source);
+    return cache_load(&vm, CACHE_PATH, cache_hash(cache_source, length), length, chunk);
+}
+
+static long file_read(uint8_t** bytes)
+{
+    FILE* file = fopen(CACHE_PATH, "rb");
+    TEST_ASSERT_NOT_NULL(file);
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    rewind(file);
+
+    *bytes = malloc((size_t)length);
+    TEST_ASSERT_EQUAL_INT(length, (long)fread(*bytes, 1, (size_t)length, file));
+    fclose(file);
+    return length;
+}
+
+static void file_write(const uint8_t* bytes, long length)
+{
+    FILE* file = fopen(CACHE_PATH, "wb");
+    TEST_ASSERT_NOT_NULL(file);
+    fwrite(bytes, 1, (size_t)length, file);
+    fclose(file);
+}
+
+TEST_GROUP(cache);
+
+TEST_SETUP(cache)
+{
+    vm_init(&vm);
+    cache_write();
+}
+
+TEST_TEAR_DOWN(cache)
+{
+    vm_free(&vm);
+    remove(CACHE_PATH);
+}
+
+TEST(cache, round_trip)
+{
+    Chunk chunk;
+    chunk_init(&chunk);
+    TEST_ASSERT_TRUE(cache_read(&chunk));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, vm_interpret_chunk(&vm, &chunk));
+
+    TEST_ASSERT_EQUAL_PTR(string_copy(&vm, "hello world", 11), AS_STRING(global_get("greeting")));
+    TEST_ASSERT_EQUAL_INT(43, (int)AS_NUMBER(global_get("r")));
+    chunk_free(&chunk);
+
+    // Storing again replaces the file.
+    cache_write();
+    chunk_init(&chunk);
+    TEST_ASSERT_TRUE(cache_read(&chunk));
+    chunk_free(&chunk);
+}
+
+TEST(cache, stale)
+{
+    size_t length = strlen(cache_source);
+    uint64_t hash = cache_hash(cache_source, length);
+
+    Chunk chunk;
+    chunk_init(&chunk);
+    TEST_ASSERT_FALSE(cache_load(&vm, CACHE_PATH, hash + 1, length, &chunk));
+    TEST_ASSERT_FALSE(cache_load(&vm, CACHE_PATH, hash, length + 1, &chunk));
+    TEST_ASSERT_FALSE(cache_load(&vm, "missing.cloxc", hash, length, &chunk));
+    TEST_ASSERT_EQUAL_INT(0, chunk.count);
+
+    // A file from another version is a miss too.
+    uint8_t* bytes;
+    long file_length = file_read(&bytes);
+    bytes[4]++;
+    file_write(bytes, file_length);
+    TEST_ASSERT_FALSE(cache_read(&chunk));
+    TEST_ASSERT_EQUAL_INT(0, chunk.count);
+    free(bytes);
+}
+
+TEST(cache, truncated)
+{
+    uint8_t* bytes;
+    long length = file_read(&bytes);
+
+    for (long cut = 0; cut < length; cut++)
+    {
+        file_write(bytes, cut);
+
+        Chunk chunk;
+        chunk_init(&chunk);
+        TEST_ASSERT_FALSE(cache_read(&chunk));
+        TEST_ASSERT_EQUAL_INT(0, chunk.count);
+    }
+
+    free(bytes);
+}
+
+/**
+ * Load the cache with every byte past the header corrupted
+ *
+ * Whatever loads must be safe to run, whatever it does. Run
+ * under a sanitizer this catches operands the loader lets
+ * through that the VM would use to read out of bounds.
+ */
+TEST(cache, corrupt)
+{
+    static const uint8_t replacements[] = { 0x00, 0x01, 0x02, 0x05, 0x7f, 0xff };
+
+    uint8_t* bytes;
+    long length = file_read(&bytes);
+    int rejected = 0;
+
+    for (long i = 24; i < length; i++)
+    {
+        for (size_t r = 0; r < sizeof(replacements); r++)
+        {
+            uint8_t original = bytes[i];
+            if (replacements[r] == original) continue;
+
+            bytes[i] = replacements[r];
+            file_write(bytes, length);
+            bytes[i] = original;
+
+            VM loading;
+            vm_init(&loading);
+            Chunk chunk;
+            chunk_init(&chunk);
+            if (cache_load(&loading, CACHE_PATH, cache_hash(cache_source, strlen(cache_source)),
+                    strlen(cache_source), &chunk))
+            {
+                vm_interpret_chunk(&loading, &chunk);
+            }
+            else
+            {
+                rejected++;
+            }
+            chunk_free(&chunk);
+            vm_free(&loading);
+        }
+    }
+
+    TEST_ASSERT_TRUE(rejected > 0);
+    free(bytes);
+}
+
+TEST_GROUP_RUNNER(cache)
+{
+    RUN_TEST_CASE(cache, round_trip);
+    RUN_TEST_CASE(cache, stale);
+    RUN_TEST_CASE(cache, truncated);
+    RUN_TEST_CASE(cache, corrupt);
+}
+
+#define SCRIPT_COUNT 12
+// The one script that doesn't compile.
+#define SCRIPT_BROKEN 5
+
+static char script_sources[SCRIPT_COUNT][128];
+static char script_paths[SCRIPT_COUNT][64];
+static char script_cache_paths[SCRIPT_COUNT][64];
+static const char* script_list[SCRIPT_COUNT];
+
+static void script_write(int i, const char* source)
+{
+    snprintf(script_sources[i], sizeof(script_sources[i]), "%s", source);
+    FILE* file = fopen(script_paths[i], "wb");
+    TEST_ASSERT_NOT_NULL(file);
+    fputs(source, file);
+    fclose(file);
+}
+
+/**
+ * Load a script's cache and run it
+ *
+ * @return whether the cache was there and current
+ */
+static bool script_cache_run(int i)
+{
+    size_t length = strlen(script_sources[i]);
+
+    Chunk chunk;
+    chunk_init(&chunk);
+    bool loaded = cache_load(&vm, script_cache_paths[i], cache_hash(script_sources[i], length), length, &chunk);
+    if (loaded) TEST_ASSERT_EQUAL_INT(INTERPRET_OK, vm_interpret_chunk(&vm, &chunk));
+
+    chunk_free(&chunk);
+    return loaded;
+}
+
+static void caches_remove(void)
+{
+    for (int i = 0; i < SCRIPT_COUNT; i++)
+    {
+        remove(script_cache_paths[i]);
+    }
+}
+
+TEST_GROUP(precompile);
+
+TEST_SETUP(precompile)
+{
+    vm_init(&vm);
+
+    char source[128];
+    for (int i = 0; i < SCRIPT_COUNT; i++)
+    {
+        snprintf(script_paths[i], sizeof(script_paths[i]), "precompile_test_%d.clox", i);
+        snprintf(script_cache_paths[i], sizeof(script_cache_paths[i]), "precompile_test_%d.cloxc", i);
+        script_list[i] = script_paths[i];
+
+        if (i == SCRIPT_BROKEN)
+        {
+            script_write(i, "let = ;\n");
+            continue;
+        }
+        snprintf(source, sizeof(source),
+            "let name = \"script %d\";\n"
+            "fn twice(n) { return n * 2; }\n"
+            "let result = twice(%d);\n", i, i);
+        script_write(i, source);
+    }
+}
+
+TEST_TEAR_DOWN(precompile)
+{
+    vm_free(&vm);
+    caches_remove();
+    for (int i = 0; i < SCRIPT_COUNT; i++)
+    {
+        remove(script_paths[i]);
+    }
+}
+
+TEST(precompile, threads)
+{
+    // One worker, a few, and more workers than scripts.
+    static const int threads[] = { 1, 4, SCRIPT_COUNT * 4 };
+
+    for (int t = 0; t < 3; t++)
+    {
+        caches_remove();
+        TEST_ASSERT_EQUAL_INT(1, precompile_files(script_list, SCRIPT_COUNT, threads[t]));
+
+        for (int i = 0; i < SCRIPT_COUNT; i++)
+        {
+            if (i == SCRIPT_BROKEN)
+            {
+                TEST_ASSERT_FALSE(script_cache_run(i));
+                continue;
+            }
+
+            TEST_ASSERT_TRUE(script_cache_run(i));
+            TEST_ASSERT_EQUAL_INT(2 * i, (int)AS_NUMBER(global_get("result")));
+        }
+    }
+}
+
+TEST(precompile, up_to_date)
+{
+    TEST_ASSERT_EQUAL_INT(1, precompile_files(script_list, SCRIPT_COUNT, 4));
+
+#ifdef HAVE_STAT
+    // Caches are replaced by renaming a new file over them, so
+    // one that was left alone keeps its inode.
+    ino_t inodes[SCRIPT_COUNT];
+    for (int i = 0; i < SCRIPT_COUNT; i++)
+    {
+        if (i == SCRIPT_BROKEN) continue;
+        struct stat status;
+        TEST_ASSERT_EQUAL_INT(0, stat(script_cache_paths[i], &status));
+        inodes[i] = status.st_ino;
+    }
+#endif
+
+    // Only the changed script is compiled again.
+    script_write(0, "let result = 42;\n");
+    TEST_ASSERT_EQUAL_INT(1, precompile_files(script_list, SCRIPT_COUNT, 4));
+
+#ifdef HAVE_STAT
+    for (int i = 1; i < SCRIPT_COUNT; i++)
+    {
+        if (i == SCRIPT_BROKEN) continue;
+        struct stat status;
+        TEST_ASSERT_EQUAL_INT(0, stat(script_cache_paths[i], &status));
+        TEST_ASSERT_TRUE(inodes[i] == status.st_ino);
+    }
+#endif
+
+    TEST_ASSERT_TRUE(script_cache_run(0));
+    TEST_ASSERT_EQUAL_INT(42, (int)AS_NUMBER(global_get("result")));
+}
+
+TEST_GROUP_RUNNER(precompile)
+{
+    RUN_TEST_CASE(precompile, threads);
+    RUN_TEST_CASE(precompile, up_to_date);
+}
+
+static void tests_run(void)
+{
+    RUN_TEST_GROUP(cache);
+    RUN_TEST_GROUP(precompile);
+}
+
+int main(int argc, const char* argv[])
+{
+    return UnityMain(argc, argv, tests_run);
+}
@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "unity_fixture.h"
+
+#include "chunk.h"
+#include "compiler.h"
+#include "object.h"
+#include "optimizer.h"
+#include "vm.h"
+
+/**
+ * Read the index of the constant loaded at an offset
+ */
+static int constant_operand(Chunk* chunk, int offset)
+{
+    if (chunk->code[offset] == OP_CONSTANT) return chunk->code[offset + 1];
+
+    TEST_ASSERT_EQUAL_INT(OP_CONSTANT_LONG, chunk->code[offset]);
+    return chunk->code[offset + 1] |
+        (chunk->code[offset + 2] << 8) |
+        (chunk->code[offset + 3] << 16);
+}
+
+TEST_GROUP(constants);
+
+TEST_SETUP(constants) {}
+
+TEST_TEAR_DOWN(constants) {}
+
+TEST(constants, long_operands)
+{
+    Chunk chunk;
+    chunk_init(&chunk);
+
+    int offset = 0;
+    for (int i = 0; i < 300; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(i, chunk_constant_write(&chunk, NUMBER_VAL(i), 1));
+        TEST_ASSERT_EQUAL_INT(i <= UINT8_MAX ? OP_CONSTANT : OP_CONSTANT_LONG, chunk.code[offset]);
+        TEST_ASSERT_EQUAL_INT(i, constant_operand(&chunk, offset));
+        offset = chunk.count;
+    }
+    TEST_ASSERT_EQUAL_INT(256 * 2 + 44 * 4, chunk.count);
+
+    chunk_free(&chunk);
+}
+
+TEST(constants, deduplicated)
+{
+    Chunk chunk;
+    chunk_init(&chunk);
+
+    for (int i = 0; i < 300; i++)
+    {
+        chunk_constant_add(&chunk, NUMBER_VAL(i));
+    }
+
+    // Loading a constant again reuses its index, with the
+    // short or long instruction that index needs.
+    TEST_ASSERT_EQUAL_INT(5, chunk_constant_write(&chunk, NUMBER_VAL(5), 1));
+    TEST_ASSERT_EQUAL_INT(OP_CONSTANT, chunk.code[0]);
+    TEST_ASSERT_EQUAL_INT(299, chunk_constant_write(&chunk, NUMBER_VAL(299), 1));
+    TEST_ASSERT_EQUAL_INT(OP_CONSTANT_LONG, chunk.code[2]);
+    TEST_ASSERT_EQUAL_INT(299, constant_operand(&chunk, 2));
+    TEST_ASSERT_EQUAL_INT(300, chunk.constants.count);
+
+    // Constants are told apart by representation, so -0 is not 0.
+    TEST_ASSERT_EQUAL_INT(300, chunk_constant_add(&chunk, NUMBER_VAL(-0.0)));
+    TEST_ASSERT_EQUAL_INT(300, chunk_constant_add(&chunk, NUMBER_VAL(-0.0)));
+    TEST_ASSERT_EQUAL_INT(0, chunk_constant_add(&chunk, NUMBER_VAL(0.0)));
+
+    // Dropped constants leave stale slots in the index, which
+    // must not be handed out again.
+    chunk.constants.count = 290;
+    TEST_ASSERT_EQUAL_INT(290, chunk_constant_add(&chunk, NUMBER_VAL(295)));
+    TEST_ASSERT_EQUAL_INT(291, chunk_constant_add(&chunk, NUMBER_VAL(1000)));
+    TEST_ASSERT_EQUAL_INT(290, chunk_constant_add(&chunk, NUMBER_VAL(295)));
+    TEST_ASSERT_EQUAL_INT(7, chunk_constant_add(&chunk, NUMBER_VAL(7)));
+
+    chunk_free(&chunk);
+}
+
+TEST(constants, run)
+{
+    // Enough distinct literals that the later ones are loaded
+    // with OP_CONSTANT_LONG, and one used twice.
+    static char source[16384];
+    char* cursor = source;
+    for (int i = 0; i < 300; i++)
+    {
+        cursor += sprintf(cursor, "let a%d = %d.5;\n", i, i);
+    }
+    sprintf(cursor, "let r = 299.5;\n");
+
+    VM vm;
+    vm_init(&vm);
+    Chunk chunk;
+    chunk_init(&chunk);
+    TEST_ASSERT_TRUE(compile(&vm, source, &chunk));
+    TEST_ASSERT_EQUAL_INT(300, chunk.constants.count);
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, vm_interpret_chunk(&vm, &chunk));
+
+    const char* names[] = { "a0", "a255", "a256", "a299", "r" };
+    const double values[] = { 0.5, 255.5, 256.5, 299.5, 299.5 };
+    for (int i = 0; i < 5; i++)
+    {
+        int slot = vm_global_slot(&vm, string_copy(&vm, names[i], (int)strlen(names[i])));
+        TEST_ASSERT_TRUE_MESSAGE(AS_NUMBER(vm.globals.values[slot]) == values[i], names[i]);
+    }
+
+    chunk_free(&chunk);
+    vm_free(&vm);
+}
+
+TEST_GROUP_RUNNER(constants)
+{
+    RUN_TEST_CASE(constants, long_operands);
+    RUN_TEST_CASE(constants, deduplicated);
+    RUN_TEST_CASE(constants, run);
+}
+
+TEST_GROUP(lines);
+
+TEST_SETUP(lines) {}
+
+TEST_TEAR_DOWN(lines) {}
+
+TEST(lines, runs)
+{
+    // Runs of every length from 1 to 20 bytes, on lines that
+    // skip about and come back to earlier ones.
+    Chunk chunk;
+    chunk_init(&chunk);
+
+    int expected[512];
+    int count = 0;
+    for (int run = 1; run <= 20; run++)
+    {
+        int line = (run * 7) % 11 + 1;
+        for (int i = 0; i < run; i++)
+        {
+            chunk_write(&chunk, OP_NIL, line);
+            expected[count++] = line;
+        }
+    }
+
+    TEST_ASSERT_EQUAL_INT(20, chunk.line_count);
+    for (int offset = 0; offset < count; offset++)
+    {
+        TEST_ASSERT_EQUAL_INT(expected[offset], chunk_line_get(&chunk, offset));
+    }
+
+    chunk_free(&chunk);
+}
+
+TEST(lines, repeated_line)
+{
+    // Writing on the same line extends a run rather than
+    // starting a new one, even across a constant.
+    Chunk chunk;
+    chunk_init(&chunk);
+    chunk_write(&chunk, OP_NIL, 3);
+    chunk_constant_write(&chunk, NUMBER_VAL(1), 3);
+    chunk_write(&chunk, OP_POP, 3);
+    chunk_write(&chunk, OP_NIL, 4);
+
+    TEST_ASSERT_EQUAL_INT(2, chunk.line_count);
+    TEST_ASSERT_EQUAL_INT(3, chunk_line_get(&chunk, 0));
+    TEST_ASSERT_EQUAL_INT(3, chunk_line_get(&chunk, 3));
+    TEST_ASSERT_EQUAL_INT(4, chunk_line_get(&chunk, 4));
+
+    chunk_free(&chunk);
+}
+
+TEST(lines, truncate)
+{
+    Chunk chunk;
+    chunk_init(&chunk);
+    for (int line = 1; line <= 10; line++)
+    {
+        chunk_write(&chunk, OP_NIL, line);
+        chunk_write(&chunk, OP_POP, line);
+    }
+
+    // Runs starting in the dropped code go, the run the cut
+    // falls in stays and is extended by the next write.
+    chunk_truncate(&chunk, 9);
+    TEST_ASSERT_EQUAL_INT(5, chunk.line_count);
+    TEST_ASSERT_EQUAL_INT(5, chunk_line_get(&chunk, 8));
+
+    chunk_write(&chunk, OP_POP, 5);
+    chunk_write(&chunk, OP_NIL, 42);
+    TEST_ASSERT_EQUAL_INT(6, chunk.line_count);
+    TEST_ASSERT_EQUAL_INT(5, chunk_line_get(&chunk, 9));
+    TEST_ASSERT_EQUAL_INT(42, chunk_line_get(&chunk, 10));
+    TEST_ASSERT_EQUAL_INT(1, chunk_line_get(&chunk, 0));
+
+    chunk_free(&chunk);
+}
+
+TEST_GROUP_RUNNER(lines)
+{
+    RUN_TEST_CASE(lines, runs);
+    RUN_TEST_CASE(lines, repeated_line);
+    RUN_TEST_CASE(lines, truncate);
+}
+
+TEST_GROUP(peephole);
+
+TEST_SETUP(peephole) {}
+
+TEST_TEAR_DOWN(peephole) {}
+
+TEST(peephole, fused)
+{
+    static const uint8_t operators[] = { OP_ADD, OP_SUBTRACT, OP_MULTIPLY, OP_DIVIDE };
+    static const uint8_t fused[] = {
+        OP_ADD_CONSTANT, OP_SUBTRACT_CONSTANT, OP_MULTIPLY_CONSTANT, OP_DIVIDE_CONSTANT
+    };
+
+    for (int i = 0; i < 4; i++)
+    {
+        Chunk chunk;
+        chunk_init(&chunk);
+        chunk_write(&chunk, OP_NIL, 1);
+        chunk_constant_write(&chunk, NUMBER_VAL(2), 1);
+        chunk_write(&chunk, operators[i], 2);
+        chunk_write(&chunk, OP_RETURN, 2);
+
+        chunk_optimize(&chunk);
+        TEST_ASSERT_EQUAL_INT(4, chunk.count);
+        TEST_ASSERT_EQUAL_INT(OP_NIL, chunk.code[0]);
+        TEST_ASSERT_EQUAL_INT(fused[i], chunk.code[1]);
+        TEST_ASSERT_EQUAL_INT(0, chunk.code[2]);
+        TEST_ASSERT_EQUAL_INT(OP_RETURN, chunk.code[3]);
+
+        // The fused instruction is on the operator's line.
+        TEST_ASSERT_EQUAL_INT(2, chunk.line_count);
+        TEST_ASSERT_EQUAL_INT(1, chunk_line_get(&chunk, 0));
+        TEST_ASSERT_EQUAL_INT(2, chunk_line_get(&chunk, 1));
+        TEST_ASSERT_EQUAL_INT(2, chunk_line_get(&chunk, 3));
+
+        chunk_free(&chunk);
+    }
+}
+
+TEST(peephole, not_fused)
+{
+    VM vm;
+    vm_init(&vm);
+    Chunk chunk;
+    chunk_init(&chunk);
+
+    // A string operand, an operator that has no fused form, and
+    // a constant that ends the chunk.
+    chunk_constant_write(&chunk, OBJ_VAL(string_copy(&vm, "s", 1)), 1);
+    chunk_write(&chunk, OP_ADD, 1);
+    chunk_constant_write(&chunk, NUMBER_VAL(2), 1);
+    chunk_write(&chunk, OP_EQUAL, 1);
+    chunk_constant_write(&chunk, NUMBER_VAL(3), 1);
+
+    uint8_t code[16];
+    int count = chunk.count;
+    memcpy(code, chunk.code, (size_t)count);
+
+    chunk_optimize(&chunk);
+    TEST_ASSERT_EQUAL_INT(count, chunk.count);
+    TEST_ASSERT_EQUAL_MEMORY(code, chunk.code, count);
+
+    chunk_free(&chunk);
+    vm_free(&vm);
+}
+
+TEST(peephole, closure_operands)
+{
+    VM vm;
+    vm_init(&vm);
+    Chunk chunk;
+    chunk_init(&chunk);
+
+    ObjFunction* function = function_new(&vm);
+    function->upvalue_count = 2;
+    chunk_constant_add(&chunk, NUMBER_VAL(2));
+    chunk_constant_add(&chunk, OBJ_VAL(function));
+
+    // The capture descriptors read like a constant and an add,
+    // which must be skipped over with the closure rather than
+    // fused. The pair after the closure is fused.
+    static const uint8_t code[] = {
+        OP_CLOSURE, 1, 0, 0,
+        OP_CONSTANT, 0, OP_ADD,
+        CAPTURE_UPVALUE, 0, 0,
+        OP_CONSTANT, 0, OP_MULTIPLY,
+        OP_RETURN,
+    };
+    for (size_t i = 0; i < sizeof(code); i++)
+    {
+        chunk_write(&chunk, code[i], 1);
+    }
+
+    chunk_optimize(&chunk);
+    TEST_ASSERT_EQUAL_INT(13, chunk.count);
+    TEST_ASSERT_EQUAL_MEMORY(code, chunk.code, 10);
+    TEST_ASSERT_EQUAL_INT(OP_MULTIPLY_CONSTANT, chunk.code[10]);
+    TEST_ASSERT_EQUAL_INT(0, chunk.code[11]);
+    TEST_ASSERT_EQUAL_INT(OP_RETURN, chunk.code[12]);
+
+    chunk_free(&chunk);
+    vm_free(&vm);
+}
+
+TEST(peephole, compiled)
+{
+    VM vm;
+    vm_init(&vm);
+    Chunk chunk;
+    chunk_init(&chunk);
+    TEST_ASSERT_TRUE(compile(&vm, "let x = 5;\nlet r = x * 3\n- 1;", &chunk));
+
+    int multiply = -1;
+    int subtract = -1;
+    for (int offset = 0; offset < chunk.count; offset++)
+    {
+        if (chunk.code[offset] == OP_MULTIPLY_CONSTANT) multiply = offset;
+        if (chunk.code[offset] == OP_SUBTRACT_CONSTANT) subtract = offset;
+    }
+    TEST_ASSERT_TRUE(multiply >= 0);
+    TEST_ASSERT_EQUAL_INT(multiply + 2, subtract);
+    TEST_ASSERT_EQUAL_INT(2, chunk_line_get(&chunk, multiply));
+    TEST_ASSERT_EQUAL_INT(3, chunk_line_get(&chunk, subtract));
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, vm_interpret_chunk(&vm, &chunk));
+    int slot = vm_global_slot(&vm, string_copy(&vm, "r", 1));
+    TEST_ASSERT_EQUAL_INT(14, (int)AS_NUMBER(vm.globals.values[slot]));
+
+    chunk_free(&chunk);
+    vm_free(&vm);
+}
+
+TEST_GROUP_RUNNER(peephole)
+{
+    RUN_TEST_CASE(peephole, fused);
+    RUN_TEST_CASE(peephole, not_fused);
+    RUN_TEST_CASE(peephole, closure_operands);
+    RUN_TEST_CASE(peephole, compiled);
+}
+
+static void tests_run(void)
+{
+    RUN_TEST_GROUP(constants);
+    RUN_TEST_GROUP(lines);
+    RUN_TEST_GROUP(peephole);
+}
+
+int main(int argc, const char* argv[])
+{
+    return UnityMain(argc, argv, tests_run);
+}
@@ -0,0 +1,141 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "unity_fixture.h"
+
+#include "chunk.h"
+#include "compiler.h"
+#include "object.h"
+#include "vm.h"
+
+static VM vm;
+
+static InterpretResult source_run(const char* source)
+{
+    Chunk chunk;
+    chunk_init(&chunk);
+    InterpretResult result = INTERPRET_COMPILE_ERROR;
+    if (compile(&vm, source, &chunk)) result = vm_interpret_chunk(&vm, &chunk);
+    chunk_free(&chunk);
+    return result;
+}
+
+static Value global_get(const char* name)
+{
+    int slot = vm_global_slot(&vm, string_copy(&vm, name, (int)strlen(name)));
+    return vm.globals.values[slot];
+}
+
+/**
+ * Check that two sources compile to the same bytecode
+ */
+static bool code_same(const char* a, const char* b)
+{
+    Chunk first;
+    Chunk second;
+    chunk_init(&first);
+    chunk_init(&second);
+    TEST_ASSERT_TRUE(compile(&vm, a, &first));
+    TEST_ASSERT_TRUE(compile(&vm, b, &second));
+
+    bool same = first.count == second.count &&
+        memcmp(first.code, second.code, (size_t)first.count) == 0;
+
+    chunk_free(&first);
+    chunk_free(&second);
+    return same;
+}
+
+TEST_GROUP(folding);
+
+TEST_SETUP(folding)
+{
+    vm_init(&vm);
+}
+
+TEST_TEAR_DOWN(folding)
+{
+    vm_free(&vm);
+}
+
+TEST(folding, literals)
+{
+    // The whole tree collapses into one constant, and the
+    // constants of the operands are dropped again.
+    Chunk chunk;
+    chunk_init(&chunk);
+    TEST_ASSERT_TRUE(compile(&vm, "let r = -1 * (2 + 3);", &chunk));
+    TEST_ASSERT_EQUAL_INT(OP_CONSTANT, chunk.code[0]);
+    TEST_ASSERT_EQUAL_INT(OP_DEFINE_GLOBAL, chunk.code[2]);
+    TEST_ASSERT_EQUAL_INT(1, chunk.constants.count);
+    TEST_ASSERT_EQUAL_INT(-5, (int)AS_NUMBER(chunk.constants.values[0]));
+    chunk_free(&chunk);
+
+    TEST_ASSERT_TRUE(code_same("let r = \"a\" + \"b\" == \"ab\";", "let r = true;"));
+    TEST_ASSERT_TRUE(code_same("let r = !(1 < 2);", "let r = false;"));
+
+    // Operations that fail at runtime are left for the runtime.
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, source_run("let r = 1 + nil;"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, source_run("let r = -\"a\";"));
+}
+
+TEST(folding, identities)
+{
+    TEST_ASSERT_TRUE(code_same("let x = 2; let a = (x - 1) * 1;", "let x = 2; let a = x - 1;"));
+    TEST_ASSERT_TRUE(code_same("let x = 2; let a = (x - 1) / 1;", "let x = 2; let a = x - 1;"));
+    TEST_ASSERT_TRUE(code_same("let x = 2; let a = (x - 1) - 0;", "let x = 2; let a = x - 1;"));
+    TEST_ASSERT_TRUE(code_same("let x = 2; let a = (x - 1) + -0;", "let x = 2; let a = x - 1;"));
+
+    // -0 + 0 is +0, so adding zero is not an identity.
+    TEST_ASSERT_FALSE(code_same("let x = 2; let a = (x - 1) + 0;", "let x = 2; let a = x - 1;"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run("let z = -0; let a = z * 1 + 0;"));
+    TEST_ASSERT_FALSE(signbit(AS_NUMBER(global_get("a"))));
+
+    // Without an arithmetic instruction the operand could be a
+    // string, which `* 1` has to reject at runtime.
+    TEST_ASSERT_FALSE(code_same("let x = 2; let a = x * 1;", "let x = 2; let a = x;"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, source_run("let s = \"s\"; let b = s * 1;"));
+}
+
+TEST(folding, nan_comparisons)
+{
+    // Folded comparisons with NaN must give what the
+    // instructions give at runtime.
+    static const char* operators[] = { "<", "<=", ">", ">=", "==", "!=" };
+    char source[256];
+
+    for (int i = 0; i < 6; i++)
+    {
+        snprintf(source, sizeof(source),
+            "let z = 0; let n = z / z;\n"
+            "let folded = 0 / 0 %s 1;\n"
+            "let run = n %s 1;\n"
+            "let folded_self = 0 / 0 %s 0 / 0;\n"
+            "let run_self = n %s n;\n",
+            operators[i], operators[i], operators[i], operators[i]);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(INTERPRET_OK, source_run(source), operators[i]);
+        TEST_ASSERT_EQUAL_MESSAGE(AS_BOOL(global_get("run")), AS_BOOL(global_get("folded")), operators[i]);
+        TEST_ASSERT_EQUAL_MESSAGE(AS_BOOL(global_get("run_self")), AS_BOOL(global_get("folded_self")), operators[i]);
+    }
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run("let r = 0 / 0 == 0 / 0;"));
+    TEST_ASSERT_FALSE(AS_BOOL(global_get("r")));
+}
+
+TEST_GROUP_RUNNER(folding)
+{
+    RUN_TEST_CASE(folding, literals);
+    RUN_TEST_CASE(folding, identities);
+    RUN_TEST_CASE(folding, nan_comparisons);
+}
+
+static void tests_run(void)
+{
+    RUN_TEST_GROUP(folding);
+}
+
+int main(int argc, const char* argv[])
+{
+    return UnityMain(argc, argv, tests_run);
+}
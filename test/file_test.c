@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <unistd.h>
+#endif
+
+#include "unity_fixture.h"
+
+#include "file.h"
+
+#define FILE_PATH "file_test.clox"
+
+static char contents[65536];
+
+/**
+ * Write `length` bytes of `contents` to the test file
+ */
+static void file_write(size_t length)
+{
+    FILE* stream = fopen(FILE_PATH, "wb");
+    TEST_ASSERT_NOT_NULL(stream);
+    TEST_ASSERT_EQUAL_INT((int)length, (int)fwrite(contents, 1, length, stream));
+    fclose(stream);
+}
+
+static size_t page_size(void)
+{
+#ifdef HAVE_MMAP
+    return (size_t)sysconf(_SC_PAGESIZE);
+#else
+    return 4096;
+#endif
+}
+
+TEST_GROUP(mapping);
+
+TEST_SETUP(mapping)
+{
+    for (size_t i = 0; i < sizeof(contents); i++)
+    {
+        contents[i] = (char)('a' + i % 26);
+    }
+}
+
+TEST_TEAR_DOWN(mapping)
+{
+    remove(FILE_PATH);
+}
+
+TEST(mapping, regular)
+{
+    file_write(100);
+
+    MappedFile file;
+    TEST_ASSERT_TRUE(file_map(FILE_PATH, &file));
+    TEST_ASSERT_EQUAL_INT(100, (int)file.length);
+    TEST_ASSERT_EQUAL_MEMORY(contents, file.data, 100);
+    TEST_ASSERT_EQUAL_INT('\0', file.data[100]);
+#ifdef HAVE_MMAP
+    TEST_ASSERT_EQUAL_INT(100, (int)file.mapped_length);
+#endif
+
+    file_unmap(&file);
+    TEST_ASSERT_NULL(file.data);
+    TEST_ASSERT_EQUAL_INT(0, (int)file.mapped_length);
+}
+
+TEST(mapping, empty)
+{
+    file_write(0);
+
+    // There is nothing to map, so the file is read.
+    MappedFile file;
+    TEST_ASSERT_TRUE(file_map(FILE_PATH, &file));
+    TEST_ASSERT_EQUAL_INT(0, (int)file.length);
+    TEST_ASSERT_EQUAL_INT(0, (int)file.mapped_length);
+    TEST_ASSERT_EQUAL_INT('\0', file.data[0]);
+    file_unmap(&file);
+}
+
+TEST(mapping, page_multiple)
+{
+    // A file that fills its last page has no zero byte after it
+    // in the mapping, so it has to be read instead.
+    size_t length = 2 * page_size();
+    TEST_ASSERT_TRUE(length <= sizeof(contents));
+    file_write(length);
+
+    MappedFile file;
+    TEST_ASSERT_TRUE(file_map(FILE_PATH, &file));
+    TEST_ASSERT_EQUAL_INT((int)length, (int)file.length);
+    TEST_ASSERT_EQUAL_INT(0, (int)file.mapped_length);
+    TEST_ASSERT_EQUAL_MEMORY(contents, file.data, length);
+    TEST_ASSERT_EQUAL_INT('\0', file.data[length]);
+    file_unmap(&file);
+
+    // One byte more and it is mapped again.
+    file_write(length + 1);
+    TEST_ASSERT_TRUE(file_map(FILE_PATH, &file));
+    TEST_ASSERT_EQUAL_INT((int)length + 1, (int)file.length);
+    TEST_ASSERT_EQUAL_INT('\0', file.data[length + 1]);
+#ifdef HAVE_MMAP
+    TEST_ASSERT_EQUAL_INT((int)length + 1, (int)file.mapped_length);
+#endif
+    file_unmap(&file);
+}
+
+TEST(mapping, missing)
+{
+    MappedFile file;
+    TEST_ASSERT_FALSE(file_map("file_test_missing.clox", &file));
+}
+
+TEST_GROUP_RUNNER(mapping)
+{
+    RUN_TEST_CASE(mapping, regular);
+    RUN_TEST_CASE(mapping, empty);
+    RUN_TEST_CASE(mapping, page_multiple);
+    RUN_TEST_CASE(mapping, missing);
+}
+
+static void tests_run(void)
+{
+    RUN_TEST_GROUP(mapping);
+}
+
+int main(int argc, const char* argv[])
+{
+    return UnityMain(argc, argv, tests_run);
+}
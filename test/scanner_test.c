@@ -0,0 +1,700 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#define HAVE_READ
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "unity_fixture.h"
+
+#include "scanner.h"
+#include "token.h"
+
+typedef struct
+{
+    const char* name;
+    TokenType type;
+} KeywordCase;
+
+static const KeywordCase keywords[] = {
+    { "and",    TOKEN_AND },
+    { "class",  TOKEN_CLASS },
+    { "else",   TOKEN_ELSE },
+    { "false",  TOKEN_FALSE },
+    { "fn",     TOKEN_FN },
+    { "for",    TOKEN_FOR },
+    { "if",     TOKEN_IF },
+    { "let",    TOKEN_LET },
+    { "nil",    TOKEN_NIL },
+    { "or",     TOKEN_OR },
+    { "print",  TOKEN_PRINT },
+    { "return", TOKEN_RETURN },
+    { "super",  TOKEN_SUPER },
+    { "this",   TOKEN_THIS },
+    { "true",   TOKEN_TRUE },
+    { "while",  TOKEN_WHILE },
+};
+
+#define KEYWORD_COUNT ((int)(sizeof(keywords) / sizeof(keywords[0])))
+
+/**
+ * The token type a word should scan as, by linear search
+ */
+static TokenType word_expected(const char* word)
+{
+    for (int i = 0; i < KEYWORD_COUNT; i++)
+    {
+        if (strcmp(keywords[i].name, word) == 0) return keywords[i].type;
+    }
+
+    return TOKEN_IDENTIFIER;
+}
+
+/**
+ * Scan a word on its own and check it is a single token
+ */
+static void word_check(const char* word)
+{
+    Scanner scanner;
+    scanner_init(&scanner, word);
+
+    Token token = token_scan(&scanner);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(word_expected(word), TOKEN_TYPE(token), word);
+    TEST_ASSERT_EQUAL_INT_MESSAGE((int)strlen(word), TOKEN_LENGTH(token), word);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(TOKEN_EOF, TOKEN_TYPE(token_scan(&scanner)), word);
+}
+
+TEST_GROUP(scanner);
+
+TEST_SETUP(scanner) {}
+
+TEST_TEAR_DOWN(scanner) {}
+
+TEST(scanner, keywords)
+{
+    for (int i = 0; i < KEYWORD_COUNT; i++)
+    {
+        word_check(keywords[i].name);
+    }
+}
+
+/**
+ * Prefixes, extensions and changed case of every keyword
+ */
+TEST(scanner, keyword_near_misses)
+{
+    char word[16];
+
+    for (int i = 0; i < KEYWORD_COUNT; i++)
+    {
+        const char* name = keywords[i].name;
+        int length = (int)strlen(name);
+
+        for (int prefix = 1; prefix < length; prefix++)
+        {
+            snprintf(word, sizeof(word), "%.*s", prefix, name);
+            word_check(word);
+        }
+
+        snprintf(word, sizeof(word), "%ss", name);
+        word_check(word);
+        snprintf(word, sizeof(word), "_%s", name);
+        word_check(word);
+        snprintf(word, sizeof(word), "%s1", name);
+        word_check(word);
+
+        snprintf(word, sizeof(word), "%s", name);
+        word[0] = (char)(word[0] - 'a' + 'A');
+        word_check(word);
+    }
+}
+
+/**
+ * Every keyword with any one character replaced
+ *
+ * This covers the words that share a keyword's length and
+ * first and last characters, which hash to its slot.
+ */
+TEST(scanner, keyword_substitutions)
+{
+    const char* alphabet = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
+    char word[16];
+
+    for (int i = 0; i < KEYWORD_COUNT; i++)
+    {
+        int length = (int)strlen(keywords[i].name);
+
+        for (int position = 0; position < length; position++)
+        {
+            for (const char* c = alphabet; *c != '\0'; c++)
+            {
+                if (position == 0 && *c >= '0' && *c <= '9') continue;
+
+                strcpy(word, keywords[i].name);
+                word[position] = *c;
+                word_check(word);
+            }
+        }
+    }
+}
+
+/**
+ * Every lowercase word of up to three letters
+ */
+TEST(scanner, short_words)
+{
+    char word[4];
+
+    for (int length = 1; length <= 3; length++)
+    {
+        int total = 1;
+        for (int i = 0; i < length; i++) total *= 26;
+
+        for (int n = 0; n < total; n++)
+        {
+            int rest = n;
+            for (int i = 0; i < length; i++)
+            {
+                word[i] = (char)('a' + rest % 26);
+                rest /= 26;
+            }
+            word[length] = '\0';
+            word_check(word);
+        }
+    }
+}
+
+TEST(scanner, keywords_in_context)
+{
+    Scanner scanner;
+    scanner_init(&scanner, "for(fn){false}\nelse");
+
+    TEST_ASSERT_EQUAL_INT(TOKEN_FOR, TOKEN_TYPE(token_scan(&scanner)));
+    TEST_ASSERT_EQUAL_INT(TOKEN_LEFT_PAREN, TOKEN_TYPE(token_scan(&scanner)));
+    TEST_ASSERT_EQUAL_INT(TOKEN_FN, TOKEN_TYPE(token_scan(&scanner)));
+    TEST_ASSERT_EQUAL_INT(TOKEN_RIGHT_PAREN, TOKEN_TYPE(token_scan(&scanner)));
+    TEST_ASSERT_EQUAL_INT(TOKEN_LEFT_BRACE, TOKEN_TYPE(token_scan(&scanner)));
+    TEST_ASSERT_EQUAL_INT(TOKEN_FALSE, TOKEN_TYPE(token_scan(&scanner)));
+    TEST_ASSERT_EQUAL_INT(TOKEN_RIGHT_BRACE, TOKEN_TYPE(token_scan(&scanner)));
+
+    Token token = token_scan(&scanner);
+    TEST_ASSERT_EQUAL_INT(TOKEN_ELSE, TOKEN_TYPE(token));
+    TEST_ASSERT_EQUAL_INT(2, token.line);
+}
+
+TEST_GROUP_RUNNER(scanner)
+{
+    RUN_TEST_CASE(scanner, keywords);
+    RUN_TEST_CASE(scanner, keyword_near_misses);
+    RUN_TEST_CASE(scanner, keyword_substitutions);
+    RUN_TEST_CASE(scanner, short_words);
+    RUN_TEST_CASE(scanner, keywords_in_context);
+}
+
+typedef enum
+{
+    RUN_BLANKS,
+    RUN_COMMENT,
+    RUN_STRING,
+} RunKind;
+
+/**
+ * Append a run of bytes the scanner skips a block at a time
+ *
+ * @param length the number of bytes between the delimiters
+ * @return the number of newlines in the run
+ *
+ * Blanks mix all four blank characters. Comments end in a
+ * newline unless `open`, and strings end in a quote unless
+ * `open`. Their bodies hold the bytes that end other runs.
+ */
+static int run_append(char** cursor, RunKind kind, int length, bool open)
+{
+    static const char* comment_bytes = "c \"/\t*";
+    static const char* string_bytes = "s\n /\t\r";
+    int newlines = 0;
+
+    if (kind == RUN_COMMENT) { *(*cursor)++ = '/'; *(*cursor)++ = '/'; }
+    if (kind == RUN_STRING) *(*cursor)++ = '"';
+
+    for (int i = 0; i < length; i++)
+    {
+        char c;
+        switch (kind)
+        {
+            case RUN_BLANKS:
+                c = i % 7 == 3 ? '\n' : i % 5 == 1 ? '\t' : i % 11 == 0 ? '\r' : ' ';
+                break;
+            case RUN_COMMENT:
+                c = comment_bytes[i % 5];
+                break;
+            default:
+                c = string_bytes[i % 6];
+                break;
+        }
+        if (c == '\n') newlines++;
+        *(*cursor)++ = c;
+    }
+
+    if (!open && kind == RUN_COMMENT) { *(*cursor)++ = '\n'; newlines++; }
+    if (!open && kind == RUN_STRING) *(*cursor)++ = '"';
+    **cursor = '\0';
+    return newlines;
+}
+
+/**
+ * Check the tokens of `x <run> y` and of `x <run>` at the end
+ *
+ * Whichever way the scanner was built, scalar, SSE2 or AVX2,
+ * the tokens and lines follow from how the source was put
+ * together.
+ */
+static void run_check(char* source, RunKind kind, int length)
+{
+    for (int open = 0; open <= 1; open++)
+    {
+        char* cursor = source;
+        *cursor++ = 'x';
+        *cursor++ = ' ';
+        int run_start = (int)(cursor - source);
+        int line = 1 + run_append(&cursor, kind, length, open);
+        int run_end = (int)(cursor - source);
+        if (!open)
+        {
+            *cursor++ = ' ';
+            *cursor++ = 'y';
+            *cursor = '\0';
+        }
+
+        Scanner scanner;
+        scanner_init(&scanner, source);
+
+        Token token = token_scan(&scanner);
+        TEST_ASSERT_EQUAL_INT(TOKEN_IDENTIFIER, TOKEN_TYPE(token));
+        TEST_ASSERT_EQUAL_INT(1, token.line);
+
+        if (kind == RUN_STRING)
+        {
+            token = token_scan(&scanner);
+            TEST_ASSERT_EQUAL_INT(open ? TOKEN_ERROR : TOKEN_STRING, TOKEN_TYPE(token));
+            TEST_ASSERT_EQUAL_INT(line, token.line);
+            if (!open)
+            {
+                TEST_ASSERT_EQUAL_UINT32(run_start, token.offset);
+                TEST_ASSERT_EQUAL_INT(run_end - run_start, TOKEN_LENGTH(token));
+            }
+        }
+
+        if (!open)
+        {
+            token = token_scan(&scanner);
+            TEST_ASSERT_EQUAL_INT(TOKEN_IDENTIFIER, TOKEN_TYPE(token));
+            TEST_ASSERT_EQUAL_UINT32(run_end + 1, token.offset);
+            TEST_ASSERT_EQUAL_INT(line, token.line);
+        }
+
+        token = token_scan(&scanner);
+        TEST_ASSERT_EQUAL_INT(TOKEN_EOF, TOKEN_TYPE(token));
+        TEST_ASSERT_EQUAL_INT(line, token.line);
+    }
+}
+
+TEST_GROUP(blocks);
+
+TEST_SETUP(blocks) {}
+
+TEST_TEAR_DOWN(blocks) {}
+
+/**
+ * Runs of every length up to a few blocks, starting at every
+ * offset within a 64 byte line
+ *
+ * Each run is split between whole blocks and the byte-at-a-time
+ * tail in every way, and the open runs stop at the terminating
+ * NUL in every position of a block. The bytes around the source
+ * are newlines, which must not be read.
+ */
+TEST(blocks, boundaries)
+{
+    static char storage[512 + 64];
+    char* aligned = (char*)(((uintptr_t)storage + 63) & ~(uintptr_t)63);
+
+    for (int kind = RUN_BLANKS; kind <= RUN_STRING; kind++)
+    {
+        for (int start = 0; start < 64; start++)
+        {
+            for (int length = 1; length <= 100; length++)
+            {
+                // Newlines in front of the source and after its
+                // end must not be read.
+                memset(storage, '\n', sizeof(storage));
+                run_check(aligned + start, (RunKind)kind, length);
+            }
+        }
+    }
+}
+
+#ifdef HAVE_MMAP
+/**
+ * Scan sources that end right before an unreadable page
+ *
+ * The vector loads must stop at the terminating NUL, which in
+ * a mapped file can be the last byte before an unmapped page.
+ */
+TEST(blocks, page_end)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    char* pages = mmap(NULL, page * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    TEST_ASSERT_TRUE(pages != MAP_FAILED);
+    TEST_ASSERT_EQUAL_INT(0, mprotect(pages + page, page, PROT_NONE));
+
+    static char source[256];
+    for (int kind = RUN_BLANKS; kind <= RUN_STRING; kind++)
+    {
+        for (int length = 1; length <= 100; length++)
+        {
+            char* cursor = source;
+            *cursor++ = 'x';
+            run_append(&cursor, (RunKind)kind, length, true);
+            size_t size = (size_t)(cursor - source) + 1;
+
+            char* copy = pages + page - size;
+            memcpy(copy, source, size);
+
+            Scanner scanner;
+            scanner_init(&scanner, copy);
+            while (TOKEN_TYPE(token_scan(&scanner)) != TOKEN_EOF) {}
+        }
+    }
+
+    munmap(pages, page * 2);
+}
+#endif
+
+TEST_GROUP_RUNNER(blocks)
+{
+    RUN_TEST_CASE(blocks, boundaries);
+#ifdef HAVE_MMAP
+    RUN_TEST_CASE(blocks, page_end);
+#endif
+}
+
+static const char* stream_source =
+    "let total = 0; // running sum\n"
+    "while (total < 100) { total = total + 1.5; print \"step\"; }\n"
+    "fn add(a, b) { return a + b; } @ class Point { }\n";
+
+static bool tokens_equal(Token a, Token b)
+{
+    return a.offset == b.offset && a.line == b.line && a.type_length == b.type_length;
+}
+
+/**
+ * Check a stream against the plain scanner
+ *
+ * The source is repeated until it is several rings long, and
+ * every position is compared at every lookahead distance.
+ */
+static void stream_check(bool batch)
+{
+    char source[4096];
+    source[0] = '\0';
+    while (strlen(source) + strlen(stream_source) < sizeof(source))
+    {
+        strcat(source, stream_source);
+    }
+
+    static Token expected[2048];
+    int count = 0;
+    Scanner scanner;
+    scanner_init(&scanner, source);
+    do
+    {
+        expected[count] = token_scan(&scanner);
+    } while (TOKEN_TYPE(expected[count++]) != TOKEN_EOF);
+    TEST_ASSERT_TRUE(count > 4 * TOKEN_RING_SIZE);
+
+    TokenStream stream;
+    token_stream_init(&stream, source, batch);
+
+    for (int i = 0; i < count; i++)
+    {
+        for (int distance = 0; distance <= TOKEN_LOOKAHEAD_MAX; distance += 7)
+        {
+            int index = i + distance < count ? i + distance : count - 1;
+            TEST_ASSERT_TRUE(tokens_equal(expected[index], token_peek(&stream, distance)));
+        }
+
+        TEST_ASSERT_TRUE(tokens_equal(expected[i], token_next(&stream)));
+    }
+
+    // The stream stays at EOF.
+    TEST_ASSERT_EQUAL_INT(TOKEN_EOF, TOKEN_TYPE(token_next(&stream)));
+    TEST_ASSERT_EQUAL_INT(TOKEN_EOF, TOKEN_TYPE(token_peek(&stream, TOKEN_LOOKAHEAD_MAX)));
+
+    token_stream_free(&stream);
+}
+
+TEST_GROUP(token_stream);
+
+TEST_SETUP(token_stream) {}
+
+TEST_TEAR_DOWN(token_stream) {}
+
+TEST(token_stream, compact)
+{
+    TEST_ASSERT_EQUAL_INT(12, (int)sizeof(Token));
+}
+
+TEST(token_stream, ring)
+{
+    stream_check(false);
+}
+
+TEST(token_stream, batch)
+{
+    stream_check(true);
+}
+
+/**
+ * Stream a source several read blocks long from a file
+ *
+ * Tokens straddle the block boundaries, which must not
+ * change a thing compared to scanning the source in memory.
+ */
+/**
+ * Check that streaming a source scans the same as scanning it in memory
+ *
+ * @param descriptor read the file through its descriptor
+ * @return the most source text the stream held at once
+ */
+static size_t source_stream_check(const char* source, size_t length, bool descriptor)
+{
+    FILE* file = tmpfile();
+    TEST_ASSERT_NOT_NULL(file);
+    fwrite(source, 1, length, file);
+    fflush(file);
+    rewind(file);
+
+    Scanner expected;
+    Scanner streamed;
+    scanner_init(&expected, source);
+#ifdef HAVE_READ
+    if (descriptor)
+    {
+        scanner_init_fd(&streamed, fileno(file));
+    }
+    else
+#endif
+    {
+        scanner_init_file(&streamed, file);
+    }
+
+    size_t window_max = 0;
+    Token a;
+    do
+    {
+        a = token_scan(&expected);
+        Token b = token_scan(&streamed);
+
+        TEST_ASSERT_EQUAL_UINT32(a.type_length, b.type_length);
+        TEST_ASSERT_EQUAL_INT(a.line, b.line);
+        if (TOKEN_TYPE(a) != TOKEN_ERROR && TOKEN_TYPE(a) != TOKEN_EOF)
+        {
+            TEST_ASSERT_EQUAL_MEMORY(token_lexeme(&expected, a),
+                token_lexeme(&streamed, b), TOKEN_LENGTH(a));
+        }
+
+        // The sources have no NULs, so the window ends at the first.
+        size_t window = strlen(streamed.source);
+        if (window > window_max) window_max = window;
+    } while (TOKEN_TYPE(a) != TOKEN_EOF);
+
+    scanner_free(&streamed);
+    fclose(file);
+    return window_max;
+}
+
+/**
+ * Fill a buffer with copies of a piece of source
+ *
+ * @return the length filled, with the last copy ending short
+ *         of the end of the buffer
+ */
+static size_t source_repeat(char* source, size_t size, const char* piece)
+{
+    size_t length = 0;
+    size_t piece_length = strlen(piece);
+    while (length + piece_length < size)
+    {
+        memcpy(source + length, piece, piece_length);
+        length += piece_length;
+    }
+    source[length] = '\0';
+    return length;
+}
+
+TEST(token_stream, file)
+{
+    static char source[SCAN_BLOCK_SIZE * 3 + 100];
+    size_t length = source_repeat(source, sizeof(source), stream_source);
+    source_stream_check(source, length, false);
+
+    // The same through the file descriptor.
+    source_stream_check(source, length, true);
+
+    // With the whole stream token_stream sees the same tokens.
+    FILE* file = tmpfile();
+    TEST_ASSERT_NOT_NULL(file);
+    fwrite(source, 1, length, file);
+    rewind(file);
+
+    TokenStream expected;
+    TokenStream streamed;
+    token_stream_init(&expected, source, false);
+    token_stream_init_file(&streamed, file);
+
+    Token a;
+    do
+    {
+        a = token_next(&expected);
+        Token b = token_next(&streamed);
+        TEST_ASSERT_EQUAL_UINT32(a.type_length, b.type_length);
+        TEST_ASSERT_EQUAL_INT(a.line, b.line);
+    } while (TOKEN_TYPE(a) != TOKEN_EOF);
+
+    token_stream_free(&expected);
+    token_stream_free(&streamed);
+    fclose(file);
+}
+
+TEST(token_stream, file_long_runs)
+{
+    // Runs of comments and blanks many blocks long, each ending
+    // in a token. Their text is dropped as it is skipped, so the
+    // window never holds more than about two blocks.
+    static char source[SCAN_BLOCK_SIZE * 8];
+    static const char* runs[] = { "//c\n", "  \t\r\n", "// a comment\n \n" };
+
+    for (int i = 0; i < 3; i++)
+    {
+        size_t length = source_repeat(source, sizeof(source) - 8, runs[i]);
+        strcpy(source + length, "x = 1;");
+        length += 6;
+
+        TEST_ASSERT_TRUE(source_stream_check(source, length, false) <= 2 * SCAN_BLOCK_SIZE);
+        TEST_ASSERT_TRUE(source_stream_check(source, length, true) <= 2 * SCAN_BLOCK_SIZE);
+    }
+
+    // A string longer than a block is held whole, and then some.
+    size_t length = 0;
+    source[length++] = 'a';
+    source[length++] = '"';
+    for (int i = 0; i < SCAN_BLOCK_SIZE * 3; i++)
+    {
+        source[length++] = i % 80 == 79 ? '\n' : 's';
+    }
+    strcpy(source + length, "\" b // the end");
+    length += strlen(source + length);
+
+    TEST_ASSERT_TRUE(source_stream_check(source, length, false) > SCAN_BLOCK_SIZE * 3);
+    source_stream_check(source, length, true);
+
+    // Unterminated, it runs to the end of the input.
+    length = 2 + SCAN_BLOCK_SIZE * 3;
+    source[length] = '\0';
+    source_stream_check(source, length, false);
+}
+
+/**
+ * Lex in pieces, with strings running across piece boundaries
+ *
+ * Every piece count must give exactly the tokens, offsets
+ * and lines of a sequential scan.
+ */
+TEST(token_stream, parallel)
+{
+    static const char* parts[] = {
+        "let a = 1;\n", "\"multi\nline\n\"\n", "// \"not a string\n",
+        "\" \n let b = \"\n", "print x; \"\n\n\n\" + 2\n", "\n",
+    };
+    static char source[8192];
+    size_t length = 0;
+    for (int i = 0; length + 32 < sizeof(source); i = (i * 7 + 3) % 6)
+    {
+        size_t part_length = strlen(parts[i]);
+        memcpy(source + length, parts[i], part_length);
+        length += part_length;
+    }
+    // Leave a string open until the end.
+    source[length++] = '"';
+    source[length] = '\0';
+
+    TokenStream expected;
+    token_stream_init(&expected, source, true);
+
+    for (int pieces = 1; pieces <= 64; pieces++)
+    {
+        TokenStream lexed;
+        token_stream_init_parallel(&lexed, source, length, pieces);
+
+        TEST_ASSERT_EQUAL_UINT32(expected.scanned, lexed.scanned);
+        for (uint32_t i = 0; i < expected.scanned; i++)
+        {
+            TEST_ASSERT_TRUE(tokens_equal(expected.tokens[i], lexed.tokens[i]));
+        }
+
+        token_stream_free(&lexed);
+    }
+
+    token_stream_free(&expected);
+}
+
+TEST(token_stream, error_messages)
+{
+    Scanner scanner;
+    scanner_init(&scanner, "@ \"open");
+
+    Token token = token_scan(&scanner);
+    TEST_ASSERT_EQUAL_INT(TOKEN_ERROR, TOKEN_TYPE(token));
+    TEST_ASSERT_EQUAL_STRING("Unexpected character.", token_error_message(token));
+
+    token = token_scan(&scanner);
+    TEST_ASSERT_EQUAL_INT(TOKEN_ERROR, TOKEN_TYPE(token));
+    TEST_ASSERT_EQUAL_STRING("Unterminated string.", token_error_message(token));
+}
+
+TEST_GROUP_RUNNER(token_stream)
+{
+    RUN_TEST_CASE(token_stream, compact);
+    RUN_TEST_CASE(token_stream, ring);
+    RUN_TEST_CASE(token_stream, batch);
+    RUN_TEST_CASE(token_stream, file);
+    RUN_TEST_CASE(token_stream, file_long_runs);
+    RUN_TEST_CASE(token_stream, parallel);
+    RUN_TEST_CASE(token_stream, error_messages);
+}
+
+static void tests_run(void)
+{
+    RUN_TEST_GROUP(scanner);
+    RUN_TEST_GROUP(blocks);
+    RUN_TEST_GROUP(token_stream);
+}
+
+int main(int argc, const char* argv[])
+{
+#if defined(__AVX2__) && defined(__GNUC__)
+    // The AVX2 build of these tests can only run on a CPU with AVX2.
+    if (!__builtin_cpu_supports("avx2"))
+    {
+        printf("No AVX2 on this CPU, skipping.\n");
+        return 0;
+    }
+#endif
+    return UnityMain(argc, argv, tests_run);
+}
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "unity_fixture.h"
+
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+static VM vm;
+
+TEST_GROUP(strings);
+
+TEST_SETUP(strings)
+{
+    vm_init(&vm);
+}
+
+TEST_TEAR_DOWN(strings)
+{
+    vm_free(&vm);
+}
+
+TEST(strings, interned)
+{
+    ObjString* a = string_copy(&vm, "hello world", 5);
+    ObjString* b = string_copy(&vm, "hello", 5);
+    TEST_ASSERT_EQUAL_PTR(a, b);
+    TEST_ASSERT_EQUAL_STRING("hello", a->chars);
+    TEST_ASSERT_EQUAL_UINT32(string_hash("hello", 5), a->hash);
+
+    TEST_ASSERT_NOT_EQUAL(a, string_copy(&vm, "hell", 4));
+    TEST_ASSERT_TRUE(values_equal(OBJ_VAL(a), OBJ_VAL(b)));
+}
+
+TEST(strings, concatenate)
+{
+    ObjString* hello = string_copy(&vm, "hello ", 6);
+    ObjString* world = string_copy(&vm, "world", 5);
+    ObjString* joined = string_concatenate(&vm, hello, world);
+
+    TEST_ASSERT_EQUAL_STRING("hello world", joined->chars);
+    TEST_ASSERT_EQUAL_INT(11, joined->length);
+    TEST_ASSERT_EQUAL_UINT32(string_hash("hello world", 11), joined->hash);
+    TEST_ASSERT_EQUAL_PTR(joined, string_copy(&vm, "hello world", 11));
+    TEST_ASSERT_EQUAL_PTR(joined, string_concatenate(&vm, hello, world));
+
+    ObjString* empty = string_copy(&vm, "", 0);
+    TEST_ASSERT_EQUAL_PTR(world, string_concatenate(&vm, empty, world));
+}
+
+TEST(strings, table)
+{
+    Table table;
+    table_init(&table);
+
+    ObjString* keys[100];
+    char name[16];
+    for (int i = 0; i < 100; i++)
+    {
+        int length = snprintf(name, sizeof(name), "key%d", i);
+        keys[i] = string_copy(&vm, name, length);
+        TEST_ASSERT_TRUE(table_set(&table, keys[i], NUMBER_VAL(i)));
+    }
+
+    TEST_ASSERT_FALSE(table_set(&table, keys[7], NUMBER_VAL(-7)));
+
+    for (int i = 0; i < 100; i += 2)
+    {
+        TEST_ASSERT_TRUE(table_delete(&table, keys[i]));
+    }
+    TEST_ASSERT_FALSE(table_delete(&table, keys[0]));
+
+    // Deletes shift the entries after them back, which must
+    // not cut the remaining keys off from their home slots.
+    for (int i = 0; i < 100; i++)
+    {
+        Value value;
+        bool found = table_get(&table, keys[i], &value);
+        TEST_ASSERT_EQUAL(i % 2 == 1, found);
+        if (found) TEST_ASSERT_EQUAL_INT(i == 7 ? -7 : i, (int)AS_NUMBER(value));
+    }
+
+    TEST_ASSERT_TRUE(table_set(&table, keys[0], NIL_VAL));
+    TEST_ASSERT_EQUAL_PTR(keys[3], table_find_string(&table, "key3", 4, string_hash("key3", 4)));
+    TEST_ASSERT_NULL(table_find_string(&table, "key2", 4, string_hash("key2", 4)));
+
+    table_free(&table);
+}
+
+TEST(strings, table_collisions)
+{
+    // More keys share a hash than an entry's distance byte can
+    // count, so some distances have to be worked out from hashes.
+    enum { KEYS = 600 };
+    ObjString* keys[KEYS];
+    for (int i = 0; i < KEYS; i++)
+    {
+        keys[i] = calloc(1, sizeof(ObjString));
+        keys[i]->hash = i % 3 == 0 ? 1 : 17;
+    }
+
+    Table table;
+    table_init(&table);
+    for (int i = 0; i < KEYS; i++)
+    {
+        TEST_ASSERT_TRUE(table_set(&table, keys[i], NUMBER_VAL(i)));
+    }
+
+    for (int i = 0; i < KEYS; i += 5)
+    {
+        TEST_ASSERT_TRUE(table_delete(&table, keys[i]));
+    }
+    TEST_ASSERT_EQUAL_INT(KEYS - KEYS / 5, table.count);
+
+    for (int i = 0; i < KEYS; i++)
+    {
+        Value value;
+        bool found = table_get(&table, keys[i], &value);
+        TEST_ASSERT_EQUAL(i % 5 != 0, found);
+        if (found) TEST_ASSERT_EQUAL_INT(i, (int)AS_NUMBER(value));
+    }
+
+    Table copy;
+    table_init(&copy);
+    table_add_all(&table, &copy);
+    TEST_ASSERT_EQUAL_INT(table.count, copy.count);
+    TEST_ASSERT_FALSE(table_set(&copy, keys[KEYS - 1], NIL_VAL));
+
+    table_free(&copy);
+    table_free(&table);
+    for (int i = 0; i < KEYS; i++) free(keys[i]);
+}
+
+TEST_GROUP_RUNNER(strings)
+{
+    RUN_TEST_CASE(strings, interned);
+    RUN_TEST_CASE(strings, concatenate);
+    RUN_TEST_CASE(strings, table);
+    RUN_TEST_CASE(strings, table_collisions);
+}
+
+static void tests_run(void)
+{
+    RUN_TEST_GROUP(strings);
+}
+
+int main(int argc, const char* argv[])
+{
+    return UnityMain(argc, argv, tests_run);
+}
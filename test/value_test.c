@@ -0,0 +1,181 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "unity_fixture.h"
+
+#include "object.h"
+#include "value.h"
+
+static Obj object_static;
+
+/**
+ * Box a number and check it comes back as the same bits
+ */
+static void number_round_trip(double number)
+{
+    Value value = NUMBER_VAL(number);
+    TEST_ASSERT_TRUE(IS_NUMBER(value));
+    TEST_ASSERT_FALSE(IS_OBJ(value));
+    TEST_ASSERT_FALSE(IS_NIL(value));
+    TEST_ASSERT_FALSE(IS_BOOL(value));
+    TEST_ASSERT_FALSE(IS_UNDEFINED(value));
+
+    double unboxed = AS_NUMBER(value);
+    TEST_ASSERT_EQUAL_MEMORY(&number, &unboxed, sizeof(double));
+}
+
+static void object_round_trip(Obj* object)
+{
+    Value value = OBJ_VAL(object);
+    TEST_ASSERT_TRUE(IS_OBJ(value));
+    TEST_ASSERT_FALSE(IS_NUMBER(value));
+    TEST_ASSERT_FALSE(IS_NIL(value));
+    TEST_ASSERT_FALSE(IS_BOOL(value));
+    TEST_ASSERT_EQUAL_PTR(object, AS_OBJ(value));
+}
+
+TEST_GROUP(encoding);
+
+TEST_SETUP(encoding)
+{
+}
+
+TEST_TEAR_DOWN(encoding)
+{
+}
+
+TEST(encoding, size)
+{
+#ifdef NAN_BOXING
+    TEST_ASSERT_EQUAL_INT(sizeof(double), sizeof(Value));
+#else
+    TEST_ASSERT_TRUE(sizeof(Value) > sizeof(double));
+#endif
+}
+
+TEST(encoding, numbers)
+{
+    number_round_trip(0.0);
+    number_round_trip(-0.0);
+    number_round_trip(1.5);
+    number_round_trip(-1e308);
+    number_round_trip(INFINITY);
+    number_round_trip(-INFINITY);
+    number_round_trip(NAN);
+    number_round_trip(-NAN);
+
+    // The NaN arithmetic makes, whose sign depends on the hardware.
+    volatile double zero = 0.0;
+    number_round_trip(zero / zero);
+
+    TEST_ASSERT_TRUE(signbit(AS_NUMBER(NUMBER_VAL(-0.0))));
+    TEST_ASSERT_FALSE(signbit(AS_NUMBER(NUMBER_VAL(0.0))));
+    TEST_ASSERT_TRUE(isinf(AS_NUMBER(NUMBER_VAL(-INFINITY))));
+    TEST_ASSERT_TRUE(isnan(AS_NUMBER(NUMBER_VAL(NAN))));
+}
+
+TEST(encoding, objects)
+{
+    // Objects in static storage, on the stack and on the heap
+    // sit at quite different addresses.
+    Obj object_local;
+    Obj* object_heap = malloc(sizeof(Obj));
+    TEST_ASSERT_NOT_NULL(object_heap);
+
+    object_round_trip(&object_static);
+    object_round_trip(&object_local);
+    object_round_trip(object_heap);
+
+    free(object_heap);
+}
+
+TEST(encoding, singletons)
+{
+    TEST_ASSERT_TRUE(IS_NIL(NIL_VAL));
+    TEST_ASSERT_FALSE(IS_NUMBER(NIL_VAL));
+    TEST_ASSERT_TRUE(IS_BOOL(BOOL_VAL(true)));
+    TEST_ASSERT_TRUE(IS_BOOL(BOOL_VAL(false)));
+    TEST_ASSERT_TRUE(AS_BOOL(BOOL_VAL(true)));
+    TEST_ASSERT_FALSE(AS_BOOL(BOOL_VAL(false)));
+    TEST_ASSERT_FALSE(IS_BOOL(NIL_VAL));
+    TEST_ASSERT_TRUE(IS_UNDEFINED(UNDEFINED_VAL));
+    TEST_ASSERT_FALSE(IS_NIL(UNDEFINED_VAL));
+    TEST_ASSERT_FALSE(IS_OBJ(NIL_VAL));
+    TEST_ASSERT_FALSE(IS_OBJ(BOOL_VAL(true)));
+}
+
+TEST_GROUP_RUNNER(encoding)
+{
+    RUN_TEST_CASE(encoding, size);
+    RUN_TEST_CASE(encoding, numbers);
+    RUN_TEST_CASE(encoding, objects);
+    RUN_TEST_CASE(encoding, singletons);
+}
+
+TEST_GROUP(equality);
+
+TEST_SETUP(equality)
+{
+}
+
+TEST_TEAR_DOWN(equality)
+{
+}
+
+TEST(equality, numbers)
+{
+    Value nan = NUMBER_VAL(NAN);
+    Value zero = NUMBER_VAL(0.0);
+    Value zero_negative = NUMBER_VAL(-0.0);
+
+    // Equality follows IEEE 754...
+    TEST_ASSERT_FALSE(values_equal(nan, nan));
+    TEST_ASSERT_TRUE(values_equal(zero, zero_negative));
+    TEST_ASSERT_TRUE(values_equal(NUMBER_VAL(INFINITY), NUMBER_VAL(INFINITY)));
+    TEST_ASSERT_FALSE(values_equal(NUMBER_VAL(INFINITY), NUMBER_VAL(-INFINITY)));
+
+    // ...while identity compares the bits.
+    TEST_ASSERT_TRUE(values_identical(nan, nan));
+    TEST_ASSERT_FALSE(values_identical(zero, zero_negative));
+    TEST_ASSERT_TRUE(values_identical(zero_negative, zero_negative));
+    TEST_ASSERT_TRUE(values_identical(NUMBER_VAL(1.5), NUMBER_VAL(1.5)));
+    TEST_ASSERT_FALSE(values_identical(NUMBER_VAL(1.5), NUMBER_VAL(2.5)));
+}
+
+TEST(equality, types)
+{
+    Obj other;
+    Value values[] = {
+        NUMBER_VAL(0.0), NUMBER_VAL(1.0), NIL_VAL, BOOL_VAL(false), BOOL_VAL(true),
+        OBJ_VAL(&object_static), OBJ_VAL(&other),
+    };
+    int count = (int)(sizeof(values) / sizeof(values[0]));
+
+    // Everywhere else the two agree: a value only equals itself.
+    for (int i = 0; i < count; i++)
+    {
+        for (int j = 0; j < count; j++)
+        {
+            TEST_ASSERT_EQUAL_INT(i == j, values_equal(values[i], values[j]));
+            TEST_ASSERT_EQUAL_INT(i == j, values_identical(values[i], values[j]));
+        }
+    }
+}
+
+TEST_GROUP_RUNNER(equality)
+{
+    RUN_TEST_CASE(equality, numbers);
+    RUN_TEST_CASE(equality, types);
+}
+
+static void tests_run(void)
+{
+    RUN_TEST_GROUP(encoding);
+    RUN_TEST_GROUP(equality);
+}
+
+int main(int argc, const char* argv[])
+{
+    return UnityMain(argc, argv, tests_run);
+}
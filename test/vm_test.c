@@ -0,0 +1,549 @@
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#include "unity_fixture.h"
+
+#include "compiler.h"
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+// Built with a small STACK_MAX, see CMakeLists.txt.
+
+static VM vm;
+
+static InterpretResult source_run_on(VM* target, const char* source)
+{
+    Chunk chunk;
+    chunk_init(&chunk);
+    InterpretResult result = INTERPRET_COMPILE_ERROR;
+    if (compile(target, source, &chunk)) result = vm_interpret_chunk(target, &chunk);
+    chunk_free(&chunk);
+    return result;
+}
+
+static InterpretResult source_run(const char* source)
+{
+    return source_run_on(&vm, source);
+}
+
+static Value global_get(const char* name)
+{
+    int slot = vm_global_slot(&vm, string_copy(&vm, name, (int)strlen(name)));
+    return vm.globals.values[slot];
+}
+
+// Look a global up without interning its name or giving it a slot.
+static bool global_find(VM* target, const char* name, Value* value)
+{
+    int length = (int)strlen(name);
+    ObjString* key = table_find_string(&target->strings, name, length, string_hash(name, length));
+    Value slot;
+    if (key == NULL || !table_get(&target->global_slots, key, &slot)) return false;
+    *value = target->globals.values[(int)AS_NUMBER(slot)];
+    return true;
+}
+
+static bool string_interned(VM* target, const char* chars)
+{
+    int length = (int)strlen(chars);
+    return table_find_string(&target->strings, chars, length, string_hash(chars, length)) != NULL;
+}
+
+TEST_GROUP(stack);
+
+TEST_SETUP(stack)
+{
+    vm_init(&vm);
+}
+
+TEST_TEAR_DOWN(stack)
+{
+    vm_free(&vm);
+}
+
+TEST(stack, push_to_max)
+{
+    TEST_ASSERT_EQUAL_INT(STACK_INITIAL, vm.stack_capacity);
+    for (int i = 0; i < STACK_MAX; i++)
+    {
+        TEST_ASSERT_TRUE(vm_stack_push(&vm, NUMBER_VAL(i)));
+    }
+    TEST_ASSERT_EQUAL_INT(STACK_MAX, vm.stack_capacity);
+
+    // A full stack refuses the push and is left as it was.
+    TEST_ASSERT_FALSE(vm_stack_push(&vm, NIL_VAL));
+    TEST_ASSERT_EQUAL_INT(STACK_MAX, (int)(vm.stack_top - vm.stack));
+    TEST_ASSERT_EQUAL_INT(STACK_MAX - 1, (int)AS_NUMBER(vm_stack_pop(&vm)));
+
+    // Values survive the stack moving as it grows.
+    for (int i = STACK_MAX - 2; i >= 0; i -= 511)
+    {
+        TEST_ASSERT_EQUAL_INT(i, (int)AS_NUMBER(vm.stack[i]));
+    }
+}
+
+TEST(stack, script_grows)
+{
+    // More locals than the initial stack holds, but within the
+    // limit.
+    char source[16384];
+    char* cursor = source;
+    cursor += sprintf(cursor, "let r; {");
+    for (int i = 0; i < 1000; i++)
+    {
+        cursor += sprintf(cursor, " let v%d = %d;", i, i);
+    }
+    sprintf(cursor, " r = v999 + v0; }");
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run(source));
+    TEST_ASSERT_EQUAL_INT(999, (int)AS_NUMBER(global_get("r")));
+    TEST_ASSERT_EQUAL_PTR(vm.stack, vm.stack_top);
+}
+
+TEST(stack, script_overflows)
+{
+    // Each call holds a hundred locals, so the stack runs out
+    // long before the frames do.
+    char source[16384];
+    char* cursor = source;
+    cursor += sprintf(cursor, "fn f() {");
+    for (int i = 0; i < 100; i++)
+    {
+        cursor += sprintf(cursor, " let v%d = %d;", i, i);
+    }
+    sprintf(cursor, " return f() + 1; }\nf();");
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, source_run(source));
+    TEST_ASSERT_EQUAL_INT(STACK_MAX, vm.stack_capacity);
+    TEST_ASSERT_EQUAL_INT(0, vm.frame_count);
+    TEST_ASSERT_EQUAL_PTR(vm.stack, vm.stack_top);
+
+    // The VM can run again after the error.
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run("let ok = 1;"));
+}
+
+TEST_GROUP_RUNNER(stack)
+{
+    RUN_TEST_CASE(stack, push_to_max);
+    RUN_TEST_CASE(stack, script_grows);
+    RUN_TEST_CASE(stack, script_overflows);
+}
+
+TEST_GROUP(variables);
+
+TEST_SETUP(variables)
+{
+    vm_init(&vm);
+}
+
+TEST_TEAR_DOWN(variables)
+{
+    vm_free(&vm);
+}
+
+TEST(variables, slots)
+{
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run("let a = 1; let b = a + 2; a = b * 2;"));
+    TEST_ASSERT_EQUAL_INT(2, vm.globals.count);
+    TEST_ASSERT_EQUAL_INT(6, (int)AS_NUMBER(global_get("a")));
+    TEST_ASSERT_EQUAL_INT(3, (int)AS_NUMBER(global_get("b")));
+
+    // Later chunks for the same VM see the same slots.
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run("let c = a - b; let s = \"x\" + \"y\";"));
+    TEST_ASSERT_EQUAL_INT(3, (int)AS_NUMBER(global_get("c")));
+    TEST_ASSERT_EQUAL_PTR(string_copy(&vm, "xy", 2), AS_STRING(global_get("s")));
+}
+
+TEST(variables, undefined)
+{
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, source_run("let a = b;"));
+    TEST_ASSERT_TRUE(IS_UNDEFINED(global_get("a")));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, source_run("b = 1;"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run("let b; let a = b;"));
+    TEST_ASSERT_TRUE(IS_NIL(global_get("a")));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_COMPILE_ERROR, source_run("a + b = 1;"));
+}
+
+TEST(variables, locals)
+{
+    const char* source =
+        "let r;\n"
+        "{\n"
+        "    let a = 1;\n"
+        "    { let a = 2; let b = a * 10; r = b; }\n"
+        "    a = a + r;\n"
+        "    r = a;\n"
+        "}\n";
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run(source));
+    TEST_ASSERT_EQUAL_INT(21, (int)AS_NUMBER(global_get("r")));
+    TEST_ASSERT_EQUAL_INT(1, vm.globals.count);
+    TEST_ASSERT_EQUAL_PTR(vm.stack, vm.stack_top);
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_COMPILE_ERROR, source_run("{ let a = 1; let a = 2; }"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_COMPILE_ERROR, source_run("{ let a = a; }"));
+}
+
+TEST(variables, many_locals)
+{
+    // Enough locals for the long forms of the instructions and
+    // a stack that has to grow under them.
+    char source[16384];
+    char* cursor = source;
+    cursor += sprintf(cursor, "let r; {");
+    for (int i = 0; i < 600; i++)
+    {
+        cursor += sprintf(cursor, " let v%d = %d;", i, i);
+    }
+    sprintf(cursor, " v599 = v1 + v300; r = v599 + v255 + v256; }");
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run(source));
+    TEST_ASSERT_EQUAL_INT(301 + 255 + 256, (int)AS_NUMBER(global_get("r")));
+    TEST_ASSERT_EQUAL_PTR(vm.stack, vm.stack_top);
+}
+
+TEST_GROUP_RUNNER(variables)
+{
+    RUN_TEST_CASE(variables, slots);
+    RUN_TEST_CASE(variables, undefined);
+    RUN_TEST_CASE(variables, locals);
+    RUN_TEST_CASE(variables, many_locals);
+}
+
+TEST_GROUP(closures);
+
+TEST_SETUP(closures)
+{
+    vm_init(&vm);
+}
+
+TEST_TEAR_DOWN(closures)
+{
+    vm_free(&vm);
+}
+
+TEST(closures, capture_nothing)
+{
+    const char* source =
+        "fn f(a, b) { return a + b; }\n"
+        "let g;\n"
+        "{ let x = 1; g = fn () { let y = 2; return y; }; }\n";
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run(source));
+    TEST_ASSERT_TRUE(IS_FUNCTION(global_get("f")));
+    TEST_ASSERT_EQUAL_INT(2, AS_FUNCTION(global_get("f"))->arity);
+    TEST_ASSERT_TRUE(IS_FUNCTION(global_get("g")));
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_COMPILE_ERROR, source_run("return 1;"));
+}
+
+TEST(closures, copies)
+{
+    // Neither variable is ever assigned, so both are copied,
+    // the outer one through the closure in between.
+    const char* source =
+        "let f;\n"
+        "{\n"
+        "    let x = 1;\n"
+        "    let y = \"y\";\n"
+        "    f = fn () { return fn () { return x; }; };\n"
+        "    fn g() { return y; }\n"
+        "}\n";
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run(source));
+
+    ObjClosure* f = AS_CLOSURE(global_get("f"));
+    TEST_ASSERT_EQUAL_INT(1, f->upvalue_count);
+    TEST_ASSERT_EQUAL_INT(1, (int)AS_NUMBER(f->upvalues[0]));
+    TEST_ASSERT_NULL(vm.open_upvalues);
+    TEST_ASSERT_EQUAL_PTR(vm.stack, vm.stack_top);
+}
+
+TEST(closures, cells)
+{
+    // `x` is assigned after it is captured, so both closures share
+    // one cell. The locals in between grow the stack while the
+    // cell is open.
+    char source[16384];
+    char* cursor = source;
+    cursor += sprintf(cursor, "let f; let g; { let x = 1; f = fn () { return x; }; g = fn () { x = 3; };");
+    for (int i = 0; i < 600; i++)
+    {
+        cursor += sprintf(cursor, " let v%d = %d;", i, i);
+    }
+    sprintf(cursor, " x = v599; }");
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run(source));
+
+    ObjClosure* f = AS_CLOSURE(global_get("f"));
+    ObjClosure* g = AS_CLOSURE(global_get("g"));
+    TEST_ASSERT_TRUE(IS_UPVALUE(f->upvalues[0]));
+    TEST_ASSERT_EQUAL_PTR(AS_OBJ(f->upvalues[0]), AS_OBJ(g->upvalues[0]));
+
+    ObjUpvalue* cell = AS_UPVALUE(f->upvalues[0]);
+    TEST_ASSERT_EQUAL_PTR(&cell->closed, cell->location);
+    TEST_ASSERT_EQUAL_INT(599, (int)AS_NUMBER(cell->closed));
+    TEST_ASSERT_NULL(vm.open_upvalues);
+    TEST_ASSERT_EQUAL_PTR(vm.stack, vm.stack_top);
+}
+
+TEST_GROUP_RUNNER(closures)
+{
+    RUN_TEST_CASE(closures, capture_nothing);
+    RUN_TEST_CASE(closures, copies);
+    RUN_TEST_CASE(closures, cells);
+}
+
+TEST_GROUP(calls);
+
+TEST_SETUP(calls)
+{
+    vm_init(&vm);
+}
+
+TEST_TEAR_DOWN(calls)
+{
+    vm_free(&vm);
+}
+
+TEST(calls, arguments)
+{
+    const char* source =
+        "fn add(a, b) { let c = a + b; return c; }\n"
+        "fn five(a, b, c, d, e) { return a - b + c - d + e; }\n"
+        "fn none() {}\n"
+        "let r = add(1, add(2, 3)) * five(1, 2, 3, 4, 5);\n"
+        "let n = none();\n";
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run(source));
+    TEST_ASSERT_EQUAL_INT(18, (int)AS_NUMBER(global_get("r")));
+    TEST_ASSERT_TRUE(IS_NIL(global_get("n")));
+    TEST_ASSERT_EQUAL_INT(0, vm.frame_count);
+    TEST_ASSERT_EQUAL_PTR(vm.stack, vm.stack_top);
+}
+
+TEST(calls, closures)
+{
+    const char* source =
+        "fn counter() {\n"
+        "    let n = 0;\n"
+        "    fn next() { n = n + 1; return n; }\n"
+        "    return next;\n"
+        "}\n"
+        "fn adder(x) { return fn (y) { return x + y; }; }\n"
+        "let a = counter();\n"
+        "let b = counter();\n"
+        "a(); a(); b();\n"
+        "let r = a() * 10 + b() + adder(100)(5);\n";
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run(source));
+    TEST_ASSERT_EQUAL_INT(30 + 2 + 105, (int)AS_NUMBER(global_get("r")));
+    TEST_ASSERT_NULL(vm.open_upvalues);
+}
+
+TEST(calls, stack_grows)
+{
+    // The callee's locals grow the stack under the frames of
+    // both calls and an open upvalue.
+    char source[16384];
+    char* cursor = source;
+    cursor += sprintf(cursor, "fn f(x) { fn get() { return x; } x = 1; {");
+    for (int i = 0; i < 600; i++)
+    {
+        cursor += sprintf(cursor, " let v%d = %d;", i, i);
+    }
+    sprintf(cursor, " x = x + v599; } return get(); }\nlet r = f(0) + f(0);");
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run(source));
+    TEST_ASSERT_EQUAL_INT(1200, (int)AS_NUMBER(global_get("r")));
+}
+
+TEST(calls, errors)
+{
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, source_run("fn f(a) {} f();"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, source_run("let x = 1; x();"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, source_run("fn f() { return f() + 1; } f();"));
+    TEST_ASSERT_EQUAL_INT(0, vm.frame_count);
+    TEST_ASSERT_EQUAL_PTR(vm.stack, vm.stack_top);
+}
+
+TEST(calls, tail_calls)
+{
+    // A chain of tail calls far deeper than the frame array, so
+    // it only runs if each call reuses its caller's frame.
+    static char source[262144];
+    char* cursor = source;
+    cursor += sprintf(cursor, "fn f0(n) { return n; }\n");
+    for (int i = 1; i < 5000; i++)
+    {
+        cursor += sprintf(cursor, "fn f%d(n) { return f%d(n + 1); }\n", i, i - 1);
+    }
+    sprintf(cursor, "let r = f4999(0);\n");
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run(source));
+    TEST_ASSERT_EQUAL_INT(4999, (int)AS_NUMBER(global_get("r")));
+    TEST_ASSERT_EQUAL_INT(0, vm.frame_count);
+    TEST_ASSERT_EQUAL_PTR(vm.stack, vm.stack_top);
+
+    // The caller's cell is closed before its frame is reused, and
+    // only the outermost call of a nested return is a tail call.
+    const char* closing =
+        "fn h(k) { return k(); }\n"
+        "fn f() { let x = 1; fn g() { return x; } x = 2; return h(g); }\n"
+        "fn add1(n) { return n + 1; }\n"
+        "fn twice(n) { return add1(add1(n)); }\n"
+        "let s = f() * 10 + twice(5);\n";
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run(closing));
+    TEST_ASSERT_EQUAL_INT(27, (int)AS_NUMBER(global_get("s")));
+    TEST_ASSERT_NULL(vm.open_upvalues);
+}
+
+TEST_GROUP_RUNNER(calls)
+{
+    RUN_TEST_CASE(calls, arguments);
+    RUN_TEST_CASE(calls, closures);
+    RUN_TEST_CASE(calls, stack_grows);
+    RUN_TEST_CASE(calls, errors);
+    RUN_TEST_CASE(calls, tail_calls);
+}
+
+TEST_GROUP(instances);
+
+TEST_SETUP(instances)
+{
+    vm_init(&vm);
+}
+
+TEST_TEAR_DOWN(instances)
+{
+    vm_free(&vm);
+}
+
+TEST(instances, separate)
+{
+    VM other;
+    vm_init(&other);
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run("let a = 1; let c = 10; let s = \"only in one\";"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run_on(&other, "let b = 2; let c = 20;"));
+
+    Value value;
+    TEST_ASSERT_TRUE(global_find(&vm, "a", &value));
+    TEST_ASSERT_EQUAL_INT(1, (int)AS_NUMBER(value));
+    TEST_ASSERT_FALSE(global_find(&vm, "b", &value));
+    TEST_ASSERT_TRUE(global_find(&other, "b", &value));
+    TEST_ASSERT_EQUAL_INT(2, (int)AS_NUMBER(value));
+    TEST_ASSERT_FALSE(global_find(&other, "a", &value));
+
+    // The same name is a different global in each.
+    TEST_ASSERT_TRUE(global_find(&vm, "c", &value));
+    TEST_ASSERT_EQUAL_INT(10, (int)AS_NUMBER(value));
+    TEST_ASSERT_TRUE(global_find(&other, "c", &value));
+    TEST_ASSERT_EQUAL_INT(20, (int)AS_NUMBER(value));
+
+    // Each interns its own strings.
+    TEST_ASSERT_TRUE(string_interned(&vm, "only in one"));
+    TEST_ASSERT_FALSE(string_interned(&other, "only in one"));
+    ObjString* mine = string_copy(&vm, "shared", 6);
+    ObjString* theirs = string_copy(&other, "shared", 6);
+    TEST_ASSERT_TRUE(mine != theirs);
+    TEST_ASSERT_EQUAL_PTR(mine, string_copy(&vm, "shared", 6));
+    TEST_ASSERT_EQUAL_PTR(theirs, string_copy(&other, "shared", 6));
+
+    // Freeing one leaves the other running.
+    vm_free(&other);
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, source_run("let d = a + c; let t = s + \"!\";"));
+    TEST_ASSERT_EQUAL_INT(11, (int)AS_NUMBER(global_get("d")));
+    TEST_ASSERT_TRUE(string_interned(&vm, "only in one!"));
+}
+
+#ifdef HAVE_PTHREADS
+
+#define INSTANCE_COUNT 2
+#define INSTANCE_LINES 2000
+
+typedef struct
+{
+    int id;
+    char source[INSTANCE_LINES * 64];
+    InterpretResult result;
+    double total;
+    // Whether the other instance's strings turned up in this one.
+    bool leaked;
+} Instance;
+
+static Instance instances[INSTANCE_COUNT];
+
+static void* instance_run(void* argument)
+{
+    Instance* instance = argument;
+    char* cursor = instance->source;
+    cursor += sprintf(cursor, "let total = 0;\n");
+    for (int i = 0; i < INSTANCE_LINES; i++)
+    {
+        cursor += sprintf(cursor, "total = total + %d; let s%d = \"vm%d_\" + \"%d\";\n",
+                          i * (instance->id + 1), i, instance->id, i);
+    }
+
+    VM target;
+    vm_init(&target);
+    instance->result = source_run_on(&target, instance->source);
+    Value total;
+    instance->total = global_find(&target, "total", &total) ? AS_NUMBER(total) : -1;
+    char other[32];
+    for (int i = 0; i < INSTANCE_LINES && !instance->leaked; i++)
+    {
+        sprintf(other, "vm%d_%d", 1 - instance->id, i);
+        instance->leaked = string_interned(&target, other);
+    }
+    vm_free(&target);
+    return NULL;
+}
+
+TEST(instances, threads)
+{
+    pthread_t threads[INSTANCE_COUNT];
+    for (int i = 0; i < INSTANCE_COUNT; i++)
+    {
+        instances[i].id = i;
+        instances[i].leaked = false;
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, instance_run, &instances[i]));
+    }
+    for (int i = 0; i < INSTANCE_COUNT; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    int sum = INSTANCE_LINES * (INSTANCE_LINES - 1) / 2;
+    for (int i = 0; i < INSTANCE_COUNT; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(INTERPRET_OK, instances[i].result);
+        TEST_ASSERT_EQUAL_INT(sum * (i + 1), (int)instances[i].total);
+        TEST_ASSERT_FALSE(instances[i].leaked);
+    }
+}
+
+#endif
+
+TEST_GROUP_RUNNER(instances)
+{
+    RUN_TEST_CASE(instances, separate);
+#ifdef HAVE_PTHREADS
+    RUN_TEST_CASE(instances, threads);
+#endif
+}
+
+static void tests_run(void)
+{
+    RUN_TEST_GROUP(stack);
+    RUN_TEST_GROUP(variables);
+    RUN_TEST_GROUP(closures);
+    RUN_TEST_GROUP(calls);
+    RUN_TEST_GROUP(instances);
+}
+
+int main(int argc, const char* argv[])
+{
+    return UnityMain(argc, argv, tests_run);
+}
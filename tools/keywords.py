@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""Generate the scanner's keyword table.
+
+Finds a collision-free hash of a keyword's length and first and
+last characters, and writes the table indexed by it to
+src/keywords.inc. Rerun after changing KEYWORDS:
+
+    python3 tools/keywords.py
+"""
+
+import os
+import sys
+
+KEYWORDS = {
+    "and": "TOKEN_AND",
+    "class": "TOKEN_CLASS",
+    "else": "TOKEN_ELSE",
+    "false": "TOKEN_FALSE",
+    "fn": "TOKEN_FN",
+    "for": "TOKEN_FOR",
+    "if": "TOKEN_IF",
+    "let": "TOKEN_LET",
+    "nil": "TOKEN_NIL",
+    "or": "TOKEN_OR",
+    "print": "TOKEN_PRINT",
+    "return": "TOKEN_RETURN",
+    "super": "TOKEN_SUPER",
+    "this": "TOKEN_THIS",
+    "true": "TOKEN_TRUE",
+    "while": "TOKEN_WHILE",
+}
+
+OUTPUT = os.path.join(os.path.dirname(__file__), "..", "src", "keywords.inc")
+
+
+def keyword_hash(word, size, multipliers):
+    a, b, c = multipliers
+    return (len(word) * a + ord(word[0]) * b + ord(word[-1]) * c) & (size - 1)
+
+
+def hash_find():
+    """Find the smallest table, then the smallest multipliers, with no collisions."""
+    size = 16
+    while size < len(KEYWORDS):
+        size *= 2
+
+    while True:
+        for a in range(16):
+            for b in range(1, 16):
+                for c in range(16):
+                    slots = {keyword_hash(word, size, (a, b, c)) for word in KEYWORDS}
+                    if len(slots) == len(KEYWORDS):
+                        return size, (a, b, c)
+        size *= 2
+
+
+def main():
+    size, (a, b, c) = hash_find()
+    table = {keyword_hash(word, size, (a, b, c)): word for word in KEYWORDS}
+    lengths = [len(word) for word in KEYWORDS]
+
+    lines = [
+        "// Generated by tools/keywords.py, do not edit.",
+        "",
+        "#define KEYWORD_LENGTH_MIN %d" % min(lengths),
+        "#define KEYWORD_LENGTH_MAX %d" % max(lengths),
+        "#define KEYWORD_TABLE_SIZE %d" % size,
+        "",
+        "#define KEYWORD_HASH(length, first, last) \\",
+        "    (((length) * %d + (first) * %d + (last) * %d) & (KEYWORD_TABLE_SIZE - 1))" % (a, b, c),
+        "",
+        "static const Keyword keywords[KEYWORD_TABLE_SIZE] = {",
+    ]
+    for slot in sorted(table):
+        word = table[slot]
+        lines.append("    [%d] = { \"%s\", %d, %s }," % (slot, word, len(word), KEYWORDS[word]))
+    lines.append("};")
+
+    with open(OUTPUT, "w") as output:
+        output.write("\n".join(lines) + "\n")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())